@@ -21,6 +21,7 @@ public class LuminanceCalculationModule: ModuleRules
 		PublicDependencyModuleNames.Add("Core");
 		PublicDependencyModuleNames.Add("Engine");
 		PublicDependencyModuleNames.Add("MaterialShaderQualitySettings");
+		PublicDependencyModuleNames.Add("VisibilityCore");
 		
 		PrivateDependencyModuleNames.AddRange(new string[]
 		{
@@ -1,250 +1,110 @@
 #include "LuminanceCalculationShader.h"
 #include "LuminanceCalculationModule/Public/LuminanceCalculationShader/LuminanceCalculationShader.h"
-#include "PixelShaderUtils.h"
-#include "MeshPassProcessor.inl"
-#include "StaticMeshResources.h"
-#include "DynamicMeshBuilder.h"
-#include "RenderGraphResources.h"
-#include "GlobalShader.h"
-#include "UnifiedBuffer.h"
-#include "CanvasTypes.h"
-#include "MeshDrawShaderBindings.h"
-#include "RHIGPUReadback.h"
-#include "MeshPassUtils.h"
-#include "MaterialShader.h"
-
-DECLARE_STATS_GROUP(TEXT("LuminanceCalculationShader"), STATGROUP_LuminanceCalculationShader, STATCAT_Advanced);
-DECLARE_CYCLE_STAT(TEXT("LuminanceCalculationShader Execute"), STAT_LuminanceCalculationShader_Execute, STATGROUP_LuminanceCalculationShader);
-
-// This class carries our parameter declarations and acts as the bridge between cpp and HLSL.
-class LUMINANCECALCULATIONMODULE_API FLuminanceCalculationShader: public FGlobalShader
-{
-public:
-	
-	DECLARE_GLOBAL_SHADER(FLuminanceCalculationShader);
-	SHADER_USE_PARAMETER_STRUCT(FLuminanceCalculationShader, FGlobalShader);
-	
-	
-	class FLuminanceCalculationShader_Perm_TEST : SHADER_PERMUTATION_INT("TEST", 1);
-	using FPermutationDomain = TShaderPermutationDomain<
-		FLuminanceCalculationShader_Perm_TEST
-	>;
-
-	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
-		/*
-		* Here's where you define one or more of the input parameters for your shader.
-		* Some examples:
-		*/
-		// SHADER_PARAMETER(uint32, MyUint32) // On the shader side: uint32 MyUint32;
-		// SHADER_PARAMETER(FVector3f, MyVector) // On the shader side: float3 MyVector;
-
-		// SHADER_PARAMETER_TEXTURE(Texture2D, MyTexture) // On the shader side: Texture2D<float4> MyTexture; (float4 should be whatever you expect each pixel in the texture to be, in this case float4(R,G,B,A) for 4 channels)
-		// SHADER_PARAMETER_SAMPLER(SamplerState, MyTextureSampler) // On the shader side: SamplerState MySampler; // CPP side: TStaticSamplerState<ESamplerFilter::SF_Bilinear>::GetRHI();
-
-		// SHADER_PARAMETER_ARRAY(float, MyFloatArray, [3]) // On the shader side: float MyFloatArray[3];
-
-		// SHADER_PARAMETER_UAV(RWTexture2D<FVector4f>, MyTextureUAV) // On the shader side: RWTexture2D<float4> MyTextureUAV;
-		// SHADER_PARAMETER_UAV(RWStructuredBuffer<FMyCustomStruct>, MyCustomStructs) // On the shader side: RWStructuredBuffer<FMyCustomStruct> MyCustomStructs;
-		// SHADER_PARAMETER_UAV(RWBuffer<FMyCustomStruct>, MyCustomStructs) // On the shader side: RWBuffer<FMyCustomStruct> MyCustomStructs;
-
-		// SHADER_PARAMETER_SRV(StructuredBuffer<FMyCustomStruct>, MyCustomStructs) // On the shader side: StructuredBuffer<FMyCustomStruct> MyCustomStructs;
-		// SHADER_PARAMETER_SRV(Buffer<FMyCustomStruct>, MyCustomStructs) // On the shader side: Buffer<FMyCustomStruct> MyCustomStructs;
-		// SHADER_PARAMETER_SRV(Texture2D<FVector4f>, MyReadOnlyTexture) // On the shader side: Texture2D<float4> MyReadOnlyTexture;
-
-		// SHADER_PARAMETER_STRUCT_REF(FMyCustomStruct, MyCustomStruct)
-
-		
-		//SHADER_PARAMETER_RDG_BUFFER_SRV(Buffer<int>, Input)
-		SHADER_PARAMETER_RDG_TEXTURE(Texture2D, InputTexture)
-		SHADER_PARAMETER_RDG_BUFFER_UAV(RWBuffer<int>, Output)
-		
-
-	END_SHADER_PARAMETER_STRUCT()
-
-public:
-	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
-	{
-		const FPermutationDomain PermutationVector(Parameters.PermutationId);
-		
-		return true;
-	}
+#include "ScreenRect/VisibilityScreenRect.h"
 
-	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
-	{
-		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+// Reduces the frame into the summed brightness of its non-dark texels, see LuminanceCalculationShader.usf
+DECLARE_VISIBILITY_REDUCTION_SHADER(FLuminanceCalculationReductionShader, 1)
 
-		const FPermutationDomain PermutationVector(Parameters.PermutationId);
+// This will tell the engine to create the shader and where the shader entry point is.
+IMPLEMENT_VISIBILITY_REDUCTION_SHADER(FLuminanceCalculationReductionShader, "/LuminanceCalculationModuleShaders/LuminanceCalculationShader/LuminanceCalculationShader.usf");
 
-		/*
-		* Here you define constants that can be used statically in the shader code.
-		* Example:
-		*/
-		// OutEnvironment.SetDefine(TEXT("MY_CUSTOM_CONST"), TEXT("1"));
+struct FLuminanceCalculationMetric
+{
+	using FShader = FLuminanceCalculationReductionShader;
+	using FResult = FLuminanceCalculationShaderResult;
 
-		/*
-		* These defines are used in the thread count section of our shader
-		*/
-		OutEnvironment.SetDefine(TEXT("THREADS_X"), NUM_THREADS_LuminanceCalculationShader_X);
-		OutEnvironment.SetDefine(TEXT("THREADS_Y"), NUM_THREADS_LuminanceCalculationShader_Y);
-		OutEnvironment.SetDefine(TEXT("THREADS_Z"), NUM_THREADS_LuminanceCalculationShader_Z);
+	static constexpr ERDGPassFlags PassFlags = ERDGPassFlags::AsyncCompute;
 
-		// This shader must support typed UAV load and we are testing if it is supported at runtime using RHIIsTypedUAVLoadSupported
-		//OutEnvironment.CompilerFlags.Add(CFLAG_AllowTypedUAVLoads);
+	static const TCHAR* GetName() { return TEXT("LuminanceCalculationShader"); }
 
-		// FForwardLightingParameters::ModifyCompilationEnvironment(Parameters.Platform, OutEnvironment);
+	static FResult Decode(const int64* Channels, double ScreenArea)
+	{
+		FResult Result;
+		Result.BrightnessSum = Channels[0];
+		Result.MeanBrightness = FVisibilityCoverage::Normalize(Channels[0], ScreenArea);
+		return Result;
 	}
-private:
 };
 
+IMPLEMENT_VISIBILITY_REDUCTION_METRIC(FLuminanceCalculationMetric)
 
-FRDGTextureRef FLuminanceCalculationShaderInterface::RegisterRenderTarget(UTextureRenderTarget2D* RenderTarget, FRDGBuilder& GraphBuilder, string VariableName)
+FVisibilityReductionInputs FLuminanceCalculationShaderInterface::MakeInputs(const FLuminanceCalculationShaderDispatchParams& Params)
 {
+	FVisibilityReductionInputs Inputs(Params.RenderTarget);
+	Inputs.ViewRect = Params.ViewRect;
+	Inputs.ScreenAspectRatio = Params.ScreenAspectRatio;
+	Inputs.ScreenRect = Params.ScreenRect;
+	Inputs.bRestrictToScreenRect = Params.bRestrictToScreenRect;
+	Inputs.bUseTileCompaction = Params.bUseTileCompaction;
+	Inputs.bCapture = Params.bCapture;
+	return Inputs;
+}
 
-	if (!RenderTarget)
-	{
-		UE_LOG(LogTemp, Warning, TEXT("RenderTarget is null."));
+FRDGTextureRef FLuminanceCalculationShaderInterface::RegisterRenderTarget(UTextureRenderTarget* RenderTarget, FRDGBuilder& GraphBuilder, string VariableName)
+{
+	FString tmp = UTF8_TO_TCHAR(VariableName.c_str());
+	return FVisibilityReductionPassBuilder::RegisterRenderTarget(RenderTarget, GraphBuilder, *tmp);
+}
 
-	}
-	const FTextureRenderTargetResource* RTResource = RenderTarget->GetRenderTargetResource();
-	if (!RTResource)
-	{
-		UE_LOG(LogTemp, Warning, TEXT("RTResource is null."));
+bool FLuminanceCalculationShaderInterface::ComputeScreenRect(const FBox& WorldBounds, const FMatrix& ViewProjectionMatrix, FIntPoint TextureSize, FIntRect& OutRect, int32 Padding)
+{
+	return FVisibilityScreenRect::Compute(WorldBounds, ViewProjectionMatrix, TextureSize, OutRect, Padding);
+}
 
-	}
+bool FLuminanceCalculationShaderInterface::ComputeScreenRect(const AActor* Actor, const USceneCaptureComponent2D* Capture, FIntRect& OutRect, int32 Padding)
+{
+	return FVisibilityScreenRect::Compute(Actor, Capture, OutRect, Padding);
+}
 
-	FRHITexture* TextureRHI = RTResource->GetRenderTargetTexture();
-	if (!TextureRHI)
-	{
-		UE_LOG(LogTemp, Warning, TEXT("TextureRHI is null."));
+void FLuminanceCalculationShaderInterface::DispatchTyped(const FLuminanceCalculationShaderDispatchParams& Params, TFunction<void(const FLuminanceCalculationShaderResult& Result)> AsyncCallback)
+{
+	TVisibilityReductionPass<FLuminanceCalculationMetric>::Dispatch(MakeInputs(Params), MoveTemp(AsyncCallback));
+}
 
-	}
+void FLuminanceCalculationShaderInterface::DispatchSlices(const FLuminanceCalculationShaderDispatchParams& Params, TFunction<void(const TArray<FLuminanceCalculationShaderResult>& SliceResults, const FLuminanceCalculationShaderResult& Total)> AsyncCallback)
+{
+	TVisibilityReductionPass<FLuminanceCalculationMetric>::DispatchSlices(MakeInputs(Params), MoveTemp(AsyncCallback));
+}
 
-	FSceneRenderTargetItem RenderTargetItem;
-	RenderTargetItem.TargetableTexture = TextureRHI;
-	RenderTargetItem.ShaderResourceTexture = TextureRHI;
-
-	FPooledRenderTargetDesc RenderTargetDesc = FPooledRenderTargetDesc::Create2DDesc(
-		RTResource->GetSizeXY(),        // Texture resolution 
-		TextureRHI->GetFormat(),             // Pixel format 
-		FClearValueBinding::Black,                // Initial clear value
-		TexCreate_None,
-		TexCreate_RenderTargetable |              // Can be used as a render target
-		TexCreate_ShaderResource |                // Can be sampled in shaders
-		TexCreate_UAV,                            // Can be written via UAV (compute shaders)
-		false
-	);
-	TRefCountPtr<IPooledRenderTarget> PooledRenderTarget;
-	GRenderTargetPool.CreateUntrackedElement(
-		RenderTargetDesc,
-		PooledRenderTarget,
-		RenderTargetItem         // Links to existing RenderTargetRHI
-	);
-	FString tmp = UTF8_TO_TCHAR(VariableName.c_str());
-	FRDGTextureRef RDGInputTexture =
-		GraphBuilder.RegisterExternalTexture(PooledRenderTarget, *tmp);
+void FLuminanceCalculationShaderInterface::DispatchToStream(const FLuminanceCalculationShaderDispatchParams& Params, const TSharedRef<FLuminanceCalculationShaderResultStream, ESPMode::ThreadSafe>& Stream, uint64 Tag)
+{
+	TVisibilityReductionPass<FLuminanceCalculationMetric>::DispatchToStream(MakeInputs(Params), Stream, Tag);
+}
 
-	return RDGInputTexture;
+FVisibilityRequestHandle FLuminanceCalculationShaderInterface::Request(const FLuminanceCalculationShaderDispatchParams& Params, TUniqueFunction<void(bool bSuccess, const FLuminanceCalculationShaderResult& Result)>&& OnComplete, const UObject* Owner)
+{
+	return TVisibilityRequests<FLuminanceCalculationMetric>::Request(MakeInputs(Params), MoveTemp(OnComplete), Owner);
+}
 
+TFuture<TOptional<FLuminanceCalculationShaderResult>> FLuminanceCalculationShaderInterface::RequestFuture(const FLuminanceCalculationShaderDispatchParams& Params, FVisibilityRequestHandle* OutHandle)
+{
+	return TVisibilityRequests<FLuminanceCalculationMetric>::RequestFuture(MakeInputs(Params), OutHandle);
 }
 
-// This will tell the engine to create the shader and where the shader entry point is.
-//                            ShaderType                            ShaderPath                     Shader function name    Type
-IMPLEMENT_GLOBAL_SHADER(FLuminanceCalculationShader, "/LuminanceCalculationModuleShaders/LuminanceCalculationShader/LuminanceCalculationShader.usf", "LuminanceCalculationShader", SF_Compute);
+FVisibilityRequestHandle FLuminanceCalculationShaderInterface::RequestPolled(const FLuminanceCalculationShaderDispatchParams& Params)
+{
+	return TVisibilityRequests<FLuminanceCalculationMetric>::Request(MakeInputs(Params));
+}
 
-void FLuminanceCalculationShaderInterface::DispatchRenderThread(FRHICommandListImmediate& RHICmdList, FLuminanceCalculationShaderDispatchParams Params, TFunction<void(int OutputVal)> AsyncCallback) {
-	FRDGBuilder GraphBuilder(RHICmdList);
+EVisibilityRequestStatus FLuminanceCalculationShaderInterface::Poll(FVisibilityRequestHandle& Handle, FLuminanceCalculationShaderResult& OutResult)
+{
+	return TVisibilityRequests<FLuminanceCalculationMetric>::Poll(Handle, OutResult);
+}
 
-	{
-		SCOPE_CYCLE_COUNTER(STAT_LuminanceCalculationShader_Execute);
-		DECLARE_GPU_STAT(LuminanceCalculationShader)
-		RDG_EVENT_SCOPE(GraphBuilder, "LuminanceCalculationShader");
-		RDG_GPU_STAT_SCOPE(GraphBuilder, LuminanceCalculationShader);
-		
-		typename FLuminanceCalculationShader::FPermutationDomain PermutationVector;
-		
-		// Add any static permutation options here
-		// PermutationVector.Set<FLuminanceCalculationShader::FMyPermutationName>(12345);
-
-		TShaderMapRef<FLuminanceCalculationShader> ComputeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel), PermutationVector);
-		
-
-		bool bIsShaderValid = ComputeShader.IsValid();
-
-		if (bIsShaderValid) {
-			FLuminanceCalculationShader::FParameters* PassParameters = GraphBuilder.AllocParameters<FLuminanceCalculationShader::FParameters>();
-
-			
-			//const void* RawData = (void*)Params.Input;
-			//int NumInputs = 2;
-			//int InputSize = sizeof(int);
-			//FRDGBufferRef InputBuffer = CreateUploadBuffer(GraphBuilder, TEXT("InputBuffer"), InputSize, NumInputs, RawData, InputSize * NumInputs);
-
-			//PassParameters->Input = GraphBuilder.CreateSRV(FRDGBufferSRVDesc(InputBuffer, PF_R32_SINT));
-
-			// RenderTarget->RTResource->TextureRHI->RenderPoolTarget->FRDGTextereRef
-
-			FRDGTextureRef RenderTargetRDGRef = RegisterRenderTarget(Params.RenderTarget, GraphBuilder, "InputTexture");
-
-			FRDGBufferRef OutputBuffer = GraphBuilder.CreateBuffer(
-				FRDGBufferDesc::CreateBufferDesc(sizeof(int32), 1),
-				TEXT("OutputBuffer"));
-
-			PassParameters->Output = GraphBuilder.CreateUAV(FRDGBufferUAVDesc(OutputBuffer, PF_R32_SINT));
-			PassParameters->InputTexture = RenderTargetRDGRef;
-
-			//auto GroupCount = FComputeShaderUtils::GetGroupCount(FIntVector(Params.X, Params.Y, Params.Z), FComputeShaderUtils::kGolden2DGroupSize);
-			FIntPoint TextureSize = RenderTargetRDGRef->Desc.Extent;
-			FIntVector GroupCount(
-				FMath::DivideAndRoundUp(TextureSize.X, 32),
-				FMath::DivideAndRoundUp(TextureSize.Y, 32),
-				1
-			);
-			GraphBuilder.AddPass(
-				RDG_EVENT_NAME("ExecuteLuminanceCalculationShader"),
-				PassParameters,
-				ERDGPassFlags::AsyncCompute,
-				[&PassParameters, ComputeShader, GroupCount](FRHIComputeCommandList& RHICmdList)
-			{
-				FComputeShaderUtils::Dispatch(RHICmdList, ComputeShader, *PassParameters, GroupCount);
-			});
-
-			
-			FRHIGPUBufferReadback* GPUBufferReadback = new FRHIGPUBufferReadback(TEXT("ExecuteLuminanceCalculationShaderOutput"));
-			AddEnqueueCopyPass(GraphBuilder, GPUBufferReadback, OutputBuffer, 0u);
-
-			auto RunnerFunc = [GPUBufferReadback, AsyncCallback](auto&& RunnerFunc) -> void {
-				if (GPUBufferReadback->IsReady()) {
-					
-					int32* Buffer = (int32*)GPUBufferReadback->Lock(1);
-					int OutVal = Buffer[0];
-					
-					GPUBufferReadback->Unlock();
-
-					AsyncTask(ENamedThreads::GameThread, [AsyncCallback, OutVal]() {
-						AsyncCallback(OutVal);
-					});
-
-					delete GPUBufferReadback;
-				} else {
-					AsyncTask(ENamedThreads::ActualRenderingThread, [RunnerFunc]() {
-						RunnerFunc(RunnerFunc);
-					});
-				}
-			};
-
-			AsyncTask(ENamedThreads::ActualRenderingThread, [RunnerFunc]() {
-				RunnerFunc(RunnerFunc);
-			});
-			
-		} else {
-			#if WITH_EDITOR
-				GEngine->AddOnScreenDebugMessage((uint64)42145125184, 6.f, FColor::Red, FString(TEXT("The compute shader has a problem.")));
-			#endif
-
-			// We exit here as we don't want to crash the game if the shader is not found or has an error.
-			
-		}
-	}
+bool FLuminanceCalculationShaderInterface::Cancel(FVisibilityRequestHandle Handle)
+{
+	return TVisibilityRequests<FLuminanceCalculationMetric>::Cancel(Handle);
+}
 
-	GraphBuilder.Execute();
-}
\ No newline at end of file
+bool FLuminanceCalculationShaderInterface::RequestCached(const FLuminanceCalculationShaderDispatchParams& Params, const AActor* Actor, const USceneCaptureComponent2D* Capture, TUniqueFunction<void(bool bSuccess, const FLuminanceCalculationShaderResult& Result)>&& OnComplete, const UObject* Owner, float MaxAge)
+{
+	return TVisibilityCachedRequests<FLuminanceCalculationMetric>::Request(MakeInputs(Params), Actor, Capture, MoveTemp(OnComplete), Owner, MaxAge);
+}
+
+void FLuminanceCalculationShaderInterface::DispatchRenderThread(FRHICommandListImmediate& RHICmdList, FLuminanceCalculationShaderDispatchParams Params, TFunction<void(int OutputVal)> AsyncCallback) {
+	TVisibilityReductionPass<FLuminanceCalculationMetric>::DispatchRenderThread(RHICmdList, MakeInputs(Params),
+		[AsyncCallback](const FLuminanceCalculationShaderResult& Result)
+		{
+			AsyncCallback((int32)FMath::Min<int64>(Result.BrightnessSum, MAX_int32));
+		});
+}
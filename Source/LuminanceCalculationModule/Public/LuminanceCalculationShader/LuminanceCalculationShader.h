@@ -4,9 +4,18 @@
 #include "GenericPlatform/GenericPlatformMisc.h"
 #include "Kismet/BlueprintAsyncActionBase.h"
 #include "Engine/TextureRenderTarget2D.h"
+#include "Engine/TextureRenderTargetCube.h"
+#include "Engine/TextureRenderTarget2DArray.h"
 #include "Materials/MaterialRenderProxy.h"
+#include "ReductionPass/VisibilityReductionPass.h"
+#include "Requests/VisibilityRequests.h"
+#include "ResultCache/VisibilityResultCache.h"
 
 #include "LuminanceCalculationShader.generated.h"
+
+class AActor;
+class USceneCaptureComponent2D;
+
 using std::string;
 struct LUMINANCECALCULATIONMODULE_API FLuminanceCalculationShaderDispatchParams
 {
@@ -14,34 +23,103 @@ struct LUMINANCECALCULATIONMODULE_API FLuminanceCalculationShaderDispatchParams
 	int Y;
 	int Z;
 
-	UTextureRenderTarget2D* RenderTarget;
+	// UTextureRenderTargetCube and UTextureRenderTarget2DArray inputs are measured slice by slice in one dispatch,
+	// see FLuminanceCalculationShaderInterface::DispatchSlices
+	UTextureRenderTarget* RenderTarget;
 	int Output;
+
+	// Optional RenderTarget-space rect the view was rendered to, f.e. with dynamic resolution. Empty means the whole texture
+	FIntRect ViewRect;
+	// Aspect ratio (width / height) of the screen MeanBrightness is relative to, 0 for the aspect of the view rect
+	float ScreenAspectRatio;
+
+	// Optional RenderTarget-space rect to accumulate over (Max is exclusive), clamped to the texture extent on the render thread.
+	// Brightness is only summed inside it, see FVisibilityScreenRect
+	FIntRect ScreenRect;
+	bool bRestrictToScreenRect;
+
+	// Runs a coarse pass that lists the 32x32 tiles holding non-dark texels, then sums brightness only over those tiles
+	// via an indirect dispatch. Also forced globally by r.VisibilityCore.TileCompaction
+	bool bUseTileCompaction;
+
+	// Snapshots this dispatch into the running frame capture (r.VisibilityCore.Capture.Start) for offline replay,
+	// see FVisibilityFrameCapture
+	bool bCapture;
 	
-	FLuminanceCalculationShaderDispatchParams(int x, int y, int z, UTextureRenderTarget2D* RenderTarget)
+	FLuminanceCalculationShaderDispatchParams(int x, int y, int z, UTextureRenderTarget* RenderTarget)
 		: X(x)
 		, Y(y)
 		, Z(z)
 		, RenderTarget(RenderTarget)
+		, ScreenAspectRatio(0.f)
+		, bRestrictToScreenRect(false)
+		, bUseTileCompaction(false)
+		, bCapture(false)
 	{
 	}
 };
 
+// Typed result of the LuminanceCalculationShader reduction
+struct LUMINANCECALCULATIONMODULE_API FLuminanceCalculationShaderResult
+{
+	// Sum of the floored perceived brightness (L*, 0..100) of every non-dark texel. Depends on the capture resolution
+	int64 BrightnessSum = 0;
+	// BrightnessSum over the screen area, the mean brightness with dark texels counted as 0. The same at any capture
+	// resolution, see FVisibilityCoverage
+	float MeanBrightness = 0.f;
+};
+
+// Results delivered in bulk from the render thread, see FLuminanceCalculationShaderInterface::DispatchToStream
+using FLuminanceCalculationShaderResultStream = TVisibilityResultStream<FLuminanceCalculationShaderResult>;
+
 // This is a public interface that we define so outside code can invoke our compute shader.
+// A thin wrapper over TVisibilityReductionPass, kept for existing callers
 class LUMINANCECALCULATIONMODULE_API FLuminanceCalculationShaderInterface {
 public:
-	// Executes this shader on the render thread
+	// Reduction inputs matching Params
+	static FVisibilityReductionInputs MakeInputs(const FLuminanceCalculationShaderDispatchParams& Params);
+
+	// Typed variant, the result is delivered on the game thread
+	static void DispatchTyped(const FLuminanceCalculationShaderDispatchParams& Params, TFunction<void(const FLuminanceCalculationShaderResult& Result)> AsyncCallback);
+
+	// Per slice variant for cube and 2D array inputs: one result per face or slice plus their sum, from a single dispatch and readback
+	static void DispatchSlices(const FLuminanceCalculationShaderDispatchParams& Params, TFunction<void(const TArray<FLuminanceCalculationShaderResult>& SliceResults, const FLuminanceCalculationShaderResult& Total)> AsyncCallback);
+
+	// Pushes the result with Tag into Stream on the render thread, for owners draining many results in bulk, see TVisibilityResultStream. Any thread
+	static void DispatchToStream(const FLuminanceCalculationShaderDispatchParams& Params, const TSharedRef<FLuminanceCalculationShaderResultStream, ESPMode::ThreadSafe>& Stream, uint64 Tag);
+
+	// Executes this shader on the render thread. OutputVal saturates at MAX_int32, the typed entry points return the whole BrightnessSum
 	static void DispatchRenderThread(
 		FRHICommandListImmediate& RHICmdList,
 		FLuminanceCalculationShaderDispatchParams Params,
 		TFunction<void(int OutputVal)> AsyncCallback
 	);
-	static FRDGTextureRef RegisterRenderTarget(UTextureRenderTarget2D* RenderTarget, FRDGBuilder& GraphBuilder, string VariableName);
+	static FRDGTextureRef RegisterRenderTarget(UTextureRenderTarget* RenderTarget, FRDGBuilder& GraphBuilder, string VariableName);
+
+	// See FVisibilityScreenRect::Compute
+	static bool ComputeScreenRect(const FBox& WorldBounds, const FMatrix& ViewProjectionMatrix, FIntPoint TextureSize, FIntRect& OutRect, int32 Padding = 2);
+	static bool ComputeScreenRect(const AActor* Actor, const USceneCaptureComponent2D* Capture, FIntRect& OutRect, int32 Padding = 2);
+
+	// Pooled request API, see FVisibilityRequests. Game thread only. Identical requests made in the same frame share one dispatch,
+	// OnComplete is called on the game thread and dropped if Owner has been garbage collected
+	static FVisibilityRequestHandle Request(const FLuminanceCalculationShaderDispatchParams& Params, TUniqueFunction<void(bool bSuccess, const FLuminanceCalculationShaderResult& Result)>&& OnComplete, const UObject* Owner = nullptr);
+	static TFuture<TOptional<FLuminanceCalculationShaderResult>> RequestFuture(const FLuminanceCalculationShaderDispatchParams& Params, FVisibilityRequestHandle* OutHandle = nullptr);
+	// Polled variant of Request. Poll until it returns Ready or Failed, or Cancel the handle
+	static FVisibilityRequestHandle RequestPolled(const FLuminanceCalculationShaderDispatchParams& Params);
+	static EVisibilityRequestStatus Poll(FVisibilityRequestHandle& Handle, FLuminanceCalculationShaderResult& OutResult);
+	static bool Cancel(FVisibilityRequestHandle Handle);
+	// Cached variant of Request for a measured Actor seen by Capture, see FVisibilityResultCache. Returns true when the result
+	// was still valid, OnComplete has been called then. MaxAge in seconds, negative uses r.VisibilityCore.Cache.MaxAge
+	static bool RequestCached(const FLuminanceCalculationShaderDispatchParams& Params, const AActor* Actor, const USceneCaptureComponent2D* Capture, TUniqueFunction<void(bool bSuccess, const FLuminanceCalculationShaderResult& Result)>&& OnComplete, const UObject* Owner = nullptr, float MaxAge = -1.f);
+
 	// Executes this shader on the render thread from the game thread via EnqueueRenderThreadCommand
 	static void DispatchGameThread(
 		FLuminanceCalculationShaderDispatchParams Params,
 		TFunction<void(int OutputVal)> AsyncCallback
 	)
 	{
+		// The inputs are only built on the render thread
+		FVisibilityRecorder::RegisterSource(Params.RenderTarget);
 		ENQUEUE_RENDER_COMMAND(SceneDrawCompletion)(
 		[Params, AsyncCallback](FRHICommandListImmediate& RHICmdList)
 		{
@@ -82,17 +160,21 @@ public:
 		if (!RenderTarget) return;
 		FLuminanceCalculationShaderDispatchParams Params(1, 1, 1, RenderTarget);
 
-		// Dispatch the compute shader and wait until it completes
-		FLuminanceCalculationShaderInterface::Dispatch(Params, [this](int OutputVal) 
+		// Dispatch the compute shader. Passing this as the Owner drops the callback if the action is garbage collected first
+		FLuminanceCalculationShaderInterface::Request(Params, [this](bool bSuccess, const FLuminanceCalculationShaderResult& Result)
 		{
-			this->Completed.Broadcast(OutputVal);
-		});
+			if (bSuccess)
+			{
+				this->Completed.Broadcast((int32)FMath::Min<int64>(Result.BrightnessSum, MAX_int32));
+			}
+			SetReadyToDestroy();
+		}, this);
 	}
 	
 	
 	
 	UFUNCTION(BlueprintCallable, meta = (BlueprintInternalUseOnly = "true", Category = "ComputeShader", WorldContext = "WorldContextObject"))
-	static ULuminanceCalculationShaderLibrary_AsyncExecution* BrightnessCalculation(UObject* WorldContextObject, UTextureRenderTarget2D* RenderTarget)
+	static ULuminanceCalculationShaderLibrary_AsyncExecution* BrightnessCalculation(UObject* WorldContextObject, UTextureRenderTarget* RenderTarget)
 	{
 		ULuminanceCalculationShaderLibrary_AsyncExecution* Action = NewObject<ULuminanceCalculationShaderLibrary_AsyncExecution>();
 		Action->RenderTarget = RenderTarget;
@@ -105,5 +187,50 @@ public:
 	FOnLuminanceCalculationShaderLibrary_AsyncExecutionCompleted Completed;
 
 	
-	UTextureRenderTarget2D* RenderTarget;
-};
\ No newline at end of file
+	UTextureRenderTarget* RenderTarget;
+};
+
+// Separate from FOnLuminanceCalculationShaderLibrary_AsyncExecutionCompleted so Blueprints bound to the original node keep compiling
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FOnLuminanceCalculationShaderLibrary_MeanBrightnessAsyncExecutionCompleted, const int, Value, const float, MeanBrightness);
+
+// Same measurement as ULuminanceCalculationShaderLibrary_AsyncExecution, also reporting the mean brightness over the screen
+UCLASS()
+class LUMINANCECALCULATIONMODULE_API ULuminanceCalculationShaderLibrary_MeanBrightnessAsyncExecution : public UBlueprintAsyncActionBase
+{
+	GENERATED_BODY()
+
+public:
+	
+	virtual void Activate() override {
+		if (!RenderTarget) return;
+		FLuminanceCalculationShaderDispatchParams Params(1, 1, 1, RenderTarget);
+		Params.ScreenAspectRatio = ScreenAspectRatio;
+
+		FLuminanceCalculationShaderInterface::Request(Params, [this](bool bSuccess, const FLuminanceCalculationShaderResult& Result)
+		{
+			if (bSuccess)
+			{
+				this->Completed.Broadcast((int32)FMath::Min<int64>(Result.BrightnessSum, MAX_int32), Result.MeanBrightness);
+			}
+			SetReadyToDestroy();
+		}, this);
+	}
+
+	// ScreenAspectRatio is the aspect of the screen MeanBrightness is relative to, 0 for the aspect of RenderTarget
+	UFUNCTION(BlueprintCallable, meta = (BlueprintInternalUseOnly = "true", Category = "ComputeShader", WorldContext = "WorldContextObject"))
+	static ULuminanceCalculationShaderLibrary_MeanBrightnessAsyncExecution* MeanBrightnessCalculation(UObject* WorldContextObject, UTextureRenderTarget* RenderTarget, float ScreenAspectRatio = 0.f)
+	{
+		ULuminanceCalculationShaderLibrary_MeanBrightnessAsyncExecution* Action = NewObject<ULuminanceCalculationShaderLibrary_MeanBrightnessAsyncExecution>();
+		Action->RenderTarget = RenderTarget;
+		Action->ScreenAspectRatio = ScreenAspectRatio;
+		Action->RegisterWithGameInstance(WorldContextObject);
+
+		return Action;
+	}
+
+	UPROPERTY(BlueprintAssignable)
+	FOnLuminanceCalculationShaderLibrary_MeanBrightnessAsyncExecutionCompleted Completed;
+
+	UTextureRenderTarget* RenderTarget;
+	float ScreenAspectRatio;
+};
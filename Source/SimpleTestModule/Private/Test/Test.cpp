@@ -1,290 +1,112 @@
 #include "Test.h"
 #include "SimpleTestModule/Public/Test/Test.h"
-#include "PixelShaderUtils.h"
-#include "MeshPassProcessor.inl"
-#include "StaticMeshResources.h"
-#include "DynamicMeshBuilder.h"
-#include "RenderGraphResources.h"
-#include "GlobalShader.h"
-#include "UnifiedBuffer.h"
-#include "CanvasTypes.h"
-#include "MeshDrawShaderBindings.h"
-#include "RHIGPUReadback.h"
-#include "MeshPassUtils.h"
-#include "MaterialShader.h"
-#include "RHI.h"
+#include "ScreenRect/VisibilityScreenRect.h"
 
 using std::string;
 
-DECLARE_STATS_GROUP(TEXT("Test"), STATGROUP_Test, STATCAT_Advanced);
-DECLARE_CYCLE_STAT(TEXT("Test Execute"), STAT_Test_Execute, STATGROUP_Test);
+// Reduces the stencil mask into the number of object texels, see Test.usf
+DECLARE_VISIBILITY_REDUCTION_SHADER(FTestReductionShader, 1)
 
-// This class carries our parameter declarations and acts as the bridge between cpp and HLSL.
-class SIMPLETESTMODULE_API FTest: public FGlobalShader
-{
-public:
-	
-	DECLARE_GLOBAL_SHADER(FTest);
-	// Generates a constructor which will connect shader to register FParameter of input values
-	SHADER_USE_PARAMETER_STRUCT(FTest, FGlobalShader);
-	
-	
-	class FTest_Perm_TEST : SHADER_PERMUTATION_INT("TEST", 1);
-	using FPermutationDomain = TShaderPermutationDomain<
-		FTest_Perm_TEST
-	>;
-	// Makros to generate C++ struct of input values into shader, and connect it to RDG
-	BEGIN_SHADER_PARAMETER_STRUCT(FParameters, )
-		/*
-		* Here's where you define one or more of the input parameters for your shader.
-		* Some examples:
-		*/
-		// SHADER_PARAMETER(uint32, MyUint32) // On the shader side: uint32 MyUint32;
-		// SHADER_PARAMETER(FVector3f, MyVector) // On the shader side: float3 MyVector;
-
-		// SHADER_PARAMETER_TEXTURE(Texture2D, MyTexture) // On the shader side: Texture2D<float4> MyTexture; (float4 should be whatever you expect each pixel in the texture to be, in this case float4(R,G,B,A) for 4 channels)
-		// SHADER_PARAMETER_SAMPLER(SamplerState, MyTextureSampler) // On the shader side: SamplerState MySampler; // CPP side: TStaticSamplerState<ESamplerFilter::SF_Bilinear>::GetRHI();
-
-		// SHADER_PARAMETER_ARRAY(float, MyFloatArray, [3]) // On the shader side: float MyFloatArray[3];
-
-		// SHADER_PARAMETER_UAV(RWTexture2D<FVector4f>, MyTextureUAV) // On the shader side: RWTexture2D<float4> MyTextureUAV;
-		// SHADER_PARAMETER_UAV(RWStructuredBuffer<FMyCustomStruct>, MyCustomStructs) // On the shader side: RWStructuredBuffer<FMyCustomStruct> MyCustomStructs;
-		// SHADER_PARAMETER_UAV(RWBuffer<FMyCustomStruct>, MyCustomStructs) // On the shader side: RWBuffer<FMyCustomStruct> MyCustomStructs;
-
-		// SHADER_PARAMETER_SRV(StructuredBuffer<FMyCustomStruct>, MyCustomStructs) // On the shader side: StructuredBuffer<FMyCustomStruct> MyCustomStructs;
-		// SHADER_PARAMETER_SRV(Buffer<FMyCustomStruct>, MyCustomStructs) // On the shader side: Buffer<FMyCustomStruct> MyCustomStructs;
-		// SHADER_PARAMETER_SRV(Texture2D<FVector4f>, MyReadOnlyTexture) // On the shader side: Texture2D<float4> MyReadOnlyTexture;
+// This will tell the engine to create the shader and where the shader entry point is.
+IMPLEMENT_VISIBILITY_REDUCTION_SHADER(FTestReductionShader, "/SimpleTestModuleShaders/Test/Test.usf");
 
-		// SHADER_PARAMETER_STRUCT_REF(FMyCustomStruct, MyCustomStruct)
+struct FTestMetric
+{
+	using FShader = FTestReductionShader;
+	using FResult = FTestResult;
 
-		// Try to pass StencilRender here
-		SHADER_PARAMETER_RDG_TEXTURE(Texture2D, InputTexture)
-		SHADER_PARAMETER_RDG_TEXTURE(Texture2D, CameraTexture)
-		SHADER_PARAMETER_RDG_BUFFER_UAV(RWBuffer<int>, Output)
-		SHADER_PARAMETER_RDG_BUFFER_UAV(RWBuffer<int>, Luminance)
-		//SHADER_PARAMETER_RDG_BUFFER_UAV(FVector, Luminance)
-		
+	static constexpr ERDGPassFlags PassFlags = ERDGPassFlags::Compute;
 
-	END_SHADER_PARAMETER_STRUCT()
+	static const TCHAR* GetName() { return TEXT("Test"); }
 
-public:
-	// Shaders may have permutations (variations) based on its settings
-	// F.e we can change what features are used: tesselation, translucency
-	// Also it allows for changing platforms and other stuff automatically by the engine, instead of writing billion variations of the same shader
-	// This function specifies what permutations to compile
-	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	static FResult Decode(const int64* Channels, double ScreenArea)
 	{
-		// This line gets specific permutation from settings of FGlobalShaderPermutationParameters
-		const FPermutationDomain PermutationVector(Parameters.PermutationId);
-		
-		// Normally this function filters out unwanted permutations, but in this basic case it allows to compile any perm
-		return true;
+		FResult Result;
+		Result.PixelCount = Channels[0];
+		Result.Coverage = FVisibilityCoverage::Normalize(Channels[0], ScreenArea);
+		return Result;
 	}
-	// Allows to set compiler flags, define constants and enable specific features
-	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
-	{
-		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
-
-		const FPermutationDomain PermutationVector(Parameters.PermutationId);
-
-		/*
-		* Here you define constants that can be used statically in the shader code.
-		* Example:
-		*/
-		// OutEnvironment.SetDefine(TEXT("MY_CUSTOM_CONST"), TEXT("1"));
-
-		/*
-		* These defines are used in the thread count section of our shader
-		*/
-		OutEnvironment.SetDefine(TEXT("THREADS_X"), NUM_THREADS_Test_X);
-		OutEnvironment.SetDefine(TEXT("THREADS_Y"), NUM_THREADS_Test_Y);
-		OutEnvironment.SetDefine(TEXT("THREADS_Z"), NUM_THREADS_Test_Z);
-
-		// This shader must support typed UAV load and we are testing if it is supported at runtime using RHIIsTypedUAVLoadSupported
-		//OutEnvironment.CompilerFlags.Add(CFLAG_AllowTypedUAVLoads);
-
-		// FForwardLightingParameters::ModifyCompilationEnvironment(Parameters.Platform, OutEnvironment);
-	}
-private:
 };
 
+IMPLEMENT_VISIBILITY_REDUCTION_METRIC(FTestMetric)
 
-
-FRDGTextureRef FTestInterface::RegisterRenderTarget(UTextureRenderTarget2D* RenderTarget, FRDGBuilder& GraphBuilder, string VariableName)
+FVisibilityReductionInputs FTestInterface::MakeInputs(const FTestDispatchParams& Params)
 {
+	FVisibilityReductionInputs Inputs(Params.InputTexture, Params.CameraTexture);
+	Inputs.ViewRect = Params.ViewRect;
+	Inputs.ScreenAspectRatio = Params.ScreenAspectRatio;
+	Inputs.ScreenRect = Params.ScreenRect;
+	Inputs.bRestrictToScreenRect = Params.bRestrictToScreenRect;
+	Inputs.bUseTileCompaction = Params.bUseTileCompaction;
+	Inputs.bCapture = Params.bCapture;
+	return Inputs;
+}
 
-	if (!RenderTarget)
-	{
-		UE_LOG(LogTemp, Warning, TEXT("RenderTarget is null."));
-		
-	}
-	const FTextureRenderTargetResource* RTResource = RenderTarget->GetRenderTargetResource();
-	if (!RTResource)
-	{
-		UE_LOG(LogTemp, Warning, TEXT("RTResource is null."));
-		
-	}
-
-	FRHITexture* TextureRHI = RTResource->GetRenderTargetTexture();
-	if (!TextureRHI)
-	{
-		UE_LOG(LogTemp, Warning, TEXT("TextureRHI is null."));
-		
-	}
-
-	FSceneRenderTargetItem RenderTargetItem;
-	RenderTargetItem.TargetableTexture = TextureRHI;
-	RenderTargetItem.ShaderResourceTexture = TextureRHI;
-
-	FPooledRenderTargetDesc RenderTargetDesc = FPooledRenderTargetDesc::Create2DDesc(
-		RTResource->GetSizeXY(),        // Texture resolution 
-		TextureRHI->GetFormat(),             // Pixel format 
-		FClearValueBinding::Black,                // Initial clear value
-		TexCreate_None,
-		TexCreate_RenderTargetable |              // Can be used as a render target
-		TexCreate_ShaderResource |                // Can be sampled in shaders
-		TexCreate_UAV,                            // Can be written via UAV (compute shaders)
-		false
-	);
-	TRefCountPtr<IPooledRenderTarget> PooledRenderTarget;
-	GRenderTargetPool.CreateUntrackedElement(
-		RenderTargetDesc,
-		PooledRenderTarget,
-		RenderTargetItem         // Links to existing RenderTargetRHI
-	);
+FRDGTextureRef FTestInterface::RegisterRenderTarget(UTextureRenderTarget* RenderTarget, FRDGBuilder& GraphBuilder, string VariableName)
+{
 	FString tmp = UTF8_TO_TCHAR(VariableName.c_str());
-	FRDGTextureRef RDGInputTexture =
-		GraphBuilder.RegisterExternalTexture(PooledRenderTarget, *tmp);
-
-	return RDGInputTexture;
-
+	return FVisibilityReductionPassBuilder::RegisterRenderTarget(RenderTarget, GraphBuilder, *tmp);
 }
 
-// This will tell the engine to create the shader and where the shader entry point is.
-//                            ShaderType                            ShaderPath                     Shader function name    Type
-IMPLEMENT_GLOBAL_SHADER(FTest, "/SimpleTestModuleShaders/Test/Test.usf", "Test", SF_Compute);
-
-// Here we prepare Pass Parameters to a shader 
-void FTestInterface::DispatchRenderThread(FRHICommandListImmediate& RHICmdList, FTestDispatchParams Params, TFunction<void(int OutputVal, float ObjectLuminance, float OtherLuminance)> AsyncCallback) {
-	FRDGBuilder GraphBuilder(RHICmdList);
-
-	{
-		
-		SCOPE_CYCLE_COUNTER(STAT_Test_Execute);
-		DECLARE_GPU_STAT(Test)
-		RDG_EVENT_SCOPE(GraphBuilder, "Test");
-		RDG_GPU_STAT_SCOPE(GraphBuilder, Test);
-		
-
-		typename FTest::FPermutationDomain PermutationVector;
-		
-		// Add any static permutation options here
-		// PermutationVector.Set<FTest::FMyPermutationName>(12345);
-
-		TShaderMapRef<FTest> ComputeShader(GetGlobalShaderMap(GMaxRHIFeatureLevel), PermutationVector);
-		
-		UE_LOG(LogTemp, Warning, TEXT("Check validity of a shader."));
-		bool bIsShaderValid = ComputeShader.IsValid();
-
-		if (bIsShaderValid) 
-		{
-			UE_LOG(LogTemp, Warning, TEXT("Shader is valid."));
-			// Init pass parameters to a shader
-
-			FTest::FParameters* PassParameters = GraphBuilder.AllocParameters<FTest::FParameters>();
-
-			if (!Params.InputTexture)
-			{
-				UE_LOG(LogTemp, Warning, TEXT("InputTexture is null."));
-				return;
-
-			}
-			FRDGTextureRef InputTextureRef = RegisterRenderTarget(Params.InputTexture, GraphBuilder, "InputTexture");
-			PassParameters->InputTexture = InputTextureRef;
-			UE_LOG(LogTemp, Warning, TEXT("Put InputTextureRef into PassParameters"));
-
-			FRDGTextureRef CameraTextureRef = RegisterRenderTarget(Params.CameraTexture, GraphBuilder, "CameraTexture");
-			PassParameters->CameraTexture = CameraTextureRef;
-			UE_LOG(LogTemp, Warning, TEXT("Put CameraTextureRef into PassParameters"));
-			
-			
-			FRDGBufferRef OutputBuffer = GraphBuilder.CreateBuffer(
-				FRDGBufferDesc::CreateBufferDesc(sizeof(int32), 1),
-				TEXT("OutputBuffer"));
-
-			FRDGBufferRef LuminanceBuffer = GraphBuilder.CreateBuffer(
-				FRDGBufferDesc::CreateBufferDesc(sizeof(int32), 2),
-				TEXT("LuminanceBuffer"));
+bool FTestInterface::ComputeScreenRect(const FBox& WorldBounds, const FMatrix& ViewProjectionMatrix, FIntPoint TextureSize, FIntRect& OutRect, int32 Padding)
+{
+	return FVisibilityScreenRect::Compute(WorldBounds, ViewProjectionMatrix, TextureSize, OutRect, Padding);
+}
 
+bool FTestInterface::ComputeScreenRect(const AActor* Actor, const USceneCaptureComponent2D* Capture, FIntRect& OutRect, int32 Padding)
+{
+	return FVisibilityScreenRect::Compute(Actor, Capture, OutRect, Padding);
+}
 
-			PassParameters->Output = GraphBuilder.CreateUAV(FRDGBufferUAVDesc(OutputBuffer, PF_R32_SINT));
-			PassParameters->Luminance = GraphBuilder.CreateUAV(FRDGBufferUAVDesc(LuminanceBuffer, PF_R32_SINT));
-			AddClearUAVPass(GraphBuilder, PassParameters->Output, 0);
-			AddClearUAVPass(GraphBuilder, PassParameters->Luminance, 13);
+void FTestInterface::DispatchTyped(const FTestDispatchParams& Params, TFunction<void(const FTestResult& Result)> AsyncCallback)
+{
+	TVisibilityReductionPass<FTestMetric>::Dispatch(MakeInputs(Params), MoveTemp(AsyncCallback));
+}
 
-			//auto GroupCount = FComputeShaderUtils::GetGroupCount(FIntVector(Params.X, Params.Y, Params.Z), FComputeShaderUtils::kGolden2DGroupSize);
-			FIntPoint TextureSize = InputTextureRef->Desc.Extent;
-			FIntVector GroupCount(
-				FMath::DivideAndRoundUp(TextureSize.X, 32),
-				FMath::DivideAndRoundUp(TextureSize.Y, 32),
-				1
-			);
-			// Binding of pass parameters to RDG, so it will automatically send data to shader
-			GraphBuilder.AddPass(
-				RDG_EVENT_NAME("ExecuteTest"),
-				PassParameters,
-				ERDGPassFlags::Compute,
-				[&PassParameters, ComputeShader, GroupCount](FRHIComputeCommandList& RHICmdList)
-			{
-				FComputeShaderUtils::Dispatch(RHICmdList, ComputeShader, *PassParameters, GroupCount);
-			});
+void FTestInterface::DispatchSlices(const FTestDispatchParams& Params, TFunction<void(const TArray<FTestResult>& SliceResults, const FTestResult& Total)> AsyncCallback)
+{
+	TVisibilityReductionPass<FTestMetric>::DispatchSlices(MakeInputs(Params), MoveTemp(AsyncCallback));
+}
 
-			// GPU Readback
-			FRHIGPUBufferReadback* GPUOutputBufferReadback = new FRHIGPUBufferReadback(TEXT("ExecuteTestOutput"));
-			FRHIGPUBufferReadback* GPULuminanceBufferReadback = new FRHIGPUBufferReadback(TEXT("ExecuteTestOutput1"));
-			AddEnqueueCopyPass(GraphBuilder, GPUOutputBufferReadback, OutputBuffer, 0u);
-			AddEnqueueCopyPass(GraphBuilder, GPULuminanceBufferReadback, LuminanceBuffer, 0u);
+void FTestInterface::DispatchToStream(const FTestDispatchParams& Params, const TSharedRef<FTestResultStream, ESPMode::ThreadSafe>& Stream, uint64 Tag)
+{
+	TVisibilityReductionPass<FTestMetric>::DispatchToStream(MakeInputs(Params), Stream, Tag);
+}
 
-			auto RunnerFunc = [GPUOutputBufferReadback, GPULuminanceBufferReadback, AsyncCallback](auto&& RunnerFunc) -> void {
-				if (GPUOutputBufferReadback->IsReady() && GPULuminanceBufferReadback->IsReady()) {
-					
-					int32* Buffer = (int32*)GPUOutputBufferReadback->Lock(sizeof(int32));
-					int32 ObjectSize = Buffer[0];
-					
-					GPUOutputBufferReadback->Unlock();
+FVisibilityRequestHandle FTestInterface::Request(const FTestDispatchParams& Params, TUniqueFunction<void(bool bSuccess, const FTestResult& Result)>&& OnComplete, const UObject* Owner)
+{
+	return TVisibilityRequests<FTestMetric>::Request(MakeInputs(Params), MoveTemp(OnComplete), Owner);
+}
 
-					int32* LumBuffer = (int32*)(GPULuminanceBufferReadback->Lock(8));
-					UE_LOG(LogTemp, Log, TEXT("Luminance Buffer: %d, %d"), LumBuffer[0], LumBuffer[1]);
-					int32 ObjectLum = LumBuffer[0];
-					int32 OtherLum = LumBuffer[1];
-					GPULuminanceBufferReadback->Unlock();
+TFuture<TOptional<FTestResult>> FTestInterface::RequestFuture(const FTestDispatchParams& Params, FVisibilityRequestHandle* OutHandle)
+{
+	return TVisibilityRequests<FTestMetric>::RequestFuture(MakeInputs(Params), OutHandle);
+}
 
-					AsyncTask(ENamedThreads::GameThread, [AsyncCallback, ObjectSize, ObjectLum, OtherLum]() {
-						AsyncCallback(ObjectSize, ObjectLum, OtherLum);
-					});
+FVisibilityRequestHandle FTestInterface::RequestPolled(const FTestDispatchParams& Params)
+{
+	return TVisibilityRequests<FTestMetric>::Request(MakeInputs(Params));
+}
 
-					delete GPUOutputBufferReadback;
-					delete GPULuminanceBufferReadback;
-				} else {
-					AsyncTask(ENamedThreads::ActualRenderingThread, [RunnerFunc]() {
-						RunnerFunc(RunnerFunc);
-					});
-				}
-			};
+EVisibilityRequestStatus FTestInterface::Poll(FVisibilityRequestHandle& Handle, FTestResult& OutResult)
+{
+	return TVisibilityRequests<FTestMetric>::Poll(Handle, OutResult);
+}
 
-			AsyncTask(ENamedThreads::ActualRenderingThread, [RunnerFunc]() {
-				RunnerFunc(RunnerFunc);
-			});
-			
-		} else {
-			#if WITH_EDITOR
-				GEngine->AddOnScreenDebugMessage((uint64)42145125184, 6.f, FColor::Red, FString(TEXT("The compute shader has a problem.")));
-			#endif
+bool FTestInterface::Cancel(FVisibilityRequestHandle Handle)
+{
+	return TVisibilityRequests<FTestMetric>::Cancel(Handle);
+}
 
-			// We exit here as we don't want to crash the game if the shader is not found or has an error.
-			
-		}
-	}
+bool FTestInterface::RequestCached(const FTestDispatchParams& Params, const AActor* Actor, const USceneCaptureComponent2D* Capture, TUniqueFunction<void(bool bSuccess, const FTestResult& Result)>&& OnComplete, const UObject* Owner, float MaxAge)
+{
+	return TVisibilityCachedRequests<FTestMetric>::Request(MakeInputs(Params), Actor, Capture, MoveTemp(OnComplete), Owner, MaxAge);
+}
 
-	GraphBuilder.Execute();
-}
\ No newline at end of file
+void FTestInterface::DispatchRenderThread(FRHICommandListImmediate& RHICmdList, FTestDispatchParams Params, TFunction<void(int OutputVal, float ObjectLuminance, float OtherLuminance)> AsyncCallback) {
+	TVisibilityReductionPass<FTestMetric>::DispatchRenderThread(RHICmdList, MakeInputs(Params),
+		[AsyncCallback](const FTestResult& Result)
+		{
+			AsyncCallback((int32)FMath::Min<int64>(Result.PixelCount, MAX_int32), 0.f, 0.f);
+		});
+}
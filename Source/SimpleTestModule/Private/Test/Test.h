@@ -2,31 +2,10 @@
 
 #include "CoreMinimal.h"
 #include "SimpleTestModule/Public/SimpleTestModule.h"
-#include "MeshPassProcessor.h"
 #include "RHICommandList.h"
 #include "RenderGraphBuilder.h"
-#include "RenderTargetPool.h"
-#include "MeshMaterialShader.h"
-#include "ShaderParameterUtils.h"
-#include "RHIStaticStates.h"
-#include "Shader.h"
-#include "RHI.h"
 #include "GlobalShader.h"
-#include "RenderGraphUtils.h"
 #include "ShaderParameterStruct.h"
-#include "UniformBuffer.h"
-#include "RHICommandList.h"
-#include "ShaderCompilerCore.h"
-#include "EngineDefines.h"
-#include "RendererInterface.h"
-#include "RenderResource.h"
-#include "RenderGraphResources.h"
-
 #include "RenderGraphResources.h"
 #include "Runtime/Engine/Classes/Engine/TextureRenderTarget2D.h"
-
-// For setting up groups
-
-#define NUM_THREADS_Test_X 32
-#define NUM_THREADS_Test_Y 32
-#define NUM_THREADS_Test_Z 1
\ No newline at end of file
+#include "ReductionPass/VisibilityReductionPass.h"
@@ -4,11 +4,19 @@
 #include "GenericPlatform/GenericPlatformMisc.h"
 #include "Kismet/BlueprintAsyncActionBase.h"
 #include "Engine/TextureRenderTarget2D.h"
+#include "Engine/TextureRenderTargetCube.h"
+#include "Engine/TextureRenderTarget2DArray.h"
 #include "Materials/MaterialRenderProxy.h"
 #include "Engine/Texture2D.h"
+#include "ReductionPass/VisibilityReductionPass.h"
+#include "Requests/VisibilityRequests.h"
+#include "ResultCache/VisibilityResultCache.h"
 
 #include "Test.generated.h"
 
+class AActor;
+class USceneCaptureComponent2D;
+
 using std::string;
 
 // This is NOT input data for shader struct, but Blueprint friendly struct that takes data from game thread to render thread for further processing
@@ -19,28 +27,90 @@ struct SIMPLETESTMODULE_API FTestDispatchParams
 	int Y;
 	int Z;
 	
-	UTextureRenderTarget2D* InputTexture; // Must be a RenderTarget for compute shaders
-	UTextureRenderTarget2D* CameraTexture;
+	// Must be a RenderTarget for compute shaders. UTextureRenderTargetCube and UTextureRenderTarget2DArray inputs
+	// are measured slice by slice in one dispatch, see FTestInterface::DispatchSlices
+	UTextureRenderTarget* InputTexture;
+	UTextureRenderTarget* CameraTexture;
 	int Output; 
 	int ObjectLuminance;
 	int OtherLuminance;
 
-	FTestDispatchParams(int x, int y, int z, UTextureRenderTarget2D* InTexture, UTextureRenderTarget2D* CamTexture)
-		: X(x), Y(y), Z(z), InputTexture(InTexture), CameraTexture(CamTexture), Output(1) {
+	// Optional InputTexture-space rect the view was rendered to, f.e. with dynamic resolution. Empty means the whole texture
+	FIntRect ViewRect;
+	// Aspect ratio (width / height) of the screen FTestResult::Coverage is relative to, 0 for the aspect of the view rect
+	float ScreenAspectRatio;
+
+	// Optional InputTexture-space rect to dispatch over (Max is exclusive). It is clamped to the texture extent on the render thread,
+	// so it only has to be conservative: every object pixel must lie inside it, see FVisibilityScreenRect
+	FIntRect ScreenRect;
+	bool bRestrictToScreenRect;
+
+	// Runs a coarse pass that lists the 32x32 tiles holding object texels, then counts only those tiles via an indirect dispatch.
+	// Pays off for mostly empty masks, for dense ones the extra pass is overhead. Also forced globally by r.VisibilityCore.TileCompaction
+	bool bUseTileCompaction;
+
+	// Snapshots this dispatch into the running frame capture (r.VisibilityCore.Capture.Start) for offline replay,
+	// see FVisibilityFrameCapture
+	bool bCapture;
+
+	FTestDispatchParams(int x, int y, int z, UTextureRenderTarget* InTexture, UTextureRenderTarget* CamTexture)
+		: X(x), Y(y), Z(z), InputTexture(InTexture), CameraTexture(CamTexture), Output(1), ScreenAspectRatio(0.f), bRestrictToScreenRect(false), bUseTileCompaction(false), bCapture(false) {
 	} 
 };
 
-// Compute Shader Interface
+// Typed result of the Test reduction
+struct SIMPLETESTMODULE_API FTestResult
+{
+	// Number of InputTexture texels covered by the object. Depends on the capture resolution
+	int64 PixelCount = 0;
+	// Fraction of the screen covered by the object, the same at any capture resolution. See FVisibilityCoverage
+	float Coverage = 0.f;
+};
+
+// Results delivered in bulk from the render thread, see FTestInterface::DispatchToStream
+using FTestResultStream = TVisibilityResultStream<FTestResult>;
+
+// Compute Shader Interface. A thin wrapper over TVisibilityReductionPass, kept for existing callers
 class SIMPLETESTMODULE_API FTestInterface {
 public:
-	// Executes shader on the render thread
+	// Reduction inputs matching Params
+	static FVisibilityReductionInputs MakeInputs(const FTestDispatchParams& Params);
+
+	// Executes shader on the render thread. ObjectLuminance and OtherLuminance are not computed by the Test kernel and are always 0.
+	// OutputVal saturates at MAX_int32, the typed entry points return the whole PixelCount
 	static void DispatchRenderThread(
 		FRHICommandListImmediate& RHICmdList,
 		FTestDispatchParams Params,
 		TFunction<void(int OutputVal, float ObjectLuminance, float OtherLuminance)> AsyncCallback
 	);
 
-	static FRDGTextureRef RegisterRenderTarget(UTextureRenderTarget2D* RenderTarget, FRDGBuilder& GraphBuilder, string VariableName);
+	static FRDGTextureRef RegisterRenderTarget(UTextureRenderTarget* RenderTarget, FRDGBuilder& GraphBuilder, string VariableName);
+
+	// Typed variant, the result is delivered on the game thread
+	static void DispatchTyped(const FTestDispatchParams& Params, TFunction<void(const FTestResult& Result)> AsyncCallback);
+
+	// Per slice variant for cube and 2D array inputs: one result per face or slice plus their sum, from a single dispatch and readback
+	static void DispatchSlices(const FTestDispatchParams& Params, TFunction<void(const TArray<FTestResult>& SliceResults, const FTestResult& Total)> AsyncCallback);
+
+	// For many measurements per frame: the result is pushed with Tag into Stream on the render thread, without a game thread
+	// task per result, and its owner drains them in bulk on a worker or once per tick. Any thread
+	static void DispatchToStream(const FTestDispatchParams& Params, const TSharedRef<FTestResultStream, ESPMode::ThreadSafe>& Stream, uint64 Tag);
+
+	// See FVisibilityScreenRect::Compute
+	static bool ComputeScreenRect(const FBox& WorldBounds, const FMatrix& ViewProjectionMatrix, FIntPoint TextureSize, FIntRect& OutRect, int32 Padding = 2);
+	static bool ComputeScreenRect(const AActor* Actor, const USceneCaptureComponent2D* Capture, FIntRect& OutRect, int32 Padding = 2);
+
+	// Pooled request API, see FVisibilityRequests. Game thread only. Identical requests made in the same frame share one dispatch,
+	// OnComplete is called on the game thread and dropped if Owner has been garbage collected
+	static FVisibilityRequestHandle Request(const FTestDispatchParams& Params, TUniqueFunction<void(bool bSuccess, const FTestResult& Result)>&& OnComplete, const UObject* Owner = nullptr);
+	static TFuture<TOptional<FTestResult>> RequestFuture(const FTestDispatchParams& Params, FVisibilityRequestHandle* OutHandle = nullptr);
+	// Polled variant of Request. Poll until it returns Ready or Failed, or Cancel the handle
+	static FVisibilityRequestHandle RequestPolled(const FTestDispatchParams& Params);
+	static EVisibilityRequestStatus Poll(FVisibilityRequestHandle& Handle, FTestResult& OutResult);
+	static bool Cancel(FVisibilityRequestHandle Handle);
+	// Cached variant of Request for a measured Actor seen by Capture, see FVisibilityResultCache. Returns true when the result
+	// was still valid, OnComplete has been called then. MaxAge in seconds, negative uses r.VisibilityCore.Cache.MaxAge
+	static bool RequestCached(const FTestDispatchParams& Params, const AActor* Actor, const USceneCaptureComponent2D* Capture, TUniqueFunction<void(bool bSuccess, const FTestResult& Result)>&& OnComplete, const UObject* Owner = nullptr, float MaxAge = -1.f);
 
 	// Executes shader from the game thread
 	static void DispatchGameThread(
@@ -48,6 +118,8 @@ public:
 		TFunction<void(int OutputVal, float ObjectLuminance, float OtherLuminance)> AsyncCallback
 	)
 	{
+		// The inputs are only built on the render thread
+		FVisibilityRecorder::RegisterSource(Params.InputTexture);
 		ENQUEUE_RENDER_COMMAND(SceneDrawCompletion)(
 			[Params, AsyncCallback](FRHICommandListImmediate& RHICmdList)
 			{
@@ -87,17 +159,20 @@ public:
 		// Ensure InputTexture is a RenderTarget
 		if (!InputTexture) return;
 		if (!CameraTexture) return;
-		// Dispatch compute shader
+		// Dispatch compute shader. Passing this as the Owner drops the callback if the action is garbage collected first
 		FTestDispatchParams Params(1, 1, 1, InputTexture, CameraTexture);
-		FTestInterface::Dispatch(Params, [this](int OutputVal, float ObjectLiminance, float OtherLuminance) {
-			this->Completed.Broadcast(OutputVal, ObjectLiminance, OtherLuminance);
-			});
+		FTestInterface::Request(Params, [this](bool bSuccess, const FTestResult& Result) {
+			if (bSuccess) {
+				this->Completed.Broadcast((int32)FMath::Min<int64>(Result.PixelCount, MAX_int32), 0.f, 0.f);
+			}
+			SetReadyToDestroy();
+			}, this);
 	}
 
 	// Blueprint function
 	UFUNCTION(BlueprintCallable, meta = (BlueprintInternalUseOnly = "true", Category = "ComputeShader", WorldContext = "WorldContextObject"))
-	static UTestLibrary_AsyncExecution* VisibilityToneCalculation(UObject* WorldContextObject, UTextureRenderTarget2D* InputTexture, 
-		UTextureRenderTarget2D* CameraTexture) {
+	static UTestLibrary_AsyncExecution* VisibilityToneCalculation(UObject* WorldContextObject, UTextureRenderTarget* InputTexture, 
+		UTextureRenderTarget* CameraTexture) {
 		UTestLibrary_AsyncExecution* Action = NewObject<UTestLibrary_AsyncExecution>();
 		Action->InputTexture = InputTexture;
 		Action->CameraTexture = CameraTexture;
@@ -109,6 +184,52 @@ public:
 	FOnTestLibrary_AsyncExecutionCompleted Completed;
 
 	// Texture input (must be a RenderTarget)
-	UTextureRenderTarget2D* InputTexture;
-	UTextureRenderTarget2D* CameraTexture;
+	UTextureRenderTarget* InputTexture;
+	UTextureRenderTarget* CameraTexture;
+};
+
+// Separate from FOnTestLibrary_AsyncExecutionCompleted so Blueprints bound to the original node keep compiling
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FOnTestLibrary_CoverageAsyncExecutionCompleted, 
+	const int, ScreenSpaceObjectSize, const float, Coverage
+);
+// Same measurement as UTestLibrary_AsyncExecution, also reporting the fraction of the screen the object covers
+UCLASS()
+class SIMPLETESTMODULE_API UTestLibrary_CoverageAsyncExecution : public UBlueprintAsyncActionBase
+{
+	GENERATED_BODY()
+
+public:
+	// Executes the compute shader
+	virtual void Activate() override {
+		if (!InputTexture) return;
+		if (!CameraTexture) return;
+		FTestDispatchParams Params(1, 1, 1, InputTexture, CameraTexture);
+		Params.ScreenAspectRatio = ScreenAspectRatio;
+		FTestInterface::Request(Params, [this](bool bSuccess, const FTestResult& Result) {
+			if (bSuccess) {
+				this->Completed.Broadcast((int32)FMath::Min<int64>(Result.PixelCount, MAX_int32), Result.Coverage);
+			}
+			SetReadyToDestroy();
+			}, this);
+	}
+
+	// Blueprint function. ScreenAspectRatio is the aspect of the screen Coverage is relative to, 0 for the aspect of InputTexture
+	UFUNCTION(BlueprintCallable, meta = (BlueprintInternalUseOnly = "true", Category = "ComputeShader", WorldContext = "WorldContextObject"))
+	static UTestLibrary_CoverageAsyncExecution* VisibilityCoverageCalculation(UObject* WorldContextObject, UTextureRenderTarget* InputTexture, 
+		UTextureRenderTarget* CameraTexture, float ScreenAspectRatio = 0.f) {
+		UTestLibrary_CoverageAsyncExecution* Action = NewObject<UTestLibrary_CoverageAsyncExecution>();
+		Action->InputTexture = InputTexture;
+		Action->CameraTexture = CameraTexture;
+		Action->ScreenAspectRatio = ScreenAspectRatio;
+		Action->RegisterWithGameInstance(WorldContextObject);
+		return Action;
+	}
+
+	UPROPERTY(BlueprintAssignable)
+	FOnTestLibrary_CoverageAsyncExecutionCompleted Completed;
+
+	// Texture input (must be a RenderTarget)
+	UTextureRenderTarget* InputTexture;
+	UTextureRenderTarget* CameraTexture;
+	float ScreenAspectRatio;
 };
@@ -0,0 +1,217 @@
+#include "Commandlet/VisibilityAnalysisCommandlet.h"
+#include "Commandlet/VisibilityAnalysisWriter.h"
+#include "CpuReference/VisibilityCpuReference.h"
+#include "Async/Async.h"
+#include "HAL/FileManager.h"
+#include "IImageWrapperModule.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Modules/ModuleManager.h"
+
+// Pairs written between two progress lines
+static constexpr int32 VisibilityAnalysisProgressInterval = 500;
+
+namespace VisibilityAnalysis
+{
+	struct FFramePair
+	{
+		FString Name;
+		FString MaskPath;
+		// Empty when there is no camera frame for this mask
+		FString CameraPath;
+	};
+
+	static bool IsImageFile(const FString& Path)
+	{
+		const FString Extension = FPaths::GetExtension(Path);
+		return Extension.Equals(TEXT("png"), ESearchCase::IgnoreCase) || Extension.Equals(TEXT("exr"), ESearchCase::IgnoreCase);
+	}
+
+	// Matches <Name><MaskSuffix>.<png|exr> with <Name><CameraSuffix>.<png|exr>, sorted by name
+	static void FindFramePairs(const FString& Directory, const FString& MaskSuffix, const FString& CameraSuffix, TArray<FFramePair>& OutPairs)
+	{
+		TArray<FString> Files;
+		IFileManager::Get().FindFiles(Files, *FPaths::Combine(Directory, TEXT("*")), true, false);
+
+		TMap<FString, FString> CameraFiles;
+		for (const FString& File : Files)
+		{
+			const FString BaseName = FPaths::GetBaseFilename(File);
+			if (IsImageFile(File) && BaseName.EndsWith(CameraSuffix))
+			{
+				CameraFiles.Add(BaseName.LeftChop(CameraSuffix.Len()), FPaths::Combine(Directory, File));
+			}
+		}
+
+		for (const FString& File : Files)
+		{
+			const FString BaseName = FPaths::GetBaseFilename(File);
+			if (!IsImageFile(File) || !BaseName.EndsWith(MaskSuffix))
+			{
+				continue;
+			}
+
+			FFramePair& Pair = OutPairs.AddDefaulted_GetRef();
+			Pair.Name = BaseName.LeftChop(MaskSuffix.Len());
+			Pair.MaskPath = FPaths::Combine(Directory, File);
+			if (const FString* CameraPath = CameraFiles.Find(Pair.Name))
+			{
+				Pair.CameraPath = *CameraPath;
+			}
+		}
+
+		OutPairs.Sort([](const FFramePair& A, const FFramePair& B) { return A.Name < B.Name; });
+	}
+
+	static bool LoadImage(IImageWrapperModule& ImageWrapperModule, const FString& Path, FImage& OutImage)
+	{
+		TArray64<uint8> Compressed;
+		if (!FFileHelper::LoadFileToArray(Compressed, *Path))
+		{
+			return false;
+		}
+		if (!ImageWrapperModule.DecompressImage(Compressed.GetData(), Compressed.Num(), OutImage))
+		{
+			return false;
+		}
+
+		FVisibilityCpuReference::NormalizeFormat(OutImage);
+		return true;
+	}
+
+	// Worker thread. Decodes one pair and reduces it, the decoded images are freed before returning. The pairs in flight
+	// already keep the pool busy, so the reductions run on this thread instead of fanning out over the task graph
+	static FVisibilityAnalysisRecord AnalyzePair(IImageWrapperModule& ImageWrapperModule, const FFramePair& Pair, uint32 Frame)
+	{
+		FVisibilityAnalysisRecord Record;
+		Record.Frame = Frame;
+		Record.Name = Pair.Name;
+
+		{
+			FImage Mask;
+			if (!LoadImage(ImageWrapperModule, Pair.MaskPath, Mask))
+			{
+				Record.Status = EVisibilityAnalysisStatus::MaskFailed;
+				return Record;
+			}
+			Record.Width = Mask.SizeX;
+			Record.Height = Mask.SizeY;
+			Record.PixelCount = FVisibilityCpuReference::CountObjectTexels(Mask, EParallelForFlags::ForceSingleThread);
+		}
+
+		if (Pair.CameraPath.IsEmpty())
+		{
+			Record.Status = EVisibilityAnalysisStatus::NoCamera;
+			return Record;
+		}
+
+		FImage Camera;
+		if (!LoadImage(ImageWrapperModule, Pair.CameraPath, Camera))
+		{
+			Record.Status = EVisibilityAnalysisStatus::CameraFailed;
+			return Record;
+		}
+		Record.BrightnessSum = FVisibilityCpuReference::SumBrightness(Camera, EParallelForFlags::ForceSingleThread);
+		return Record;
+	}
+}
+
+UVisibilityAnalysisCommandlet::UVisibilityAnalysisCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = true;
+	LogToConsole = true;
+	ShowErrorCount = true;
+}
+
+int32 UVisibilityAnalysisCommandlet::Main(const FString& Params)
+{
+	using namespace VisibilityAnalysis;
+
+	FString InputDirectory;
+	if (!FParse::Value(*Params, TEXT("Input="), InputDirectory))
+	{
+		UE_LOG(LogTemp, Error, TEXT("VisibilityAnalysis: missing -Input=<directory>."));
+		return 1;
+	}
+
+	FString OutputPath = FPaths::Combine(InputDirectory, TEXT("VisibilityAnalysis.csv"));
+	FParse::Value(*Params, TEXT("Output="), OutputPath);
+
+	FString MaskSuffix = TEXT("_mask");
+	FString CameraSuffix = TEXT("_camera");
+	FParse::Value(*Params, TEXT("MaskSuffix="), MaskSuffix);
+	FParse::Value(*Params, TEXT("CameraSuffix="), CameraSuffix);
+
+	// Pairs decoded ahead of the writer. Bounds memory to about Prefetch decoded pairs
+	int32 Prefetch = FMath::Max(FPlatformMisc::NumberOfCoresIncludingHyperthreads(), 2);
+	FParse::Value(*Params, TEXT("Prefetch="), Prefetch);
+	Prefetch = FMath::Max(Prefetch, 1);
+
+	TArray<FFramePair> Pairs;
+	FindFramePairs(InputDirectory, MaskSuffix, CameraSuffix, Pairs);
+	if (Pairs.Num() == 0)
+	{
+		UE_LOG(LogTemp, Error, TEXT("VisibilityAnalysis: no *%s.png or *%s.exr files in %s."), *MaskSuffix, *MaskSuffix, *InputDirectory);
+		return 1;
+	}
+
+	FVisibilityAnalysisWriter Writer;
+	if (!Writer.Open(OutputPath))
+	{
+		UE_LOG(LogTemp, Error, TEXT("VisibilityAnalysis: can't open %s for writing."), *OutputPath);
+		return 1;
+	}
+
+	UE_LOG(LogTemp, Display, TEXT("VisibilityAnalysis: %d frame pairs from %s to %s, %d frames ahead."), Pairs.Num(), *InputDirectory, *OutputPath, Prefetch);
+
+	// Loaded here, modules can't be loaded from the workers
+	IImageWrapperModule& ImageWrapperModule = FModuleManager::LoadModuleChecked<IImageWrapperModule>(TEXT("ImageWrapper"));
+
+	// Ring of in-flight pairs, results are written in frame order
+	TArray<TFuture<FVisibilityAnalysisRecord>> InFlight;
+	InFlight.SetNum(Prefetch);
+	auto Launch = [&](int32 Frame)
+	{
+		InFlight[Frame % Prefetch] = Async(EAsyncExecution::ThreadPool, [&ImageWrapperModule, &Pair = Pairs[Frame], Frame]()
+		{
+			return AnalyzePair(ImageWrapperModule, Pair, Frame);
+		});
+	};
+
+	for (int32 Frame = 0; Frame < FMath::Min(Prefetch, Pairs.Num()); ++Frame)
+	{
+		Launch(Frame);
+	}
+
+	const double StartTime = FPlatformTime::Seconds();
+	int32 NumFailed = 0;
+	for (int32 Frame = 0; Frame < Pairs.Num(); ++Frame)
+	{
+		const FVisibilityAnalysisRecord Record = InFlight[Frame % Prefetch].Get();
+		if (Frame + Prefetch < Pairs.Num())
+		{
+			Launch(Frame + Prefetch);
+		}
+
+		if (Record.Status == EVisibilityAnalysisStatus::MaskFailed || Record.Status == EVisibilityAnalysisStatus::CameraFailed)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("VisibilityAnalysis: can't decode %s."), *Record.Name);
+			++NumFailed;
+		}
+		Writer.Write(Record);
+
+		if ((Frame + 1) % VisibilityAnalysisProgressInterval == 0)
+		{
+			const double Elapsed = FPlatformTime::Seconds() - StartTime;
+			UE_LOG(LogTemp, Display, TEXT("VisibilityAnalysis: %d / %d pairs, %.1f pairs/s."), Frame + 1, Pairs.Num(), (Frame + 1) / Elapsed);
+		}
+	}
+
+	Writer.Close();
+
+	const double Elapsed = FPlatformTime::Seconds() - StartTime;
+	UE_LOG(LogTemp, Display, TEXT("VisibilityAnalysis: %d pairs in %.2f s (%.1f pairs/s), %d failed."), Pairs.Num(), Elapsed, Pairs.Num() / FMath::Max(Elapsed, 0.001), NumFailed);
+	return NumFailed > 0 ? 1 : 0;
+}
@@ -0,0 +1,90 @@
+#include "Commandlet/VisibilityAnalysisWriter.h"
+#include "HAL/FileManager.h"
+#include "Misc/Paths.h"
+
+// Records written between two flushes of the output file
+static constexpr int32 VisibilityAnalysisFlushInterval = 256;
+
+// Quotes a CSV field per RFC 4180, so names holding commas, quotes or line breaks keep the columns aligned
+static FString VisibilityAnalysisQuoteCsv(const FString& Field)
+{
+	return TEXT("\"") + Field.Replace(TEXT("\""), TEXT("\"\"")) + TEXT("\"");
+}
+
+FVisibilityAnalysisWriter::~FVisibilityAnalysisWriter()
+{
+	Close();
+}
+
+bool FVisibilityAnalysisWriter::Open(const FString& Path)
+{
+	Close();
+
+	Archive.Reset(IFileManager::Get().CreateFileWriter(*Path));
+	if (!Archive)
+	{
+		return false;
+	}
+
+	bBinary = FPaths::GetExtension(Path).Equals(TEXT("bin"), ESearchCase::IgnoreCase);
+	if (bBinary)
+	{
+		uint32 Magic = BinaryMagic;
+		uint32 Version = BinaryVersion;
+		*Archive << Magic;
+		*Archive << Version;
+	}
+	else
+	{
+		WriteUTF8(TEXT("Frame,Name,Status,Width,Height,PixelCount,BrightnessSum\n"));
+	}
+	return true;
+}
+
+void FVisibilityAnalysisWriter::WriteUTF8(const FString& Text)
+{
+	FTCHARToUTF8 UTF8(*Text);
+	Archive->Serialize((void*)UTF8.Get(), UTF8.Length());
+}
+
+void FVisibilityAnalysisWriter::Write(const FVisibilityAnalysisRecord& Record)
+{
+	check(Archive);
+
+	if (bBinary)
+	{
+		uint32 Frame = Record.Frame;
+		uint8 Status = (uint8)Record.Status;
+		int32 Width = Record.Width;
+		int32 Height = Record.Height;
+		int64 PixelCount = Record.PixelCount;
+		int64 BrightnessSum = Record.BrightnessSum;
+		*Archive << Frame << Status << Width << Height << PixelCount << BrightnessSum;
+
+		FTCHARToUTF8 Name(*Record.Name);
+		uint16 NameLength = (uint16)FMath::Min(Name.Length(), (int32)MAX_uint16);
+		*Archive << NameLength;
+		Archive->Serialize((void*)Name.Get(), NameLength);
+	}
+	else
+	{
+		WriteUTF8(FString::Printf(TEXT("%u,%s,%d,%d,%d,%lld,%lld\n"),
+			Record.Frame, *VisibilityAnalysisQuoteCsv(Record.Name), (int32)Record.Status, Record.Width, Record.Height, Record.PixelCount, Record.BrightnessSum));
+	}
+
+	if (++NumUnflushed >= VisibilityAnalysisFlushInterval)
+	{
+		Archive->Flush();
+		NumUnflushed = 0;
+	}
+}
+
+void FVisibilityAnalysisWriter::Close()
+{
+	if (Archive)
+	{
+		Archive->Close();
+		Archive.Reset();
+	}
+	NumUnflushed = 0;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+enum class EVisibilityAnalysisStatus : uint8
+{
+	Ok,
+	// The mask could not be read or decoded, no metric was computed
+	MaskFailed,
+	// No camera frame matches the mask, BrightnessSum is -1
+	NoCamera,
+	// The camera frame could not be read or decoded, BrightnessSum is -1
+	CameraFailed,
+};
+
+// Metrics of one mask / camera frame pair
+struct FVisibilityAnalysisRecord
+{
+	uint32 Frame = 0;
+	FString Name;
+	EVisibilityAnalysisStatus Status = EVisibilityAnalysisStatus::Ok;
+	int32 Width = 0;
+	int32 Height = 0;
+	// Test metric over the mask
+	int64 PixelCount = -1;
+	// LuminanceCalculation metric over the camera frame
+	int64 BrightnessSum = -1;
+};
+
+// Appends records to a CSV or binary file as they are produced, flushing regularly so interrupted runs keep their results.
+// The binary layout is described in VisibilityAnalysisCommandlet_readme.md
+class FVisibilityAnalysisWriter
+{
+public:
+	static constexpr uint32 BinaryMagic = 0x41534956; // "VISA"
+	static constexpr uint32 BinaryVersion = 1;
+
+	~FVisibilityAnalysisWriter();
+
+	// Binary when the extension is .bin, CSV otherwise
+	bool Open(const FString& Path);
+	void Write(const FVisibilityAnalysisRecord& Record);
+	void Close();
+
+private:
+	void WriteUTF8(const FString& Text);
+
+	TUniquePtr<FArchive> Archive;
+	bool bBinary = false;
+	int32 NumUnflushed = 0;
+};
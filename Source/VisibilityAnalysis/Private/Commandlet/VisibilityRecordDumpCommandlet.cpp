@@ -0,0 +1,104 @@
+#include "Commandlet/VisibilityRecordDumpCommandlet.h"
+#include "Recorder/VisibilityRecordReader.h"
+#include "HAL/FileManager.h"
+
+// Quotes a CSV field per RFC 4180, so names holding commas, quotes or line breaks keep the columns aligned
+static FString VisibilityRecordDumpQuoteCsv(const FString& Field)
+{
+	return TEXT("\"") + Field.Replace(TEXT("\""), TEXT("\"\"")) + TEXT("\"");
+}
+
+UVisibilityRecordDumpCommandlet::UVisibilityRecordDumpCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = true;
+	LogToConsole = true;
+	ShowErrorCount = true;
+}
+
+int32 UVisibilityRecordDumpCommandlet::Main(const FString& Params)
+{
+	FString InputPath;
+	if (!FParse::Value(*Params, TEXT("Input="), InputPath))
+	{
+		UE_LOG(LogTemp, Error, TEXT("VisibilityRecordDump: missing -Input=<file.vrec>."));
+		return 1;
+	}
+
+	FVisibilityRecordReader Reader;
+	if (!Reader.Open(InputPath))
+	{
+		UE_LOG(LogTemp, Error, TEXT("VisibilityRecordDump: can't read %s."), *InputPath);
+		return 1;
+	}
+
+	const FVisibilityRecordFileHeader& Header = Reader.GetHeader();
+	UE_LOG(LogTemp, Display, TEXT("VisibilityRecordDump: %lld records, %llu dropped, %s."),
+		Reader.Num(), Header.NumDropped, Header.IndexOffset != 0 ? TEXT("finished") : TEXT("unfinished, no index and names"));
+	if (Reader.Num() > 0)
+	{
+		UE_LOG(LogTemp, Display, TEXT("VisibilityRecordDump: frames %u to %u over %.2f s."),
+			Reader[0].FrameNumber, Reader[Reader.Num() - 1].FrameNumber, Reader.GetSeconds(Reader[Reader.Num() - 1]));
+	}
+
+	FString OutputPath;
+	if (!FParse::Value(*Params, TEXT("Output="), OutputPath))
+	{
+		return 0;
+	}
+
+	uint32 FromFrame = 0;
+	uint32 ToFrame = MAX_uint32;
+	FParse::Value(*Params, TEXT("FromFrame="), FromFrame);
+	FParse::Value(*Params, TEXT("ToFrame="), ToFrame);
+
+	TUniquePtr<FArchive> Output(IFileManager::Get().CreateFileWriter(*OutputPath));
+	if (!Output)
+	{
+		UE_LOG(LogTemp, Error, TEXT("VisibilityRecordDump: can't open %s for writing."), *OutputPath);
+		return 1;
+	}
+
+	auto WriteLine = [&Output](const FString& Line)
+	{
+		FTCHARToUTF8 UTF8(*Line);
+		Output->Serialize((void*)UTF8.Get(), UTF8.Length());
+	};
+
+	FString Line = TEXT("Frame,Seconds,Metric,Source,Slices");
+	for (int32 Channel = 0; Channel < VISIBILITY_RECORD_MAX_CHANNELS; ++Channel)
+	{
+		Line += FString::Printf(TEXT(",Channel%d"), Channel);
+	}
+	WriteLine(Line + TEXT("\n"));
+
+	int64 NumWritten = 0;
+	for (int64 RecordIndex = Reader.FindFirstRecord(FromFrame); RecordIndex < Reader.Num(); ++RecordIndex)
+	{
+		const FVisibilityRecord& Record = Reader[RecordIndex];
+		if (Record.FrameNumber > ToFrame)
+		{
+			break;
+		}
+
+		const FString* Metric = Reader.FindMetricName(Record.MetricId);
+		const FString* Source = Reader.FindSourceName(Record.SourceId);
+		Line = FString::Printf(TEXT("%u,%.6f,%s,%s,%u"),
+			Record.FrameNumber,
+			Reader.GetSeconds(Record),
+			Metric ? *VisibilityRecordDumpQuoteCsv(*Metric) : *FString::Printf(TEXT("%08x"), Record.MetricId),
+			Source ? *VisibilityRecordDumpQuoteCsv(*Source) : *FString::Printf(TEXT("%u"), Record.SourceId),
+			Record.NumSlices);
+		for (int32 Channel = 0; Channel < VISIBILITY_RECORD_MAX_CHANNELS; ++Channel)
+		{
+			Line += FString::Printf(TEXT(",%lld"), Record.Channels[Channel]);
+		}
+		WriteLine(Line + TEXT("\n"));
+		++NumWritten;
+	}
+
+	Output->Close();
+	UE_LOG(LogTemp, Display, TEXT("VisibilityRecordDump: %lld records written to %s."), NumWritten, *OutputPath);
+	return 0;
+}
@@ -0,0 +1,588 @@
+#include "Commandlet/VisibilityReplayCommandlet.h"
+#include "Capture/VisibilityFrameCapture.h"
+#include "Coverage/VisibilityCoverage.h"
+#include "CpuReference/VisibilityCpuReference.h"
+#include "Engine/TextureRenderTarget2D.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/App.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "RenderGraphBuilder.h"
+#include "RenderingThread.h"
+#include "UObject/StrongObjectPtr.h"
+
+namespace VisibilityReplay
+{
+	struct FTimings
+	{
+		double MinMs = 0.0;
+		double MaxMs = 0.0;
+		double TotalMs = 0.0;
+		int32 Num = 0;
+
+		void Add(double Ms)
+		{
+			MinMs = Num == 0 ? Ms : FMath::Min(MinMs, Ms);
+			MaxMs = FMath::Max(MaxMs, Ms);
+			TotalMs += Ms;
+			++Num;
+		}
+
+		double GetMeanMs() const { return Num > 0 ? TotalMs / Num : 0.0; }
+	};
+
+	// Outcome of one path for one capture. Result is the sum of the first channel over every slice
+	struct FReplayResult
+	{
+		bool bRan = false;
+		int64 Result = 0;
+		// Summed absolute difference to the captured result, over every slice and channel
+		int64 Diff = 0;
+		FTimings Timings;
+	};
+
+	struct FMetricSummary
+	{
+		int32 NumCaptures = 0;
+		int32 NumCpuDiffs = 0;
+		int32 NumGpuDiffs = 0;
+		FTimings Cpu;
+		FTimings Gpu;
+	};
+
+	// CPU reference of a metric. Reduce writes NumChannels values for one slice, in the order of the shader's channels
+	struct FCpuReference
+	{
+		int32 NumChannels = 0;
+		void (*Reduce)(const FImageView& Image, int64* OutChannels) = nullptr;
+	};
+
+	// CPU references of the shipped metrics, by metric name. Null Reduce for the others
+	static FCpuReference FindCpuReference(const FString& MetricName)
+	{
+		FCpuReference Reference;
+		if (MetricName == TEXT("Test"))
+		{
+			Reference.NumChannels = 1;
+			Reference.Reduce = [](const FImageView& Image, int64* OutChannels) { OutChannels[0] = FVisibilityCpuReference::CountObjectTexels(Image); };
+		}
+		else if (MetricName == TEXT("LuminanceCalculationShader"))
+		{
+			Reference.NumChannels = 1;
+			Reference.Reduce = [](const FImageView& Image, int64* OutChannels) { OutChannels[0] = FVisibilityCpuReference::SumBrightness(Image); };
+		}
+		return Reference;
+	}
+
+	// The rect the reduction dispatched over, see FVisibilityReductionPassBuilder::AddPasses
+	static FIntRect GetDispatchRect(const FVisibilityCapture& Capture)
+	{
+		const FIntPoint TextureSize(Capture.InputTexture.SizeX, Capture.InputTexture.SizeY);
+		FIntRect DispatchRect = FVisibilityCoverage::GetMeasuredRect(TextureSize, Capture.ViewRect, Capture.ScreenAspectRatio);
+		if (Capture.bRestrictToScreenRect)
+		{
+			DispatchRect.Clip(Capture.ScreenRect);
+		}
+		return DispatchRect;
+	}
+
+	// Copies one slice, cropped to Rect, into an image the CPU reference reads. False for formats it cannot read
+	static bool MakeSliceImage(const FVisibilityCaptureTexture& Texture, int32 Slice, const FIntRect& Rect, FImage& OutImage)
+	{
+		ERawImageFormat::Type Format;
+		bool bSwapRedBlue = false;
+		switch (Texture.PixelFormat)
+		{
+		case PF_B8G8R8A8:
+			Format = ERawImageFormat::BGRA8;
+			break;
+		case PF_R8G8B8A8:
+			Format = ERawImageFormat::BGRA8;
+			bSwapRedBlue = true;
+			break;
+		case PF_FloatRGBA:
+			Format = ERawImageFormat::RGBA16F;
+			break;
+		case PF_A32B32G32R32F:
+			Format = ERawImageFormat::RGBA32F;
+			break;
+		default:
+			return false;
+		}
+
+		const int32 BytesPerPixel = Texture.GetBytesPerPixel();
+		const int32 Width = Rect.Width();
+		const int32 Height = Rect.Height();
+		OutImage.Init(Width, Height, Format, Texture.bSRGB ? EGammaSpace::sRGB : EGammaSpace::Linear);
+
+		const uint8* Source = Texture.GetSlice(Slice);
+		for (int32 Row = 0; Row < Height; ++Row)
+		{
+			const int64 SourceOffset = ((int64)(Rect.Min.Y + Row) * Texture.SizeX + Rect.Min.X) * BytesPerPixel;
+			FMemory::Memcpy(OutImage.RawData.GetData() + (int64)Row * Width * BytesPerPixel, Source + SourceOffset, (SIZE_T)Width * BytesPerPixel);
+		}
+
+		if (bSwapRedBlue)
+		{
+			uint8* Pixel = OutImage.RawData.GetData();
+			for (int64 Index = 0; Index < (int64)Width * Height; ++Index, Pixel += 4)
+			{
+				Swap(Pixel[0], Pixel[2]);
+			}
+		}
+
+		// The shaders read sRGB targets decoded, the CPU reference reads texels as stored
+		if (Texture.bSRGB)
+		{
+			OutImage.ChangeFormat(ERawImageFormat::RGBA32F, EGammaSpace::Linear);
+		}
+		return true;
+	}
+
+	// Reference.NumChannels must match the capture's
+	static bool ReplayCpu(const FVisibilityCapture& Capture, const FCpuReference& Reference, int32 Iterations, FReplayResult& OutResult)
+	{
+		check(Reference.NumChannels == Capture.NumChannels);
+
+		const FIntRect DispatchRect = GetDispatchRect(Capture);
+		const FVisibilityCaptureTexture& Texture = Capture.InputTexture;
+
+		TArray<FImage> Slices;
+		Slices.SetNum(Texture.NumSlices);
+		for (int32 Slice = 0; Slice < Texture.NumSlices; ++Slice)
+		{
+			if (DispatchRect.Area() > 0 && !MakeSliceImage(Texture, Slice, DispatchRect, Slices[Slice]))
+			{
+				return false;
+			}
+		}
+
+		// NumChannels values per slice, slice after slice like the GPU output
+		TArray<int64> SliceResults;
+		SliceResults.SetNumZeroed(Texture.NumSlices * Capture.NumChannels);
+		for (int32 Iteration = 0; Iteration < Iterations; ++Iteration)
+		{
+			const double StartTime = FPlatformTime::Seconds();
+			for (int32 Slice = 0; Slice < Texture.NumSlices && DispatchRect.Area() > 0; ++Slice)
+			{
+				Reference.Reduce(Slices[Slice], SliceResults.GetData() + Slice * Capture.NumChannels);
+			}
+			OutResult.Timings.Add((FPlatformTime::Seconds() - StartTime) * 1000.0);
+		}
+
+		OutResult.bRan = true;
+		for (int32 Slice = 0; Slice < Texture.NumSlices; ++Slice)
+		{
+			OutResult.Result += SliceResults[Slice * Capture.NumChannels];
+			for (int32 Channel = 0; Channel < Capture.NumChannels; ++Channel)
+			{
+				const int32 Index = Slice * Capture.NumChannels + Channel;
+				if (Capture.Result.IsValidIndex(Index))
+				{
+					OutResult.Diff += FMath::Abs(SliceResults[Index] - Capture.Result[Index]);
+				}
+			}
+		}
+		return true;
+	}
+
+	// Game thread. A transient 2D target holding one slice of a captured texture
+	static TStrongObjectPtr<UTextureRenderTarget2D> CreateSliceTarget(const FVisibilityCaptureTexture& Texture, int32 Slice)
+	{
+		TStrongObjectPtr<UTextureRenderTarget2D> RenderTarget(NewObject<UTextureRenderTarget2D>());
+		RenderTarget->ClearColor = FLinearColor::Black;
+		RenderTarget->InitCustomFormat(Texture.SizeX, Texture.SizeY, (EPixelFormat)Texture.PixelFormat, !Texture.bSRGB);
+		RenderTarget->UpdateResourceImmediate(false);
+
+		FTextureRenderTargetResource* Resource = RenderTarget->GameThread_GetRenderTargetResource();
+		const uint8* Data = Texture.GetSlice(Slice);
+		const uint32 Pitch = Texture.SizeX * Texture.GetBytesPerPixel();
+		const FUpdateTextureRegion2D Region(0, 0, 0, 0, Texture.SizeX, Texture.SizeY);
+		ENQUEUE_RENDER_COMMAND(VisibilityReplayUpload)(
+			[Resource, Data, Pitch, Region](FRHICommandListImmediate& RHICmdList)
+			{
+				RHICmdList.UpdateTexture2D(Resource->GetRenderTargetTexture(), 0, Region, Pitch, Data);
+			});
+
+		// The slice data must outlive the upload
+		FlushRenderingCommands();
+		return RenderTarget;
+	}
+
+	// Runs the reduction of every slice Iterations times on the GPU, each slice as a 2D target. Timings are taken with
+	// timestamp queries around the graph, with the passes forced to the graphics pipe so the timestamps bracket them
+	static bool ReplayGpu(const FVisibilityCapture& Capture, const FVisibilityReductionMetric& Metric, int32 Iterations, FReplayResult& OutResult)
+	{
+		const int32 NumSlices = Capture.InputTexture.NumSlices;
+		TArray<int64> SliceTimingsUs;
+
+		for (int32 Slice = 0; Slice < NumSlices; ++Slice)
+		{
+			TStrongObjectPtr<UTextureRenderTarget2D> Input = CreateSliceTarget(Capture.InputTexture, Slice);
+			TStrongObjectPtr<UTextureRenderTarget2D> Camera;
+			if (Capture.bHasCameraTexture)
+			{
+				Camera = CreateSliceTarget(Capture.CameraTexture, FMath::Min(Slice, Capture.CameraTexture.NumSlices - 1));
+			}
+
+			FVisibilityReductionInputs Inputs = Capture.MakeInputs();
+			Inputs.InputTexture = Input.Get();
+			Inputs.CameraTexture = Camera.Get();
+
+			TArray<int64> SliceResult;
+			TArray<uint64> DurationsUs;
+			bool bEnqueued = true;
+			ENQUEUE_RENDER_COMMAND(VisibilityReplayReduce)(
+				[&Inputs, &Metric, Iterations, &SliceResult, &DurationsUs, &bEnqueued](FRHICommandListImmediate& RHICmdList)
+				{
+					const FVisibilityReductionShaders Shaders = Metric.GetShaders(GMaxRHIFeatureLevel);
+
+					TArray<TPair<FRenderQueryRHIRef, FRenderQueryRHIRef>> Queries;
+					for (int32 Iteration = 0; Iteration < Iterations && bEnqueued; ++Iteration)
+					{
+						FRenderQueryRHIRef Begin = RHICreateRenderQuery(RQT_AbsoluteTime);
+						FRenderQueryRHIRef End = RHICreateRenderQuery(RQT_AbsoluteTime);
+
+						RHICmdList.EndRenderQuery(Begin);
+						bEnqueued = FVisibilityReductionPassBuilder::Execute(RHICmdList, Inputs, Shaders, Metric.Name, ERDGPassFlags::Compute,
+							[&SliceResult](const int64* Data, uint32 NumBytes)
+							{
+								SliceResult.Reset();
+								SliceResult.Append(Data, NumBytes / sizeof(int64));
+							});
+						RHICmdList.EndRenderQuery(End);
+
+						Queries.Emplace(Begin, End);
+					}
+
+					// Nothing drives the end of frame here, wait and poll by hand
+					RHICmdList.ImmediateFlush(EImmediateFlushType::FlushRHIThread);
+					RHICmdList.BlockUntilGPUIdle();
+					FVisibilityReadbacks::Poll();
+
+					for (const TPair<FRenderQueryRHIRef, FRenderQueryRHIRef>& Query : Queries)
+					{
+						uint64 BeginUs = 0;
+						uint64 EndUs = 0;
+						if (RHIGetRenderQueryResult(Query.Key, BeginUs, true) && RHIGetRenderQueryResult(Query.Value, EndUs, true))
+						{
+							DurationsUs.Add(EndUs - BeginUs);
+						}
+					}
+				});
+			FlushRenderingCommands();
+
+			if (!bEnqueued || SliceResult.Num() < Capture.NumChannels)
+			{
+				return false;
+			}
+
+			// Iterations are timed per slice, a capture's time is the sum over its slices
+			SliceTimingsUs.SetNumZeroed(FMath::Max(SliceTimingsUs.Num(), DurationsUs.Num()));
+			for (int32 Iteration = 0; Iteration < DurationsUs.Num(); ++Iteration)
+			{
+				SliceTimingsUs[Iteration] += (int64)DurationsUs[Iteration];
+			}
+
+			OutResult.Result += SliceResult[0];
+			for (int32 Channel = 0; Channel < Capture.NumChannels; ++Channel)
+			{
+				const int32 CapturedIndex = Slice * Capture.NumChannels + Channel;
+				if (Capture.Result.IsValidIndex(CapturedIndex))
+				{
+					OutResult.Diff += FMath::Abs(SliceResult[Channel] - Capture.Result[CapturedIndex]);
+				}
+			}
+		}
+
+		for (const int64 TimingUs : SliceTimingsUs)
+		{
+			OutResult.Timings.Add(TimingUs / 1000.0);
+		}
+		OutResult.bRan = true;
+		return true;
+	}
+
+	// Synthetic capture for the tile compaction benchmark: a white square covering Coverage of a black Size x Size target,
+	// centered. Both shipped metrics count white texels and skip black ones
+	static FVisibilityCapture MakeBenchmarkCapture(const FVisibilityReductionMetric& Metric, int32 Size, double Coverage, bool bUseTileCompaction)
+	{
+		FVisibilityCapture Capture;
+		Capture.MetricName = Metric.Name;
+		Capture.NumChannels = Metric.NumChannels;
+		Capture.bUseTileCompaction = bUseTileCompaction;
+
+		FVisibilityCaptureTexture& Texture = Capture.InputTexture;
+		Texture.PixelFormat = PF_B8G8R8A8;
+		Texture.SizeX = Size;
+		Texture.SizeY = Size;
+		Texture.NumSlices = 1;
+		Texture.Pixels.SetNumZeroed(Texture.GetSliceBytes());
+
+		const int32 Edge = FMath::Clamp(FMath::RoundToInt(Size * FMath::Sqrt(Coverage)), 0, Size);
+		const int32 Min = (Size - Edge) / 2;
+		for (int32 Row = Min; Row < Min + Edge; ++Row)
+		{
+			FMemory::Memset(Texture.Pixels.GetData() + ((int64)Row * Size + Min) * 4, 0xff, (SIZE_T)Edge * 4);
+		}
+		return Capture;
+	}
+
+	// Times the full-screen path against tile compaction on sparse, medium and dense synthetic masks
+	static int32 RunBenchmark(const FString& MetricFilter, int32 Size, int32 Iterations, const FString& OutputPath)
+	{
+		static const double Coverages[] = { 0.01, 0.25, 0.9 };
+
+		if (!FApp::CanEverRender())
+		{
+			UE_LOG(LogTemp, Error, TEXT("VisibilityReplay: the benchmark needs an RHI, run it without -nullrhi."));
+			return 1;
+		}
+
+		TArray<const FVisibilityReductionMetric*> Metrics;
+		for (const TCHAR* MetricName : { TEXT("Test"), TEXT("LuminanceCalculationShader") })
+		{
+			if (!MetricFilter.IsEmpty() && MetricFilter != MetricName)
+			{
+				continue;
+			}
+			if (const FVisibilityReductionMetric* Metric = FVisibilityReductionMetric::Find(MetricName))
+			{
+				Metrics.Add(Metric);
+			}
+			else
+			{
+				UE_LOG(LogTemp, Warning, TEXT("VisibilityReplay: metric %s is not loaded, skipping it."), MetricName);
+			}
+		}
+		if (Metrics.IsEmpty())
+		{
+			UE_LOG(LogTemp, Error, TEXT("VisibilityReplay: no metric to benchmark."));
+			return 1;
+		}
+
+		// A forced value would turn the full-screen runs into compacted ones or the reverse
+		IConsoleVariable* TileCompactionCVar = IConsoleManager::Get().FindConsoleVariable(TEXT("r.VisibilityCore.TileCompaction"));
+		const int32 PreviousTileCompaction = TileCompactionCVar ? TileCompactionCVar->GetInt() : 0;
+		if (TileCompactionCVar)
+		{
+			TileCompactionCVar->Set(0, ECVF_SetByCode);
+		}
+
+		TArray<FString> Lines;
+		Lines.Add(TEXT("Metric,Coverage,Width,Height,FullResult,FullMinMs,FullMeanMs,FullMaxMs,CompactedResult,CompactedMinMs,CompactedMeanMs,CompactedMaxMs,Speedup"));
+
+		bool bAnyFailed = false;
+		for (const FVisibilityReductionMetric* Metric : Metrics)
+		{
+			for (const double Coverage : Coverages)
+			{
+				FReplayResult Full;
+				FReplayResult Compacted;
+				if (!ReplayGpu(MakeBenchmarkCapture(*Metric, Size, Coverage, false), *Metric, Iterations, Full)
+					|| !ReplayGpu(MakeBenchmarkCapture(*Metric, Size, Coverage, true), *Metric, Iterations, Compacted))
+				{
+					UE_LOG(LogTemp, Error, TEXT("VisibilityReplay: the %s reduction could not run."), Metric->Name);
+					bAnyFailed = true;
+					continue;
+				}
+
+				// Compaction only skips tiles without relevant texels, both paths must agree
+				if (Full.Result != Compacted.Result)
+				{
+					UE_LOG(LogTemp, Error, TEXT("VisibilityReplay: %s at %.0f%% coverage, the full-screen path returned %lld and tile compaction %lld."),
+						Metric->Name, Coverage * 100.0, Full.Result, Compacted.Result);
+					bAnyFailed = true;
+				}
+
+				const double Speedup = Compacted.Timings.GetMeanMs() > 0.0 ? Full.Timings.GetMeanMs() / Compacted.Timings.GetMeanMs() : 0.0;
+				UE_LOG(LogTemp, Display, TEXT("VisibilityReplay: %s, %d%% coverage of %dx%d. Full %.3f ms mean (%.3f..%.3f), compacted %.3f ms mean (%.3f..%.3f), %.2fx."),
+					Metric->Name, FMath::RoundToInt(Coverage * 100.0), Size, Size,
+					Full.Timings.GetMeanMs(), Full.Timings.MinMs, Full.Timings.MaxMs,
+					Compacted.Timings.GetMeanMs(), Compacted.Timings.MinMs, Compacted.Timings.MaxMs, Speedup);
+
+				Lines.Add(FString::Printf(TEXT("%s,%.2f,%d,%d,%lld,%.4f,%.4f,%.4f,%lld,%.4f,%.4f,%.4f,%.3f"), Metric->Name, Coverage, Size, Size,
+					Full.Result, Full.Timings.MinMs, Full.Timings.GetMeanMs(), Full.Timings.MaxMs,
+					Compacted.Result, Compacted.Timings.MinMs, Compacted.Timings.GetMeanMs(), Compacted.Timings.MaxMs, Speedup));
+			}
+		}
+
+		if (TileCompactionCVar)
+		{
+			TileCompactionCVar->Set(PreviousTileCompaction, ECVF_SetByCode);
+		}
+
+		if (!FFileHelper::SaveStringArrayToFile(Lines, *OutputPath))
+		{
+			UE_LOG(LogTemp, Error, TEXT("VisibilityReplay: cannot write %s."), *OutputPath);
+			return 1;
+		}
+		UE_LOG(LogTemp, Display, TEXT("VisibilityReplay: benchmarked %d metrics, %d iterations each, report in %s."), Metrics.Num(), Iterations, *OutputPath);
+		return bAnyFailed ? 1 : 0;
+	}
+
+	static void AppendTimings(FString& Line, const FReplayResult& Result)
+	{
+		if (Result.bRan)
+		{
+			Line += FString::Printf(TEXT(",%lld,%lld,%.4f,%.4f,%.4f"), Result.Result, Result.Diff,
+				Result.Timings.MinMs, Result.Timings.GetMeanMs(), Result.Timings.MaxMs);
+		}
+		else
+		{
+			Line += TEXT(",,,,,");
+		}
+	}
+}
+
+UVisibilityReplayCommandlet::UVisibilityReplayCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = true;
+	LogToConsole = true;
+	ShowErrorCount = true;
+}
+
+int32 UVisibilityReplayCommandlet::Main(const FString& Params)
+{
+	using namespace VisibilityReplay;
+
+	int32 Iterations = 20;
+	FParse::Value(*Params, TEXT("Iterations="), Iterations);
+	Iterations = FMath::Max(Iterations, 1);
+
+	FString MetricFilter;
+	FParse::Value(*Params, TEXT("Metric="), MetricFilter);
+
+	if (FParse::Param(*Params, TEXT("Benchmark")))
+	{
+		int32 Size = 2048;
+		FParse::Value(*Params, TEXT("Size="), Size);
+
+		FString BenchmarkPath = FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("VisibilityReplay"), TEXT("Benchmark.csv"));
+		FParse::Value(*Params, TEXT("Output="), BenchmarkPath);
+		return RunBenchmark(MetricFilter, FMath::Max(Size, 1), Iterations, BenchmarkPath);
+	}
+
+	FString InputPath;
+	if (!FParse::Value(*Params, TEXT("Input="), InputPath))
+	{
+		UE_LOG(LogTemp, Error, TEXT("VisibilityReplay: missing -Input=<file.vcap>."));
+		return 1;
+	}
+
+	FString OutputPath = FPaths::ChangeExtension(InputPath, TEXT("csv"));
+	FParse::Value(*Params, TEXT("Output="), OutputPath);
+
+	FString Mode = TEXT("Both");
+	FParse::Value(*Params, TEXT("Mode="), Mode);
+	const bool bRunCpu = !Mode.Equals(TEXT("Gpu"), ESearchCase::IgnoreCase);
+	bool bRunGpu = !Mode.Equals(TEXT("Cpu"), ESearchCase::IgnoreCase);
+
+	const bool bFailOnDiff = FParse::Param(*Params, TEXT("FailOnDiff"));
+
+	if (bRunGpu && !FApp::CanEverRender())
+	{
+		UE_LOG(LogTemp, Display, TEXT("VisibilityReplay: no RHI, replaying on the CPU reference only."));
+		bRunGpu = false;
+	}
+
+	FVisibilityCaptureReader Reader;
+	if (!Reader.Open(InputPath))
+	{
+		UE_LOG(LogTemp, Error, TEXT("VisibilityReplay: cannot read %s."), *InputPath);
+		return 1;
+	}
+
+	TArray<FString> Lines;
+	Lines.Add(TEXT("Capture,Frame,Metric,Width,Height,Slices,CapturedResult,CpuResult,CpuDiff,CpuMinMs,CpuMeanMs,CpuMaxMs,GpuResult,GpuDiff,GpuMinMs,GpuMeanMs,GpuMaxMs"));
+
+	TMap<FString, FMetricSummary> Summaries;
+	bool bAnyFailed = false;
+	bool bAnyDiff = false;
+	int32 CaptureIndex = 0;
+
+	FVisibilityCapture Capture;
+	for (; Reader.Next(Capture); ++CaptureIndex)
+	{
+		if (!MetricFilter.IsEmpty() && Capture.MetricName != MetricFilter)
+		{
+			continue;
+		}
+
+		FMetricSummary& Summary = Summaries.FindOrAdd(Capture.MetricName);
+		++Summary.NumCaptures;
+
+		FReplayResult CpuResult;
+		if (bRunCpu)
+		{
+			const FCpuReference Reference = FindCpuReference(Capture.MetricName);
+			if (Reference.Reduce && Reference.NumChannels != Capture.NumChannels)
+			{
+				UE_LOG(LogTemp, Warning, TEXT("VisibilityReplay: capture %d has %d channels, the %s CPU reference computes %d."), CaptureIndex, Capture.NumChannels, *Capture.MetricName, Reference.NumChannels);
+			}
+			else if (Reference.Reduce && !ReplayCpu(Capture, Reference, Iterations, CpuResult))
+			{
+				UE_LOG(LogTemp, Warning, TEXT("VisibilityReplay: capture %d, the CPU reference cannot read pixel format %d."), CaptureIndex, Capture.InputTexture.PixelFormat);
+			}
+		}
+
+		FReplayResult GpuResult;
+		if (bRunGpu)
+		{
+			const FVisibilityReductionMetric* Metric = FVisibilityReductionMetric::Find(Capture.MetricName);
+			if (!Metric)
+			{
+				UE_LOG(LogTemp, Warning, TEXT("VisibilityReplay: capture %d, metric %s is not loaded."), CaptureIndex, *Capture.MetricName);
+			}
+			else if (!ReplayGpu(Capture, *Metric, Iterations, GpuResult))
+			{
+				UE_LOG(LogTemp, Error, TEXT("VisibilityReplay: capture %d, the %s reduction could not run."), CaptureIndex, *Capture.MetricName);
+				bAnyFailed = true;
+			}
+		}
+
+		int64 CapturedResult = 0;
+		for (int32 Slice = 0; Capture.NumChannels > 0 && Slice * Capture.NumChannels < Capture.Result.Num(); ++Slice)
+		{
+			CapturedResult += Capture.Result[Slice * Capture.NumChannels];
+		}
+
+		if (CpuResult.bRan)
+		{
+			Summary.Cpu.Add(CpuResult.Timings.GetMeanMs());
+			Summary.NumCpuDiffs += CpuResult.Diff != 0;
+		}
+		if (GpuResult.bRan)
+		{
+			Summary.Gpu.Add(GpuResult.Timings.GetMeanMs());
+			Summary.NumGpuDiffs += GpuResult.Diff != 0;
+		}
+		bAnyDiff |= CpuResult.Diff != 0 || GpuResult.Diff != 0;
+
+		FString Line = FString::Printf(TEXT("%d,%u,%s,%d,%d,%d,%lld"), CaptureIndex, Capture.FrameNumber, *Capture.MetricName,
+			Capture.InputTexture.SizeX, Capture.InputTexture.SizeY, Capture.InputTexture.NumSlices, CapturedResult);
+		AppendTimings(Line, CpuResult);
+		AppendTimings(Line, GpuResult);
+		Lines.Add(MoveTemp(Line));
+	}
+
+	if (!FFileHelper::SaveStringArrayToFile(Lines, *OutputPath))
+	{
+		UE_LOG(LogTemp, Error, TEXT("VisibilityReplay: cannot write %s."), *OutputPath);
+		return 1;
+	}
+
+	for (const TPair<FString, FMetricSummary>& Pair : Summaries)
+	{
+		const FMetricSummary& Summary = Pair.Value;
+		UE_LOG(LogTemp, Display, TEXT("VisibilityReplay: %s, %d captures. CPU %.3f ms mean (%.3f..%.3f), %d differ. GPU %.3f ms mean (%.3f..%.3f), %d differ."),
+			*Pair.Key, Summary.NumCaptures,
+			Summary.Cpu.GetMeanMs(), Summary.Cpu.MinMs, Summary.Cpu.MaxMs, Summary.NumCpuDiffs,
+			Summary.Gpu.GetMeanMs(), Summary.Gpu.MinMs, Summary.Gpu.MaxMs, Summary.NumGpuDiffs);
+	}
+	UE_LOG(LogTemp, Display, TEXT("VisibilityReplay: read %d captures, replayed %d times each, report in %s."), CaptureIndex, Iterations, *OutputPath);
+
+	return bAnyFailed || (bFailOnDiff && bAnyDiff) ? 1 : 0;
+}
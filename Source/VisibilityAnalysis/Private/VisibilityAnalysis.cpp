@@ -0,0 +1,17 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "VisibilityAnalysis.h"
+
+#define LOCTEXT_NAMESPACE "FVisibilityAnalysisModule"
+
+void FVisibilityAnalysisModule::StartupModule()
+{
+}
+
+void FVisibilityAnalysisModule::ShutdownModule()
+{
+}
+
+#undef LOCTEXT_NAMESPACE
+	
+IMPLEMENT_MODULE(FVisibilityAnalysisModule, VisibilityAnalysis)
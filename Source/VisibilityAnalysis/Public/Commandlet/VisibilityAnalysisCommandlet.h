@@ -0,0 +1,23 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "VisibilityAnalysisCommandlet.generated.h"
+
+// Computes the Test and LuminanceCalculation metrics of captured mask / camera frame pairs on the CPU, without a GPU.
+//
+// UnrealEditor-Cmd <Project> -run=VisibilityAnalysis -Input=<dir> [-Output=<file.csv|file.bin>]
+//     [-MaskSuffix=_mask] [-CameraSuffix=_camera] [-Prefetch=<frames>] -nullrhi
+//
+// Frames are decoded and reduced on worker threads, at most Prefetch pairs ahead of the writer, so memory stays bounded
+// whatever the size of the dataset. See VisibilityAnalysisCommandlet_readme.md
+UCLASS()
+class VISIBILITYANALYSIS_API UVisibilityAnalysisCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UVisibilityAnalysisCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+};
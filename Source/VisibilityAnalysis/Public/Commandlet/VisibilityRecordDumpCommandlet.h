@@ -0,0 +1,21 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "VisibilityRecordDumpCommandlet.generated.h"
+
+// Converts a recording of FVisibilityRecorder to CSV, or prints its summary.
+//
+// UnrealEditor-Cmd <Project> -run=VisibilityRecordDump -Input=<file.vrec> [-Output=<file.csv>] [-FromFrame=<n>] [-ToFrame=<n>] -nullrhi
+//
+// See Source/VisibilityCore/Public/Recorder/VisibilityRecorder_readme.md
+UCLASS()
+class VISIBILITYANALYSIS_API UVisibilityRecordDumpCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UVisibilityRecordDumpCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+};
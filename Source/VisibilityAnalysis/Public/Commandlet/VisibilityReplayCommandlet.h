@@ -0,0 +1,25 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "VisibilityReplayCommandlet.generated.h"
+
+// Runs the reductions of a capture file written by FVisibilityFrameCapture again, on the GPU kernels and on the CPU
+// reference, and reports their timings and how their results differ from the captured ones.
+//
+// UnrealEditor-Cmd <Project> -run=VisibilityReplay -Input=<file.vcap> [-Output=<report.csv>] [-Iterations=<n>]
+//     [-Mode=Both|Gpu|Cpu] [-Metric=<name>] [-FailOnDiff]
+// UnrealEditor-Cmd <Project> -run=VisibilityReplay -Benchmark [-Size=<texels>] [-Output=<report.csv>] [-Iterations=<n>] [-Metric=<name>]
+//
+// -Benchmark times tile compaction against the full-screen path on synthetic 1%, 25% and 90% coverage masks instead.
+// With -nullrhi only the CPU reference runs. See VisibilityReplayCommandlet_readme.md
+UCLASS()
+class VISIBILITYANALYSIS_API UVisibilityReplayCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UVisibilityReplayCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+};
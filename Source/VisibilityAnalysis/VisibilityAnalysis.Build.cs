@@ -0,0 +1,30 @@
+using UnrealBuildTool; 
+
+public class VisibilityAnalysis: ModuleRules 
+
+{ 
+
+	public VisibilityAnalysis(ReadOnlyTargetRules Target) : base(Target) 
+
+	{
+		PCHUsage = PCHUsageMode.UseExplicitOrSharedPCHs;
+		
+		PrivateIncludePaths.AddRange(new string[] 
+		{
+			"VisibilityAnalysis/Private"
+		});
+		PublicDependencyModuleNames.Add("Core");
+		PublicDependencyModuleNames.Add("CoreUObject");
+		PublicDependencyModuleNames.Add("Engine");
+		
+		PrivateDependencyModuleNames.AddRange(new string[]
+		{
+			"ImageCore",
+			"ImageWrapper",
+			"RenderCore",
+			"RHI",
+			"VisibilityCore"
+		});
+	} 
+
+}
@@ -0,0 +1,529 @@
+#include "Capture/VisibilityFrameCapture.h"
+#include "HAL/FileManager.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/Runnable.h"
+#include "HAL/RunnableThread.h"
+#include "Containers/Queue.h"
+#include "Misc/Compression.h"
+#include "Misc/Paths.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+#include "RenderGraphBuilder.h"
+#include "RenderGraphUtils.h"
+#include "RenderingThread.h"
+#include "RHIGPUReadback.h"
+#include "Engine/TextureRenderTarget.h"
+
+// Seconds the writer thread sleeps between two drains of its queue
+static constexpr float VisibilityCaptureDrainInterval = 0.01f;
+// Render thread frames after which a capture whose copies never landed is dropped
+static constexpr uint32 VisibilityCaptureMaxPendingFrames = 64;
+// Largest serialized capture, twice an 8K RGBA8 input with its camera texture. The writer drops larger captures and the
+// reader rejects larger sizes as corrupt rather than allocating them
+static constexpr uint32 VisibilityCaptureMaxBytes = 1u << 30;
+// Upper bound of the zlib compression ratio
+static constexpr uint32 VisibilityCaptureMaxCompressionRatio = 1032;
+
+static TAutoConsoleVariable<FString> CVarVisibilityCaptureMetric(
+	TEXT("r.VisibilityCore.Capture.Metric"),
+	TEXT(""),
+	TEXT("Only captures reductions of this metric, f.e. Test. Empty captures every metric"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarVisibilityCaptureMaxPendingMB(
+	TEXT("r.VisibilityCore.Capture.MaxPendingMB"),
+	256,
+	TEXT("Captures waiting to be compressed and written may hold at most this many MB, further captures are dropped"),
+	ECVF_RenderThreadSafe);
+
+std::atomic<bool> FVisibilityFrameCapture::bCapturing{ false };
+std::atomic<int32> FVisibilityFrameCapture::NumToCapture{ 0 };
+TUniquePtr<FVisibilityFrameCapture::FWriter> FVisibilityFrameCapture::Writer;
+TArray<TSharedPtr<FVisibilityFrameCapture::FPendingCapture>> FVisibilityFrameCapture::Pending;
+
+int32 FVisibilityCaptureTexture::GetBytesPerPixel() const
+{
+	return PixelFormat > PF_Unknown && PixelFormat < PF_MAX ? GPixelFormats[PixelFormat].BlockBytes : 0;
+}
+
+FArchive& operator<<(FArchive& Ar, FVisibilityCaptureTexture& Texture)
+{
+	Ar << Texture.PixelFormat << Texture.SizeX << Texture.SizeY << Texture.NumSlices << Texture.bSRGB;
+	Ar << Texture.Pixels;
+	return Ar;
+}
+
+FArchive& operator<<(FArchive& Ar, FVisibilityCapture& Capture)
+{
+	Ar << Capture.MetricName << Capture.FrameNumber << Capture.Time;
+	Ar << Capture.ViewRect << Capture.ScreenAspectRatio << Capture.ScreenRect << Capture.bRestrictToScreenRect << Capture.bUseTileCompaction;
+	Ar << Capture.NumChannels << Capture.Result;
+	Ar << Capture.InputTexture << Capture.bHasCameraTexture;
+	if (Capture.bHasCameraTexture)
+	{
+		Ar << Capture.CameraTexture;
+	}
+	return Ar;
+}
+
+FVisibilityReductionInputs FVisibilityCapture::MakeInputs() const
+{
+	FVisibilityReductionInputs Inputs;
+	Inputs.ViewRect = ViewRect;
+	Inputs.ScreenAspectRatio = ScreenAspectRatio;
+	Inputs.ScreenRect = ScreenRect;
+	Inputs.bRestrictToScreenRect = bRestrictToScreenRect;
+	Inputs.bUseTileCompaction = bUseTileCompaction;
+	return Inputs;
+}
+
+// A selected reduction whose copies are in flight. Render thread only
+struct FVisibilityFrameCapture::FPendingCapture
+{
+	struct FSliceReadback
+	{
+		TUniquePtr<FRHIGPUTextureReadback> Readback;
+		FVisibilityCaptureTexture* Texture;
+		int32 Slice;
+	};
+
+	TUniquePtr<FVisibilityCapture> Capture;
+	TArray<FSliceReadback> Readbacks;
+	bool bHasResult = false;
+	uint32 FirstFrame = 0;
+};
+
+class FVisibilityFrameCapture::FWriter : public FRunnable
+{
+public:
+	virtual ~FWriter()
+	{
+		delete Thread;
+	}
+
+	bool Open(const FString& Path)
+	{
+		File.Reset(IFileManager::Get().CreateFileWriter(*Path));
+		if (!File)
+		{
+			return false;
+		}
+
+		FVisibilityCaptureFileHeader Header;
+		*File << Header;
+
+		Thread = FRunnableThread::Create(this, TEXT("VisibilityFrameCapture"), 0, TPri_BelowNormal);
+		return Thread != nullptr;
+	}
+
+	// Game thread, once the render thread can't push anymore. Writes what is left and closes the file
+	void Finish()
+	{
+		bStopRequested = true;
+		Thread->WaitForCompletion();
+		File->Close();
+
+		UE_LOG(LogTemp, Display, TEXT("Wrote %d visibility captures, %d dropped."), NumWritten, NumDropped.load(std::memory_order_relaxed));
+	}
+
+	virtual uint32 Run() override
+	{
+		while (!bStopRequested)
+		{
+			Drain();
+			FPlatformProcess::Sleep(VisibilityCaptureDrainInterval);
+		}
+		Drain();
+		return 0;
+	}
+
+	// Render thread. Returns false, and drops the capture, when the writer is too far behind
+	bool Push(TUniquePtr<FVisibilityCapture>&& Capture)
+	{
+		const int64 Bytes = Capture->InputTexture.Pixels.Num() + Capture->CameraTexture.Pixels.Num();
+		const int64 MaxBytes = (int64)CVarVisibilityCaptureMaxPendingMB.GetValueOnRenderThread() << 20;
+		if (PendingBytes.load(std::memory_order_relaxed) + Bytes > MaxBytes)
+		{
+			NumDropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		PendingBytes.fetch_add(Bytes, std::memory_order_relaxed);
+		Queue.Enqueue(MoveTemp(Capture));
+		return true;
+	}
+
+	void CountDropped()
+	{
+		NumDropped.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	const double StartTime = FPlatformTime::Seconds();
+
+private:
+	// Writer thread. Every capture is stored as uint32 UncompressedSize, uint32 CompressedSize and the compressed serialization
+	void Drain()
+	{
+		TUniquePtr<FVisibilityCapture> Capture;
+		while (Queue.Dequeue(Capture))
+		{
+			const int64 Bytes = Capture->InputTexture.Pixels.Num() + Capture->CameraTexture.Pixels.Num();
+
+			Uncompressed.Reset();
+			FMemoryWriter CaptureWriter(Uncompressed);
+			CaptureWriter << *Capture;
+			Capture.Reset();
+			PendingBytes.fetch_sub(Bytes, std::memory_order_relaxed);
+			if (Uncompressed.Num() > (int64)VisibilityCaptureMaxBytes)
+			{
+				NumDropped.fetch_add(1, std::memory_order_relaxed);
+				continue;
+			}
+
+			int32 CompressedSize = FCompression::CompressMemoryBound(NAME_Zlib, Uncompressed.Num());
+			Compressed.SetNumUninitialized(CompressedSize, false);
+			if (!FCompression::CompressMemory(NAME_Zlib, Compressed.GetData(), CompressedSize, Uncompressed.GetData(), Uncompressed.Num()))
+			{
+				NumDropped.fetch_add(1, std::memory_order_relaxed);
+				continue;
+			}
+
+			uint32 UncompressedSize = Uncompressed.Num();
+			uint32 StoredSize = CompressedSize;
+			*File << UncompressedSize << StoredSize;
+			File->Serialize(Compressed.GetData(), CompressedSize);
+			++NumWritten;
+		}
+		File->Flush();
+	}
+
+	FRunnableThread* Thread = nullptr;
+	std::atomic<bool> bStopRequested{ false };
+	TUniquePtr<FArchive> File;
+
+	// Render thread -> writer thread
+	TQueue<TUniquePtr<FVisibilityCapture>, EQueueMode::Spsc> Queue;
+	std::atomic<int64> PendingBytes{ 0 };
+	std::atomic<int32> NumDropped{ 0 };
+
+	// Writer thread only, kept across captures
+	TArray<uint8> Uncompressed;
+	TArray<uint8> Compressed;
+	int32 NumWritten = 0;
+};
+
+bool FVisibilityFrameCapture::Start(const FString& Path)
+{
+	check(IsInGameThread());
+
+	Stop();
+
+	IFileManager::Get().MakeDirectory(*FPaths::GetPath(Path), true);
+	TUniquePtr<FWriter> NewWriter = MakeUnique<FWriter>();
+	if (!NewWriter->Open(Path))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Can't capture visibility reductions to %s."), *Path);
+		return false;
+	}
+
+	Writer = MoveTemp(NewWriter);
+	bCapturing.store(true, std::memory_order_release);
+
+	UE_LOG(LogTemp, Display, TEXT("Capturing visibility reductions to %s."), *Path);
+	return true;
+}
+
+void FVisibilityFrameCapture::Stop()
+{
+	check(IsInGameThread());
+
+	if (!Writer)
+	{
+		return;
+	}
+
+	bCapturing.store(false, std::memory_order_release);
+	NumToCapture.store(0, std::memory_order_relaxed);
+
+	// Stopping is the one place that waits for the GPU, so the captures in flight make it into the file
+	ENQUEUE_RENDER_COMMAND(VisibilityFrameCaptureStop)(
+		[](FRHICommandListImmediate& RHICmdList)
+		{
+			RHICmdList.ImmediateFlush(EImmediateFlushType::FlushRHIThread);
+			RHICmdList.BlockUntilGPUIdle();
+			FVisibilityReadbacks::Poll();
+			Poll();
+
+			for (int32 Index = 0; Index < Pending.Num(); ++Index)
+			{
+				Writer->CountDropped();
+			}
+			Pending.Empty();
+		});
+	FlushRenderingCommands();
+
+	Writer->Finish();
+	Writer.Reset();
+}
+
+void FVisibilityFrameCapture::CaptureNext(int32 Count)
+{
+	NumToCapture.store(FMath::Max(Count, 0), std::memory_order_relaxed);
+}
+
+bool FVisibilityFrameCapture::ShouldCapture(const FVisibilityReductionInputs& Inputs, const TCHAR* MetricName)
+{
+	const FString MetricFilter = CVarVisibilityCaptureMetric.GetValueOnRenderThread();
+	if (!MetricFilter.IsEmpty() && MetricFilter != MetricName)
+	{
+		return false;
+	}
+	if (Inputs.bCapture)
+	{
+		return true;
+	}
+
+	// Only the render thread decrements, the game thread may reset it concurrently
+	int32 Remaining = NumToCapture.load(std::memory_order_relaxed);
+	while (Remaining > 0)
+	{
+		if (NumToCapture.compare_exchange_weak(Remaining, Remaining - 1, std::memory_order_relaxed))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// Copies every slice of a render target into its own texture readback. Texture arrays and cubes go through a 2D
+// staging texture per slice, readbacks only copy the first slice of their source
+static void AddSliceReadbacks(FRDGBuilder& GraphBuilder, UTextureRenderTarget* RenderTarget, FVisibilityCaptureTexture& OutTexture, TArray<TPair<TUniquePtr<FRHIGPUTextureReadback>, int32>>& OutReadbacks)
+{
+	FRDGTextureRef Texture = FVisibilityReductionPassBuilder::RegisterRenderTarget(RenderTarget, GraphBuilder, TEXT("VisibilityCaptureSource"));
+	if (!Texture)
+	{
+		return;
+	}
+
+	const FRDGTextureDesc& Desc = Texture->Desc;
+	OutTexture.PixelFormat = Desc.Format;
+	OutTexture.SizeX = Desc.Extent.X;
+	OutTexture.SizeY = Desc.Extent.Y;
+	OutTexture.NumSlices = FVisibilityReductionPassBuilder::GetNumSlices(Desc);
+	OutTexture.bSRGB = EnumHasAnyFlags(Desc.Flags, TexCreate_SRGB);
+
+	for (int32 Slice = 0; Slice < OutTexture.NumSlices; ++Slice)
+	{
+		TUniquePtr<FRHIGPUTextureReadback> Readback = MakeUnique<FRHIGPUTextureReadback>(TEXT("VisibilityCapture"));
+		if (Desc.Dimension == ETextureDimension::Texture2D)
+		{
+			AddEnqueueCopyPass(GraphBuilder, Readback.Get(), Texture);
+		}
+		else
+		{
+			FRDGTextureRef SliceTexture = GraphBuilder.CreateTexture(
+				FRDGTextureDesc::Create2D(Desc.Extent, Desc.Format, FClearValueBinding::None, TexCreate_ShaderResource),
+				TEXT("VisibilityCaptureSlice"));
+
+			FRHICopyTextureInfo CopyInfo;
+			CopyInfo.Size = FIntVector(Desc.Extent.X, Desc.Extent.Y, 1);
+			CopyInfo.SourceSliceIndex = Slice;
+			CopyInfo.NumSlices = 1;
+			AddCopyTexturePass(GraphBuilder, Texture, SliceTexture, CopyInfo);
+			AddEnqueueCopyPass(GraphBuilder, Readback.Get(), SliceTexture);
+		}
+		OutReadbacks.Emplace(MoveTemp(Readback), Slice);
+	}
+}
+
+void FVisibilityFrameCapture::AddCapture(FRDGBuilder& GraphBuilder, const FVisibilityReductionInputs& Inputs, const TCHAR* MetricName, int32 NumChannels, FVisibilityReadbacks::FOnReady& OnReady)
+{
+	check(IsInRenderingThread());
+
+	if (!IsCapturing() || !ShouldCapture(Inputs, MetricName))
+	{
+		return;
+	}
+
+	TSharedPtr<FPendingCapture> Entry = MakeShared<FPendingCapture>();
+	Entry->FirstFrame = GFrameNumberRenderThread;
+	Entry->Capture = MakeUnique<FVisibilityCapture>();
+
+	FVisibilityCapture& Capture = *Entry->Capture;
+	Capture.MetricName = MetricName;
+	Capture.FrameNumber = GFrameNumberRenderThread;
+	Capture.Time = FPlatformTime::Seconds() - Writer->StartTime;
+	Capture.ViewRect = Inputs.ViewRect;
+	Capture.ScreenAspectRatio = Inputs.ScreenAspectRatio;
+	Capture.ScreenRect = Inputs.ScreenRect;
+	Capture.bRestrictToScreenRect = Inputs.bRestrictToScreenRect;
+	Capture.bUseTileCompaction = Inputs.bUseTileCompaction;
+	Capture.NumChannels = NumChannels;
+
+	auto AddTexture = [&GraphBuilder, &Entry](UTextureRenderTarget* RenderTarget, FVisibilityCaptureTexture& Texture)
+	{
+		TArray<TPair<TUniquePtr<FRHIGPUTextureReadback>, int32>> Readbacks;
+		AddSliceReadbacks(GraphBuilder, RenderTarget, Texture, Readbacks);
+		for (TPair<TUniquePtr<FRHIGPUTextureReadback>, int32>& Readback : Readbacks)
+		{
+			Entry->Readbacks.Add({ MoveTemp(Readback.Key), &Texture, Readback.Value });
+		}
+		Texture.Pixels.SetNumUninitialized(Texture.GetSliceBytes() * Texture.NumSlices);
+	};
+
+	AddTexture(Inputs.InputTexture, Capture.InputTexture);
+	if (Inputs.CameraTexture)
+	{
+		Capture.bHasCameraTexture = true;
+		AddTexture(Inputs.CameraTexture, Capture.CameraTexture);
+	}
+
+	OnReady = [OnReady = MoveTemp(OnReady), Entry](const int64* Data, uint32 NumBytes)
+	{
+		Entry->Capture->Result.Append(Data, NumBytes / sizeof(int64));
+		Entry->bHasResult = true;
+		OnReady(Data, NumBytes);
+	};
+
+	Pending.Add(MoveTemp(Entry));
+}
+
+void FVisibilityFrameCapture::Poll()
+{
+	check(IsInRenderingThread());
+
+	for (int32 Index = 0; Index < Pending.Num(); )
+	{
+		FPendingCapture& Entry = *Pending[Index];
+
+		// Copied out as they land, so the readbacks can be freed early
+		for (int32 ReadbackIndex = 0; ReadbackIndex < Entry.Readbacks.Num(); )
+		{
+			FPendingCapture::FSliceReadback& SliceReadback = Entry.Readbacks[ReadbackIndex];
+			if (!SliceReadback.Readback->IsReady())
+			{
+				++ReadbackIndex;
+				continue;
+			}
+
+			FVisibilityCaptureTexture& Texture = *SliceReadback.Texture;
+			const int64 RowBytes = (int64)Texture.SizeX * Texture.GetBytesPerPixel();
+			int32 RowPitchInPixels = 0;
+			const uint8* Source = (const uint8*)SliceReadback.Readback->Lock(RowPitchInPixels);
+			if (Source)
+			{
+				uint8* Destination = Texture.Pixels.GetData() + SliceReadback.Slice * Texture.GetSliceBytes();
+				const int64 SourcePitch = (int64)RowPitchInPixels * Texture.GetBytesPerPixel();
+				for (int32 Row = 0; Row < Texture.SizeY; ++Row)
+				{
+					FMemory::Memcpy(Destination + Row * RowBytes, Source + Row * SourcePitch, RowBytes);
+				}
+			}
+			SliceReadback.Readback->Unlock();
+
+			Entry.Readbacks.RemoveAtSwap(ReadbackIndex, 1, false);
+		}
+
+		const bool bComplete = Entry.bHasResult && Entry.Readbacks.Num() == 0;
+		const bool bExpired = GFrameNumberRenderThread - Entry.FirstFrame > VisibilityCaptureMaxPendingFrames;
+		if (!bComplete && !bExpired)
+		{
+			++Index;
+			continue;
+		}
+
+		if (Writer)
+		{
+			if (bComplete)
+			{
+				Writer->Push(MoveTemp(Entry.Capture));
+			}
+			else
+			{
+				Writer->CountDropped();
+			}
+		}
+		Pending.RemoveAt(Index, 1, false);
+	}
+}
+
+void FVisibilityFrameCapture::Shutdown()
+{
+	Pending.Empty();
+}
+
+bool FVisibilityCaptureReader::Open(const FString& Path)
+{
+	File.Reset(IFileManager::Get().CreateFileReader(*Path));
+	if (!File)
+	{
+		return false;
+	}
+
+	FVisibilityCaptureFileHeader Header;
+	*File << Header;
+	if (File->IsError() || Header.Magic != FVisibilityCaptureFileHeader::ExpectedMagic || Header.Version != FVisibilityCaptureFileHeader::CurrentVersion)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s is not a visibility capture of version %u."), *Path, FVisibilityCaptureFileHeader::CurrentVersion);
+		File.Reset();
+		return false;
+	}
+	return true;
+}
+
+bool FVisibilityCaptureReader::Next(FVisibilityCapture& OutCapture)
+{
+	if (!File || File->Tell() + 2 * (int64)sizeof(uint32) > File->TotalSize())
+	{
+		return false;
+	}
+
+	uint32 UncompressedSize = 0;
+	uint32 CompressedSize = 0;
+	*File << UncompressedSize << CompressedSize;
+	if (File->Tell() + CompressedSize > File->TotalSize())
+	{
+		// Interrupted while writing, everything before is still readable
+		return false;
+	}
+	if (UncompressedSize > VisibilityCaptureMaxBytes || UncompressedSize > (uint64)CompressedSize * VisibilityCaptureMaxCompressionRatio)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Corrupt visibility capture at offset %lld, it claims %u bytes from %u compressed."), File->Tell() - 2 * (int64)sizeof(uint32), UncompressedSize, CompressedSize);
+		return false;
+	}
+
+	Compressed.SetNumUninitialized(CompressedSize, false);
+	File->Serialize(Compressed.GetData(), CompressedSize);
+	Uncompressed.SetNumUninitialized(UncompressedSize, false);
+	if (File->IsError() || !FCompression::UncompressMemory(NAME_Zlib, Uncompressed.GetData(), UncompressedSize, Compressed.GetData(), CompressedSize))
+	{
+		return false;
+	}
+
+	OutCapture = FVisibilityCapture();
+	FMemoryReader Reader(Uncompressed);
+	Reader << OutCapture;
+	return !Reader.IsError();
+}
+
+static FAutoConsoleCommand CmdVisibilityCaptureStart(
+	TEXT("r.VisibilityCore.Capture.Start"),
+	TEXT("Captures the inputs and results of selected visibility reductions into the given file, Saved/Profiling/VisibilityCaptures.vcap by default. ")
+	TEXT("Reductions are selected by FVisibilityReductionInputs::bCapture or r.VisibilityCore.Capture.Next"),
+	FConsoleCommandWithArgsDelegate::CreateStatic([](const TArray<FString>& Args)
+	{
+		FVisibilityFrameCapture::Start(Args.Num() > 0 ? Args[0] : FPaths::Combine(FPaths::ProfilingDir(), TEXT("VisibilityCaptures.vcap")));
+	}));
+
+static FAutoConsoleCommand CmdVisibilityCaptureNext(
+	TEXT("r.VisibilityCore.Capture.Next"),
+	TEXT("Captures the next N visibility reductions (1 by default) while r.VisibilityCore.Capture.Start is running"),
+	FConsoleCommandWithArgsDelegate::CreateStatic([](const TArray<FString>& Args)
+	{
+		FVisibilityFrameCapture::CaptureNext(Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 1);
+	}));
+
+static FAutoConsoleCommand CmdVisibilityCaptureStop(
+	TEXT("r.VisibilityCore.Capture.Stop"),
+	TEXT("Stops r.VisibilityCore.Capture.Start and closes the file"),
+	FConsoleCommandDelegate::CreateStatic(&FVisibilityFrameCapture::Stop));
@@ -0,0 +1,54 @@
+#include "Coverage/VisibilityCoverage.h"
+#include "Engine/TextureRenderTarget.h"
+
+static FIntRect GetViewRect(FIntPoint TextureSize, const FIntRect& ViewRect)
+{
+	FIntRect Result(FIntPoint::ZeroValue, TextureSize);
+	if (ViewRect.Area() > 0)
+	{
+		Result.Clip(ViewRect);
+	}
+	return Result;
+}
+
+FIntRect FVisibilityCoverage::GetMeasuredRect(FIntPoint TextureSize, const FIntRect& ViewRect, float ScreenAspectRatio)
+{
+	FIntRect Result = GetViewRect(TextureSize, ViewRect);
+	if (ScreenAspectRatio <= 0.f || Result.Area() <= 0)
+	{
+		return Result;
+	}
+
+	// Rounded to whole rows, the half row this drops or adds at most is part of the error model
+	const int32 ScreenHeight = FMath::RoundToInt(Result.Width() / ScreenAspectRatio);
+	if (ScreenHeight < Result.Height())
+	{
+		Result.Min.Y += (Result.Height() - ScreenHeight) / 2;
+		Result.Max.Y = Result.Min.Y + ScreenHeight;
+	}
+	return Result;
+}
+
+double FVisibilityCoverage::GetScreenArea(FIntPoint TextureSize, const FIntRect& ViewRect, float ScreenAspectRatio)
+{
+	const FIntRect Rect = GetViewRect(TextureSize, ViewRect);
+	if (Rect.Area() <= 0)
+	{
+		return 0.0;
+	}
+	if (ScreenAspectRatio <= 0.f)
+	{
+		return (double)Rect.Area();
+	}
+	return (double)Rect.Width() * Rect.Width() / ScreenAspectRatio;
+}
+
+double FVisibilityCoverage::GetScreenArea(const UTextureRenderTarget* Texture, const FIntRect& ViewRect, float ScreenAspectRatio)
+{
+	if (!Texture)
+	{
+		return 0.0;
+	}
+	const FIntPoint TextureSize(FMath::RoundToInt(Texture->GetSurfaceWidth()), FMath::RoundToInt(Texture->GetSurfaceHeight()));
+	return GetScreenArea(TextureSize, ViewRect, ScreenAspectRatio);
+}
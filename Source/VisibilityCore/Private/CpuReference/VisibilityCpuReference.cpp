@@ -0,0 +1,131 @@
+#include "CpuReference/VisibilityCpuReference.h"
+
+// Rows reduced by one ParallelFor task. Large enough to amortize the task, small enough to balance 1080p over many cores
+static constexpr int32 VisibilityCpuRowsPerTask = 32;
+
+static float SRGBToLinear(float Color)
+{
+	if (Color <= 0.04045f)
+	{
+		return Color / 12.92f;
+	}
+	return FMath::Pow((Color + 0.055f) / 1.055f, 2.4f);
+}
+
+static float LuminanceToBrightness(float Luminance)
+{
+	if (Luminance <= 0.008856f)
+	{
+		return Luminance * 903.3f;
+	}
+	return FMath::Pow(Luminance, 1.0f / 3.0f) * 116.0f - 16.0f;
+}
+
+float FVisibilityCpuReference::GetBrightness(const FLinearColor& Color)
+{
+	// Weighting linear colors to obtain luminance
+	const float Luminance = 0.2126f * SRGBToLinear(Color.R) + 0.7152f * SRGBToLinear(Color.G) + 0.0722f * SRGBToLinear(Color.B);
+	return LuminanceToBrightness(Luminance);
+}
+
+bool FVisibilityCpuReference::IsSupportedFormat(ERawImageFormat::Type Format)
+{
+	return Format == ERawImageFormat::BGRA8 || Format == ERawImageFormat::RGBA16F || Format == ERawImageFormat::RGBA32F;
+}
+
+void FVisibilityCpuReference::NormalizeFormat(FImage& Image)
+{
+	if (IsSupportedFormat(Image.Format))
+	{
+		return;
+	}
+
+	// Declared linear first, so the conversion keeps the stored values instead of decoding sRGB
+	Image.GammaSpace = EGammaSpace::Linear;
+	Image.ChangeFormat(ERawImageFormat::RGBA32F, EGammaSpace::Linear);
+}
+
+static FLinearColor LoadTexel(const FColor& Texel)
+{
+	return FLinearColor(Texel.R / 255.0f, Texel.G / 255.0f, Texel.B / 255.0f, Texel.A / 255.0f);
+}
+
+static FLinearColor LoadTexel(const FFloat16Color& Texel)
+{
+	return FLinearColor(Texel.R.GetFloat(), Texel.G.GetFloat(), Texel.B.GetFloat(), Texel.A.GetFloat());
+}
+
+static FLinearColor LoadTexel(const FLinearColor& Texel)
+{
+	return Texel;
+}
+
+// Sums PerTexel over every texel of the first slice, in row blocks spread over the task graph unless Flags force a single thread
+template<typename TTexel, typename TPerTexel>
+static int64 ReduceTexels(const FImageView& Image, EParallelForFlags Flags, TPerTexel PerTexel)
+{
+	const TTexel* Texels = (const TTexel*)Image.RawData;
+	const int32 Width = Image.SizeX;
+	const int32 Height = Image.SizeY;
+	const int32 NumTasks = FMath::DivideAndRoundUp(Height, VisibilityCpuRowsPerTask);
+
+	TArray<int64, TInlineAllocator<128>> Partials;
+	Partials.SetNumZeroed(NumTasks);
+
+	ParallelFor(NumTasks, [&](int32 Task)
+	{
+		const int32 RowBegin = Task * VisibilityCpuRowsPerTask;
+		const int32 RowEnd = FMath::Min(RowBegin + VisibilityCpuRowsPerTask, Height);
+
+		int64 Sum = 0;
+		for (int32 Y = RowBegin; Y < RowEnd; ++Y)
+		{
+			const TTexel* Row = Texels + (int64)Y * Width;
+			for (int32 X = 0; X < Width; ++X)
+			{
+				Sum += PerTexel(LoadTexel(Row[X]));
+			}
+		}
+		Partials[Task] = Sum;
+	}, Flags);
+
+	int64 Total = 0;
+	for (int64 Partial : Partials)
+	{
+		Total += Partial;
+	}
+	return Total;
+}
+
+template<typename TPerTexel>
+static int64 ReduceImage(const FImageView& Image, EParallelForFlags Flags, TPerTexel PerTexel)
+{
+	switch (Image.Format)
+	{
+	case ERawImageFormat::BGRA8:
+		return ReduceTexels<FColor>(Image, Flags, PerTexel);
+	case ERawImageFormat::RGBA16F:
+		return ReduceTexels<FFloat16Color>(Image, Flags, PerTexel);
+	case ERawImageFormat::RGBA32F:
+		return ReduceTexels<FLinearColor>(Image, Flags, PerTexel);
+	default:
+		UE_LOG(LogTemp, Warning, TEXT("Unsupported image format %d for the CPU reduction, see FVisibilityCpuReference::NormalizeFormat."), (int32)Image.Format);
+		return 0;
+	}
+}
+
+int64 FVisibilityCpuReference::CountObjectTexels(const FImageView& Mask, EParallelForFlags Flags)
+{
+	return ReduceImage(Mask, Flags, [](const FLinearColor& Color) -> int64
+	{
+		return IsObjectTexel(Color) ? 1 : 0;
+	});
+}
+
+int64 FVisibilityCpuReference::SumBrightness(const FImageView& Frame, EParallelForFlags Flags)
+{
+	return ReduceImage(Frame, Flags, [](const FLinearColor& Color) -> int64
+	{
+		return IsNotDark(Color) ? (int64)FMath::FloorToInt(GetBrightness(Color)) : 0;
+	});
+}
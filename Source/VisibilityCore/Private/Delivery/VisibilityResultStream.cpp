@@ -0,0 +1,45 @@
+#include "Delivery/VisibilityResultStream.h"
+
+TArray<TWeakPtr<FVisibilityResultStreamBase, ESPMode::ThreadSafe>> FVisibilityResultStreams::Streams;
+
+void FVisibilityResultStreams::Register(const TSharedRef<FVisibilityResultStreamBase, ESPMode::ThreadSafe>& Stream)
+{
+	check(IsInGameThread());
+	Streams.Add(Stream);
+}
+
+void FVisibilityResultStreams::Unregister(const FVisibilityResultStreamBase* Stream)
+{
+	check(IsInGameThread());
+
+	// Only cleared, handlers may unregister while Tick walks the array
+	for (TWeakPtr<FVisibilityResultStreamBase, ESPMode::ThreadSafe>& Registered : Streams)
+	{
+		if (Registered.HasSameObject(Stream))
+		{
+			Registered.Reset();
+		}
+	}
+}
+
+void FVisibilityResultStreams::Tick()
+{
+	check(IsInGameThread());
+
+	// Handlers registering streams may grow the array, those are ticked from the next frame
+	const int32 NumStreams = Streams.Num();
+	for (int32 Index = 0; Index < NumStreams; ++Index)
+	{
+		if (TSharedPtr<FVisibilityResultStreamBase, ESPMode::ThreadSafe> Stream = Streams[Index].Pin())
+		{
+			Stream->TickGameThread();
+		}
+	}
+
+	Streams.RemoveAll([](const TWeakPtr<FVisibilityResultStreamBase, ESPMode::ThreadSafe>& Stream) { return !Stream.IsValid(); });
+}
+
+void FVisibilityResultStreams::Shutdown()
+{
+	Streams.Empty();
+}
@@ -0,0 +1,190 @@
+#include "Recorder/VisibilityMappedFile.h"
+
+#if PLATFORM_WINDOWS
+#include "Windows/AllowWindowsPlatformTypes.h"
+#include <windows.h>
+#include "Windows/HideWindowsPlatformTypes.h"
+#elif PLATFORM_UNIX || PLATFORM_MAC || PLATFORM_ANDROID
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define VISIBILITY_MAPPED_FILE_POSIX 1
+#endif
+
+#ifndef VISIBILITY_MAPPED_FILE_POSIX
+#define VISIBILITY_MAPPED_FILE_POSIX 0
+#endif
+
+FVisibilityMappedFile::~FVisibilityMappedFile()
+{
+	Close(MappedSize);
+}
+
+#if PLATFORM_WINDOWS
+
+bool FVisibilityMappedFile::Open(const FString& Path, uint64 InitialSize)
+{
+	HANDLE File = CreateFileW(*Path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (File == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	FileHandle = File;
+
+	if (!Map(InitialSize))
+	{
+		CloseHandle(File);
+		FileHandle = nullptr;
+		return false;
+	}
+	return true;
+}
+
+bool FVisibilityMappedFile::Map(uint64 Size)
+{
+	// Creating the mapping extends the file to Size
+	HANDLE Mapping = CreateFileMappingW((HANDLE)FileHandle, nullptr, PAGE_READWRITE, (DWORD)(Size >> 32), (DWORD)Size, nullptr);
+	if (!Mapping)
+	{
+		return false;
+	}
+
+	void* View = MapViewOfFile(Mapping, FILE_MAP_WRITE, 0, 0, (SIZE_T)Size);
+	if (!View)
+	{
+		CloseHandle(Mapping);
+		return false;
+	}
+
+	// The previous view stays valid until the new one exists
+	Unmap();
+	MappingHandle = Mapping;
+	Data = (uint8*)View;
+	MappedSize = Size;
+	return true;
+}
+
+void FVisibilityMappedFile::Unmap()
+{
+	if (Data)
+	{
+		FlushViewOfFile(Data, 0);
+		UnmapViewOfFile(Data);
+		Data = nullptr;
+	}
+	if (MappingHandle)
+	{
+		CloseHandle((HANDLE)MappingHandle);
+		MappingHandle = nullptr;
+	}
+}
+
+void FVisibilityMappedFile::Close(uint64 FinalSize)
+{
+	Unmap();
+	if (FileHandle)
+	{
+		LARGE_INTEGER Size;
+		Size.QuadPart = (LONGLONG)FinalSize;
+		SetFilePointerEx((HANDLE)FileHandle, Size, nullptr, FILE_BEGIN);
+		SetEndOfFile((HANDLE)FileHandle);
+		CloseHandle((HANDLE)FileHandle);
+		FileHandle = nullptr;
+	}
+	MappedSize = 0;
+}
+
+#elif VISIBILITY_MAPPED_FILE_POSIX
+
+bool FVisibilityMappedFile::Open(const FString& Path, uint64 InitialSize)
+{
+	FileDescriptor = open(TCHAR_TO_UTF8(*Path), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (FileDescriptor < 0)
+	{
+		return false;
+	}
+
+	if (!Map(InitialSize))
+	{
+		close(FileDescriptor);
+		FileDescriptor = -1;
+		return false;
+	}
+	return true;
+}
+
+bool FVisibilityMappedFile::Map(uint64 Size)
+{
+	if (ftruncate(FileDescriptor, (off_t)Size) != 0)
+	{
+		return false;
+	}
+
+	void* View = mmap(nullptr, (size_t)Size, PROT_READ | PROT_WRITE, MAP_SHARED, FileDescriptor, 0);
+	if (View == MAP_FAILED)
+	{
+		return false;
+	}
+
+	// The previous view stays valid until the new one exists, growing the file does not invalidate it
+	Unmap();
+	Data = (uint8*)View;
+	MappedSize = Size;
+	return true;
+}
+
+void FVisibilityMappedFile::Unmap()
+{
+	if (Data)
+	{
+		msync(Data, (size_t)MappedSize, MS_ASYNC);
+		munmap(Data, (size_t)MappedSize);
+		Data = nullptr;
+	}
+}
+
+void FVisibilityMappedFile::Close(uint64 FinalSize)
+{
+	Unmap();
+	if (FileDescriptor >= 0)
+	{
+		ftruncate(FileDescriptor, (off_t)FinalSize);
+		close(FileDescriptor);
+		FileDescriptor = -1;
+	}
+	MappedSize = 0;
+}
+
+#else
+
+bool FVisibilityMappedFile::Open(const FString& Path, uint64 InitialSize)
+{
+	return false;
+}
+
+bool FVisibilityMappedFile::Map(uint64 Size)
+{
+	return false;
+}
+
+void FVisibilityMappedFile::Unmap()
+{
+}
+
+void FVisibilityMappedFile::Close(uint64 FinalSize)
+{
+}
+
+#endif
+
+bool FVisibilityMappedFile::Grow(uint64 MinSize)
+{
+	if (MinSize <= MappedSize)
+	{
+		return true;
+	}
+
+	// Doubling keeps the number of remaps logarithmic in the session length
+	const uint64 NewSize = FMath::Max(MinSize, MappedSize * 2);
+	return Map(NewSize);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+// Writable memory mapping of a file that grows as it is appended to. IMappedFileHandle only maps files read-only,
+// so this talks to the platform directly. Only available on Windows and POSIX platforms, Open fails elsewhere
+class FVisibilityMappedFile
+{
+public:
+	~FVisibilityMappedFile();
+
+	// Creates or truncates Path and maps its first InitialSize bytes
+	bool Open(const FString& Path, uint64 InitialSize);
+
+	// Remaps the file with at least MinSize bytes. Invalidates pointers returned by GetData. On failure the previous
+	// mapping stays as it was
+	bool Grow(uint64 MinSize);
+
+	// Unmaps the file and truncates it to FinalSize
+	void Close(uint64 FinalSize);
+
+	uint8* GetData() const { return Data; }
+	uint64 GetMappedSize() const { return MappedSize; }
+	bool IsOpen() const { return Data != nullptr; }
+
+private:
+	// Maps Size bytes, then releases the previous mapping. Leaves it alone on failure
+	bool Map(uint64 Size);
+	void Unmap();
+
+	uint8* Data = nullptr;
+	uint64 MappedSize = 0;
+
+#if PLATFORM_WINDOWS
+	void* FileHandle = nullptr;
+	void* MappingHandle = nullptr;
+#else
+	int32 FileDescriptor = -1;
+#endif
+};
@@ -0,0 +1,128 @@
+#include "Recorder/VisibilityRecordReader.h"
+#include "Async/MappedFileHandle.h"
+#include "HAL/PlatformFileManager.h"
+#include "Algo/BinarySearch.h"
+
+FVisibilityRecordReader::FVisibilityRecordReader() = default;
+
+FVisibilityRecordReader::~FVisibilityRecordReader()
+{
+	Close();
+}
+
+bool FVisibilityRecordReader::Open(const FString& Path)
+{
+	Close();
+
+	Handle.Reset(FPlatformFileManager::Get().GetPlatformFile().OpenMapped(*Path));
+	if (!Handle || Handle->GetFileSize() < (int64)sizeof(FVisibilityRecordFileHeader))
+	{
+		Close();
+		return false;
+	}
+
+	Region.Reset(Handle->MapRegion(0, Handle->GetFileSize()));
+	if (!Region)
+	{
+		Close();
+		return false;
+	}
+
+	const uint8* Data = Region->GetMappedPtr();
+	const uint64 Size = Region->GetMappedSize();
+	Header = (const FVisibilityRecordFileHeader*)Data;
+	if (Header->Magic != FVisibilityRecordFileHeader::ExpectedMagic || Header->Version != FVisibilityRecordFileHeader::CurrentVersion
+		|| Header->RecordSize != sizeof(FVisibilityRecord))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s is not a visibility recording of version %u."), *Path, FVisibilityRecordFileHeader::CurrentVersion);
+		Close();
+		return false;
+	}
+
+	// Unfinished recordings are still sized for the mapping, trust the header count but not past the file
+	const uint64 RecordBytes = Size - sizeof(FVisibilityRecordFileHeader);
+	Records = (const FVisibilityRecord*)(Data + sizeof(FVisibilityRecordFileHeader));
+	NumRecords = (int64)FMath::Min<uint64>(Header->NumRecords, RecordBytes / sizeof(FVisibilityRecord));
+
+	if (Header->IndexOffset != 0 && Header->IndexOffset + Header->NumIndexEntries * sizeof(FVisibilityRecordIndexEntry) <= Size)
+	{
+		Index = MakeArrayView((const FVisibilityRecordIndexEntry*)(Data + Header->IndexOffset), Header->NumIndexEntries);
+	}
+	if (Header->NamesOffset != 0 && Header->NamesOffset < Size)
+	{
+		ReadNames(Data + Header->NamesOffset, Data + Size);
+	}
+	return true;
+}
+
+void FVisibilityRecordReader::ReadNames(const uint8* Begin, const uint8* End)
+{
+	auto Read = [&Begin, End](void* Out, int32 Bytes)
+	{
+		if (End - Begin < Bytes)
+		{
+			return false;
+		}
+		FMemory::Memcpy(Out, Begin, Bytes);
+		Begin += Bytes;
+		return true;
+	};
+
+	uint32 NumNames = 0;
+	if (!Read(&NumNames, sizeof(NumNames)))
+	{
+		return;
+	}
+
+	for (uint32 NameIndex = 0; NameIndex < NumNames; ++NameIndex)
+	{
+		uint8 Kind;
+		uint32 Id;
+		uint16 Length;
+		if (!Read(&Kind, sizeof(Kind)) || !Read(&Id, sizeof(Id)) || !Read(&Length, sizeof(Length)) || End - Begin < Length)
+		{
+			return;
+		}
+
+		FString Name(FUTF8ToTCHAR((const ANSICHAR*)Begin, Length));
+		Begin += Length;
+
+		TMap<uint32, FString>& Names = (EVisibilityRecordNameKind)Kind == EVisibilityRecordNameKind::Metric ? MetricNames : SourceNames;
+		Names.Add(Id, MoveTemp(Name));
+	}
+}
+
+void FVisibilityRecordReader::Close()
+{
+	Region.Reset();
+	Handle.Reset();
+	Header = nullptr;
+	Records = nullptr;
+	NumRecords = 0;
+	Index = TArrayView<const FVisibilityRecordIndexEntry>();
+	MetricNames.Reset();
+	SourceNames.Reset();
+}
+
+int64 FVisibilityRecordReader::FindFirstRecord(uint32 FrameNumber) const
+{
+	// Start the scan from the last indexed record of an earlier frame
+	int64 First = 0;
+	if (Index.Num() > 0)
+	{
+		const int32 Entry = Algo::LowerBoundBy(Index, FrameNumber, &FVisibilityRecordIndexEntry::FrameNumber);
+		if (Entry > 0)
+		{
+			First = FMath::Min<int64>(Index[Entry - 1].RecordIndex, NumRecords);
+		}
+	}
+
+	for (int64 RecordIndex = First; RecordIndex < NumRecords; ++RecordIndex)
+	{
+		if (Records[RecordIndex].FrameNumber >= FrameNumber)
+		{
+			return RecordIndex;
+		}
+	}
+	return NumRecords;
+}
@@ -0,0 +1,337 @@
+#include "Recorder/VisibilityRecorder.h"
+#include "Recorder/VisibilityMappedFile.h"
+#include "Recorder/VisibilityMpscRing.h"
+#include "Engine/TextureRenderTarget.h"
+#include "HAL/FileManager.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/Runnable.h"
+#include "HAL/RunnableThread.h"
+#include "Misc/Paths.h"
+#include "Serialization/MemoryWriter.h"
+#include "UObject/WeakObjectPtr.h"
+#include "RenderingThread.h"
+
+// Records between two index entries
+static constexpr uint32 VisibilityRecordIndexInterval = 4096;
+// The file is created with room for this many records and doubled when full
+static constexpr uint64 VisibilityRecordInitialCapacity = 1 << 16;
+// Seconds the writer thread sleeps between two drains of the ring
+static constexpr float VisibilityRecordDrainInterval = 0.01f;
+
+// Names of the metrics and render targets seen since startup. It outlives the writers and every recording gets all of it,
+// so sources named before a Start, or dispatches built before it, are still named in the file
+class FVisibilityRecordNameTable
+{
+public:
+	static FVisibilityRecordNameTable& Get()
+	{
+		static FVisibilityRecordNameTable Table;
+		return Table;
+	}
+
+	// Game thread
+	void RegisterSource(const UTextureRenderTarget* InputTexture)
+	{
+		const uint32 Id = InputTexture->GetUniqueID();
+		// Unique ids are reused once their object is destroyed, a different render target under a known id is named again
+		FWeakObjectPtr& Known = KnownSources.FindOrAdd(Id);
+		if (Known.Get() == InputTexture)
+		{
+			return;
+		}
+		Known = InputTexture;
+		Add(EVisibilityRecordNameKind::Source, Id, InputTexture->GetPathName());
+	}
+
+	// Render thread
+	void RegisterMetric(uint32 Id, const TCHAR* MetricName)
+	{
+		if (KnownMetrics.Contains(Id))
+		{
+			return;
+		}
+		KnownMetrics.Add(Id);
+		Add(EVisibilityRecordNameKind::Metric, Id, MetricName);
+	}
+
+	// Key is the EVisibilityRecordNameKind in the high and the id in the low 32 bits
+	TMap<uint64, FString> GetNames() const
+	{
+		FScopeLock ScopeLock(&Lock);
+		return Names;
+	}
+
+private:
+	void Add(EVisibilityRecordNameKind Kind, uint32 Id, FString Name)
+	{
+		FScopeLock ScopeLock(&Lock);
+		Names.Add(((uint64)Kind << 32) | Id, MoveTemp(Name));
+	}
+
+	// Each only touched by one thread, so known names cost no lock
+	TMap<uint32, FWeakObjectPtr> KnownSources;
+	TSet<uint32> KnownMetrics;
+
+	mutable FCriticalSection Lock;
+	TMap<uint64, FString> Names;
+};
+
+std::atomic<bool> FVisibilityRecorder::bRecording{ false };
+TUniquePtr<FVisibilityRecorder::FWriter> FVisibilityRecorder::Writer;
+
+class FVisibilityRecorder::FWriter : public FRunnable
+{
+public:
+	explicit FWriter(uint32 RingCapacity)
+		: Ring(RingCapacity)
+		, StartCycles(FPlatformTime::Cycles64())
+	{
+	}
+
+	virtual ~FWriter()
+	{
+		delete Thread;
+	}
+
+	bool Open(const FString& Path)
+	{
+		IFileManager::Get().MakeDirectory(*FPaths::GetPath(Path), true);
+		if (!File.Open(Path, sizeof(FVisibilityRecordFileHeader) + VisibilityRecordInitialCapacity * sizeof(FVisibilityRecord)))
+		{
+			return false;
+		}
+
+		FVisibilityRecordFileHeader& Header = GetHeader();
+		FMemory::Memzero(Header);
+		Header.Magic = FVisibilityRecordFileHeader::ExpectedMagic;
+		Header.Version = FVisibilityRecordFileHeader::CurrentVersion;
+		Header.RecordSize = sizeof(FVisibilityRecord);
+		Header.IndexInterval = VisibilityRecordIndexInterval;
+		Header.SecondsPerCycle = FPlatformTime::GetSecondsPerCycle64();
+
+		Thread = FRunnableThread::Create(this, TEXT("VisibilityRecorder"), 0, TPri_BelowNormal);
+		return Thread != nullptr;
+	}
+
+	// Game thread, once no producer can push anymore. Drains the ring, appends the index and the name table and closes the file
+	void Finish()
+	{
+		bStopRequested = true;
+		Thread->WaitForCompletion();
+
+		uint64 Offset = sizeof(FVisibilityRecordFileHeader) + NumRecords * sizeof(FVisibilityRecord);
+		const uint64 IndexOffset = Offset;
+		const uint64 IndexBytes = Index.Num() * sizeof(FVisibilityRecordIndexEntry);
+
+		const TMap<uint64, FString> Names = FVisibilityRecordNameTable::Get().GetNames();
+		TArray<uint8> NameTable;
+		FMemoryWriter NameWriter(NameTable);
+		uint32 NumNames = Names.Num();
+		NameWriter << NumNames;
+		for (const TPair<uint64, FString>& Name : Names)
+		{
+			uint8 Kind = (uint8)(Name.Key >> 32);
+			uint32 Id = (uint32)Name.Key;
+			FTCHARToUTF8 UTF8(*Name.Value);
+			uint16 Length = (uint16)FMath::Min(UTF8.Length(), (int32)MAX_uint16);
+			NameWriter << Kind << Id << Length;
+			NameWriter.Serialize((void*)UTF8.Get(), Length);
+		}
+
+		const uint64 NamesOffset = IndexOffset + IndexBytes;
+		const uint64 FinalSize = NamesOffset + NameTable.Num();
+		if (File.GetData() && File.Grow(FinalSize))
+		{
+			FMemory::Memcpy(File.GetData() + IndexOffset, Index.GetData(), IndexBytes);
+			FMemory::Memcpy(File.GetData() + NamesOffset, NameTable.GetData(), NameTable.Num());
+
+			FVisibilityRecordFileHeader& Header = GetHeader();
+			Header.IndexOffset = IndexOffset;
+			Header.NamesOffset = NamesOffset;
+			Header.NumIndexEntries = Index.Num();
+			Header.NumDropped = NumDropped.load(std::memory_order_relaxed);
+			File.Close(FinalSize);
+		}
+		else
+		{
+			// Records stay readable, only the index and the names are lost
+			File.Close(Offset);
+		}
+	}
+
+	virtual uint32 Run() override
+	{
+		while (!bStopRequested)
+		{
+			Drain();
+			FPlatformProcess::Sleep(VisibilityRecordDrainInterval);
+		}
+		Drain();
+		return 0;
+	}
+
+	TVisibilityMpscRing<FVisibilityRecord> Ring;
+	std::atomic<uint64> NumDropped{ 0 };
+	// Set by the writer thread when the file could not grow. Records are dropped from then on
+	std::atomic<bool> bFileFull{ false };
+	const uint64 StartCycles;
+
+private:
+	FVisibilityRecordFileHeader& GetHeader()
+	{
+		return *(FVisibilityRecordFileHeader*)File.GetData();
+	}
+
+	// Writer thread. Takes at most one ring's worth of records, so producers that keep up with it can't hold the header
+	// update back forever
+	void Drain()
+	{
+		for (uint32 NumDrained = 0; NumDrained < Ring.GetCapacity() && Ring.PopAll(Batch, 4096) > 0; NumDrained += Batch.Num())
+		{
+			const uint64 RequiredSize = sizeof(FVisibilityRecordFileHeader) + (NumRecords + Batch.Num()) * sizeof(FVisibilityRecord);
+			if (bFileFull.load(std::memory_order_relaxed) || !File.GetData() || !File.Grow(RequiredSize))
+			{
+				if (!bFileFull.exchange(true, std::memory_order_relaxed))
+				{
+					UE_LOG(LogTemp, Warning, TEXT("Can't grow the visibility recording to %llu bytes, dropping the records from now on."), RequiredSize);
+				}
+				NumDropped.fetch_add(Batch.Num(), std::memory_order_relaxed);
+				continue;
+			}
+
+			for (int32 BatchIndex = 0; BatchIndex < Batch.Num(); ++BatchIndex)
+			{
+				if ((NumRecords + BatchIndex) % VisibilityRecordIndexInterval == 0)
+				{
+					Index.Add({ Batch[BatchIndex].FrameNumber, 0, NumRecords + BatchIndex });
+				}
+			}
+
+			FMemory::Memcpy(File.GetData() + sizeof(FVisibilityRecordFileHeader) + NumRecords * sizeof(FVisibilityRecord), Batch.GetData(), Batch.Num() * sizeof(FVisibilityRecord));
+			NumRecords += Batch.Num();
+		}
+
+		if (!File.GetData())
+		{
+			return;
+		}
+
+		// Published after the records, a reader of a crashed session never sees a count past the written data
+		FVisibilityRecordFileHeader& Header = GetHeader();
+		Header.NumRecords = NumRecords;
+		Header.NumDropped = NumDropped.load(std::memory_order_relaxed);
+	}
+
+	FVisibilityMappedFile File;
+	FRunnableThread* Thread = nullptr;
+	std::atomic<bool> bStopRequested{ false };
+
+	TArray<FVisibilityRecord> Batch;
+	TArray<FVisibilityRecordIndexEntry> Index;
+	uint64 NumRecords = 0;
+};
+
+bool FVisibilityRecorder::Start(const FString& Path, uint32 RingCapacity)
+{
+	check(IsInGameThread());
+
+	Stop();
+
+	TUniquePtr<FWriter> NewWriter = MakeUnique<FWriter>(RingCapacity);
+	if (!NewWriter->Open(Path))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Can't record visibility results to %s."), *Path);
+		return false;
+	}
+
+	Writer = MoveTemp(NewWriter);
+	bRecording.store(true, std::memory_order_release);
+
+	UE_LOG(LogTemp, Display, TEXT("Recording visibility results to %s."), *Path);
+	return true;
+}
+
+void FVisibilityRecorder::Stop()
+{
+	check(IsInGameThread());
+
+	if (!Writer)
+	{
+		return;
+	}
+
+	bRecording.store(false, std::memory_order_release);
+	// The render thread may still be inside Record or MakeSource
+	FlushRenderingCommands();
+
+	Writer->Finish();
+	Writer.Reset();
+}
+
+uint32 FVisibilityRecorder::GetMetricId(const TCHAR* MetricName)
+{
+	return FCrc::StrCrc32(MetricName);
+}
+
+FVisibilityRecordSource FVisibilityRecorder::MakeSource(const TCHAR* MetricName, const UTextureRenderTarget* InputTexture)
+{
+	FVisibilityRecordSource Source;
+	Source.MetricId = GetMetricId(MetricName);
+	Source.SourceId = InputTexture ? InputTexture->GetUniqueID() : 0;
+
+	if (IsRecording())
+	{
+		FVisibilityRecordNameTable::Get().RegisterMetric(Source.MetricId, MetricName);
+	}
+	return Source;
+}
+
+void FVisibilityRecorder::RegisterSource(const UTextureRenderTarget* InputTexture)
+{
+	if (InputTexture && IsInGameThread())
+	{
+		FVisibilityRecordNameTable::Get().RegisterSource(InputTexture);
+	}
+}
+
+void FVisibilityRecorder::Record(const FVisibilityRecordSource& Source, int32 NumChannels, const int64* Data, uint32 NumBytes)
+{
+	if (!IsRecording() || NumChannels <= 0)
+	{
+		return;
+	}
+
+	FVisibilityRecord Record = {};
+	Record.Timestamp = FPlatformTime::Cycles64() - Writer->StartCycles;
+	Record.FrameNumber = GFrameNumberRenderThread;
+	Record.MetricId = Source.MetricId;
+	Record.SourceId = Source.SourceId;
+	Record.NumChannels = (uint16)FMath::Min(NumChannels, VISIBILITY_RECORD_MAX_CHANNELS);
+	Record.NumSlices = (uint16)(NumBytes / (NumChannels * sizeof(int64)));
+
+	for (int32 Slice = 0; Slice < Record.NumSlices; ++Slice)
+	{
+		for (int32 Channel = 0; Channel < Record.NumChannels; ++Channel)
+		{
+			Record.Channels[Channel] += Data[Slice * NumChannels + Channel];
+		}
+	}
+
+	if (Writer->bFileFull.load(std::memory_order_relaxed) || !Writer->Ring.TryPush(Record))
+	{
+		Writer->NumDropped.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+static FAutoConsoleCommand CmdVisibilityRecorderStart(
+	TEXT("r.VisibilityCore.Recorder.Start"),
+	TEXT("Records every delivered visibility reduction result into the given file, Saved/Profiling/VisibilityRecords.vrec by default"),
+	FConsoleCommandWithArgsDelegate::CreateStatic([](const TArray<FString>& Args)
+	{
+		FVisibilityRecorder::Start(Args.Num() > 0 ? Args[0] : FPaths::Combine(FPaths::ProfilingDir(), TEXT("VisibilityRecords.vrec")));
+	}));
+
+static FAutoConsoleCommand CmdVisibilityRecorderStop(
+	TEXT("r.VisibilityCore.Recorder.Stop"),
+	TEXT("Stops r.VisibilityCore.Recorder.Start and finalizes the file"),
+	FConsoleCommandDelegate::CreateStatic(&FVisibilityRecorder::Stop));
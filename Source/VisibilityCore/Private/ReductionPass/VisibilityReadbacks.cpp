@@ -0,0 +1,69 @@
+#include "ReductionPass/VisibilityReadbacks.h"
+#include "RenderGraphBuilder.h"
+#include "RenderGraphUtils.h"
+#include "RHIGPUReadback.h"
+
+TArray<FRHIGPUBufferReadback*> FVisibilityReadbacks::FreeReadbacks;
+TArray<FVisibilityReadbacks::FPendingReadback> FVisibilityReadbacks::Pending;
+
+FRHIGPUBufferReadback* FVisibilityReadbacks::Acquire()
+{
+	check(IsInRenderingThread());
+
+	if (FreeReadbacks.Num() > 0)
+	{
+		return FreeReadbacks.Pop(false);
+	}
+	return new FRHIGPUBufferReadback(TEXT("VisibilityReductionOutput"));
+}
+
+void FVisibilityReadbacks::Enqueue(FRDGBuilder& GraphBuilder, FRDGBufferRef Buffer, uint32 NumBytes, FOnReady&& OnReady)
+{
+	check(IsInRenderingThread());
+
+	FRHIGPUBufferReadback* Readback = Acquire();
+	AddEnqueueCopyPass(GraphBuilder, Readback, Buffer, NumBytes);
+
+	// Only polled from a later render thread task, after the graph holding the copy has executed
+	Pending.Add({ Readback, NumBytes, MoveTemp(OnReady) });
+}
+
+void FVisibilityReadbacks::Poll()
+{
+	check(IsInRenderingThread());
+
+	for (int32 Index = 0; Index < Pending.Num(); )
+	{
+		if (!Pending[Index].Readback->IsReady())
+		{
+			++Index;
+			continue;
+		}
+
+		// Taken out of the array first, OnReady is free to enqueue further readbacks.
+		// RemoveAt keeps completion order stable for readbacks that land in the same frame
+		FPendingReadback Entry = MoveTemp(Pending[Index]);
+		Pending.RemoveAt(Index, 1, false);
+
+		const int64* Data = (const int64*)Entry.Readback->Lock(Entry.NumBytes);
+		Entry.OnReady(Data, Entry.NumBytes);
+		Entry.Readback->Unlock();
+
+		FreeReadbacks.Add(Entry.Readback);
+	}
+}
+
+void FVisibilityReadbacks::Shutdown()
+{
+	for (FPendingReadback& Entry : Pending)
+	{
+		delete Entry.Readback;
+	}
+	Pending.Empty();
+
+	for (FRHIGPUBufferReadback* Readback : FreeReadbacks)
+	{
+		delete Readback;
+	}
+	FreeReadbacks.Empty();
+}
@@ -0,0 +1,291 @@
+#include "ReductionPass/VisibilityReductionPass.h"
+#include "Recorder/VisibilityRecorder.h"
+#include "Capture/VisibilityFrameCapture.h"
+#include "VisibilityCoreStats.h"
+#include "RenderGraphUtils.h"
+#include "RenderTargetPool.h"
+#include "RHIGPUReadback.h"
+#include "Engine/Engine.h"
+
+DECLARE_CYCLE_STAT(TEXT("VisibilityReduction Execute"), STAT_VisibilityReduction_Execute, STATGROUP_VisibilityCore);
+// Separate GPU stats for the two tile compaction passes, so `stat gpu` compares them against the full-rect pass
+DECLARE_GPU_STAT_NAMED(VisibilityReduction, TEXT("Visibility Reduction"));
+DECLARE_GPU_STAT_NAMED(VisibilityTileClassify, TEXT("Visibility Tile Classify"));
+DECLARE_GPU_STAT_NAMED(VisibilityReductionTiles, TEXT("Visibility Reduction Tiles"));
+
+static TAutoConsoleVariable<int32> CVarVisibilityTileCompaction(
+	TEXT("r.VisibilityCore.TileCompaction"),
+	0,
+	TEXT("0: Use tile compaction only when requested by FVisibilityReductionInputs::bUseTileCompaction\n")
+	TEXT("1: Force tile compaction for every reduction (for A/B benchmarking)\n")
+	TEXT("-1: Never use tile compaction"),
+	ECVF_RenderThreadSafe);
+
+FRDGTextureRef FVisibilityReductionPassBuilder::RegisterRenderTarget(UTextureRenderTarget* RenderTarget, FRDGBuilder& GraphBuilder, const TCHAR* Name)
+{
+	if (!RenderTarget)
+	{
+		return nullptr;
+	}
+
+	// Cube and 2D array render target resources expose their whole texture here as well
+	const FTextureRenderTargetResource* RTResource = RenderTarget->GetRenderTargetResource();
+	FRHITexture* TextureRHI = RTResource ? RTResource->GetRenderTargetTexture() : nullptr;
+	if (!TextureRHI)
+	{
+		return nullptr;
+	}
+
+	return GraphBuilder.RegisterExternalTexture(CreateRenderTarget(TextureRHI, Name));
+}
+
+int32 FVisibilityReductionPassBuilder::GetNumSlices(const FRDGTextureDesc& Desc)
+{
+	if (Desc.IsTextureCube())
+	{
+		return 6 * Desc.ArraySize;
+	}
+	return Desc.IsTextureArray() ? Desc.ArraySize : 1;
+}
+
+// Views cube faces as array slices, so both cubes and 2D arrays are read as Texture2DArray
+static FRDGTextureSRVRef CreateTextureArraySRV(FRDGBuilder& GraphBuilder, FRDGTextureRef Texture)
+{
+	FRDGTextureSRVDesc SRVDesc = FRDGTextureSRVDesc::Create(Texture);
+	if (Texture->Desc.IsTextureCube())
+	{
+		SRVDesc.DimensionOverride = ETextureDimension::Texture2DArray;
+	}
+	return GraphBuilder.CreateSRV(SRVDesc);
+}
+
+FVisibilityReductionOutput FVisibilityReductionPassBuilder::AddPasses(FRDGBuilder& GraphBuilder, const FVisibilityReductionInputs& Inputs, const FVisibilityReductionShaders& Shaders, ERDGPassFlags PassFlags)
+{
+	FVisibilityReductionOutput Output;
+
+	FRDGTextureRef InputTextureRef = RegisterRenderTarget(Inputs.InputTexture, GraphBuilder, TEXT("VisibilityInputTexture"));
+	if (!InputTextureRef)
+	{
+		return Output;
+	}
+	FRDGTextureRef CameraTextureRef = RegisterRenderTarget(Inputs.CameraTexture, GraphBuilder, TEXT("VisibilityCameraTexture"));
+
+	const int32 NumSlices = GetNumSlices(InputTextureRef->Desc);
+	const bool bTextureArray = InputTextureRef->Desc.Dimension != ETextureDimension::Texture2D;
+	if (CameraTextureRef && (GetNumSlices(CameraTextureRef->Desc) != NumSlices || (CameraTextureRef->Desc.Dimension != ETextureDimension::Texture2D) != bTextureArray))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("CameraTexture %s does not match the slices of InputTexture %s and is ignored."), *Inputs.CameraTexture->GetName(), *Inputs.InputTexture->GetName());
+		CameraTextureRef = nullptr;
+	}
+
+	// Two uints per 64 bit channel, there is no portable 64 bit buffer atomic
+	FRDGBufferRef OutputBuffer = GraphBuilder.CreateBuffer(
+		FRDGBufferDesc::CreateBufferDesc(sizeof(uint32), 2 * Shaders.NumChannels * NumSlices),
+		TEXT("VisibilityReductionOutput"));
+	Output.Buffer = OutputBuffer;
+	Output.NumSlices = NumSlices;
+	FRDGBufferUAVRef OutputUAV = GraphBuilder.CreateUAV(FRDGBufferUAVDesc(OutputBuffer, PF_R32_UINT));
+	AddClearUAVPass(GraphBuilder, OutputUAV, 0u);
+
+	const FIntPoint TextureSize = InputTextureRef->Desc.Extent;
+	FIntRect DispatchRect = FVisibilityCoverage::GetMeasuredRect(TextureSize, Inputs.ViewRect, Inputs.ScreenAspectRatio);
+	if (Inputs.bRestrictToScreenRect)
+	{
+		DispatchRect.Clip(Inputs.ScreenRect);
+	}
+
+	// One group layer per slice
+	const FIntVector GroupCount(
+		FMath::DivideAndRoundUp(DispatchRect.Width(), VISIBILITY_REDUCTION_TILE_SIZE),
+		FMath::DivideAndRoundUp(DispatchRect.Height(), VISIBILITY_REDUCTION_TILE_SIZE),
+		NumSlices
+	);
+	// Off screen objects have nothing to reduce, the cleared output is read back as is
+	if (GroupCount.X <= 0 || GroupCount.Y <= 0)
+	{
+		return Output;
+	}
+
+	FRDGTextureSRVRef InputTextureArraySRV = bTextureArray ? CreateTextureArraySRV(GraphBuilder, InputTextureRef) : nullptr;
+	FRDGTextureSRVRef CameraTextureArraySRV = bTextureArray && CameraTextureRef ? CreateTextureArraySRV(GraphBuilder, CameraTextureRef) : nullptr;
+	auto SetInputs = [&](FVisibilityReductionParameters* Parameters)
+	{
+		if (bTextureArray)
+		{
+			Parameters->InputTextureArray = InputTextureArraySRV;
+			Parameters->CameraTextureArray = CameraTextureArraySRV;
+		}
+		else
+		{
+			Parameters->InputTexture = InputTextureRef;
+			Parameters->CameraTexture = CameraTextureRef;
+		}
+	};
+
+	FVisibilityReductionParameters* PassParameters = GraphBuilder.AllocParameters<FVisibilityReductionParameters>();
+	SetInputs(PassParameters);
+	PassParameters->RectMin = DispatchRect.Min;
+	PassParameters->RectMax = DispatchRect.Max;
+	PassParameters->ReductionOutput = OutputUAV;
+
+	// Tiles are packed as 12 bit coordinates and an 8 bit slice, and the indirect dispatch is one dimensional
+	const int32 NumTiles = GroupCount.X * GroupCount.Y * GroupCount.Z;
+	const int32 CVarTileCompaction = CVarVisibilityTileCompaction.GetValueOnRenderThread();
+	const bool bUseTileCompaction = (Inputs.bUseTileCompaction || CVarTileCompaction > 0) && CVarTileCompaction >= 0
+		&& NumTiles <= (int32)GRHIMaxDispatchThreadGroupsPerDimension.X
+		&& GroupCount.X < (1 << 12) && GroupCount.Y < (1 << 12) && GroupCount.Z <= (1 << 8)
+		&& Shaders.ReduceTiles[bTextureArray].IsValid() && Shaders.Classify[bTextureArray].IsValid();
+
+	if (bUseTileCompaction)
+	{
+		FRDGBufferRef TileListBuffer = GraphBuilder.CreateBuffer(
+			FRDGBufferDesc::CreateBufferDesc(sizeof(uint32), NumTiles),
+			TEXT("VisibilityTileList"));
+		FRDGBufferRef TileIndirectArgs = GraphBuilder.CreateBuffer(
+			FRDGBufferDesc::CreateIndirectDesc<FRHIDispatchIndirectParameters>(1),
+			TEXT("VisibilityTileIndirectArgs"));
+
+		FVisibilityReductionParameters* ClassifyParameters = GraphBuilder.AllocParameters<FVisibilityReductionParameters>();
+		SetInputs(ClassifyParameters);
+		ClassifyParameters->RectMin = DispatchRect.Min;
+		ClassifyParameters->RectMax = DispatchRect.Max;
+		ClassifyParameters->RWTileList = GraphBuilder.CreateUAV(FRDGBufferUAVDesc(TileListBuffer, PF_R32_UINT));
+		ClassifyParameters->RWTileIndirectArgs = GraphBuilder.CreateUAV(FRDGBufferUAVDesc(TileIndirectArgs, PF_R32_UINT));
+		AddClearUAVPass(GraphBuilder, ClassifyParameters->RWTileIndirectArgs, 0u);
+
+		{
+			RDG_GPU_STAT_SCOPE(GraphBuilder, VisibilityTileClassify);
+			FComputeShaderUtils::AddPass(
+				GraphBuilder,
+				RDG_EVENT_NAME("TileClassify %dx%dx%d tiles", GroupCount.X, GroupCount.Y, GroupCount.Z),
+				PassFlags,
+				Shaders.Classify[bTextureArray],
+				ClassifyParameters,
+				GroupCount);
+		}
+
+		PassParameters->TileList = GraphBuilder.CreateSRV(FRDGBufferSRVDesc(TileListBuffer, PF_R32_UINT));
+		PassParameters->TileIndirectArgs = TileIndirectArgs;
+
+		{
+			RDG_GPU_STAT_SCOPE(GraphBuilder, VisibilityReductionTiles);
+			FComputeShaderUtils::AddPass(
+				GraphBuilder,
+				RDG_EVENT_NAME("Reduce Tiles"),
+				PassFlags,
+				Shaders.ReduceTiles[bTextureArray],
+				PassParameters,
+				TileIndirectArgs,
+				0);
+		}
+	}
+	else
+	{
+		FComputeShaderUtils::AddPass(
+			GraphBuilder,
+			RDG_EVENT_NAME("Reduce %dx%dx%d", DispatchRect.Width(), DispatchRect.Height(), NumSlices),
+			PassFlags,
+			Shaders.Reduce[bTextureArray],
+			PassParameters,
+			GroupCount);
+	}
+
+	return Output;
+}
+
+bool FVisibilityReductionPassBuilder::AddReduction(
+	FRDGBuilder& GraphBuilder,
+	const FVisibilityReductionInputs& Inputs,
+	const FVisibilityReductionShaders& Shaders,
+	const TCHAR* MetricName,
+	ERDGPassFlags PassFlags,
+	FVisibilityReadbacks::FOnReady&& OnReady)
+{
+	check(IsInRenderingThread());
+
+	if (!Shaders.Reduce[0].IsValid() || !Shaders.Reduce[1].IsValid())
+	{
+		#if WITH_EDITOR
+			GEngine->AddOnScreenDebugMessage((uint64)42145125184, 6.f, FColor::Red, FString::Printf(TEXT("The %s compute shader has a problem."), MetricName));
+		#endif
+
+		// We exit here as we don't want to crash the game if the shader is not found or has an error.
+		return false;
+	}
+
+	SCOPE_CYCLE_COUNTER(STAT_VisibilityReduction_Execute);
+	RDG_EVENT_SCOPE(GraphBuilder, "%s", MetricName);
+	RDG_GPU_STAT_SCOPE(GraphBuilder, VisibilityReduction);
+
+	FVisibilityReductionOutput Output = AddPasses(GraphBuilder, Inputs, Shaders, PassFlags);
+	if (!Output.Buffer)
+	{
+		return false;
+	}
+
+	// Recording and capturing only wrap the callback while enabled, the completion path stays untouched otherwise
+	if (FVisibilityFrameCapture::IsCapturing())
+	{
+		FVisibilityFrameCapture::AddCapture(GraphBuilder, Inputs, MetricName, Shaders.NumChannels, OnReady);
+	}
+	if (FVisibilityRecorder::IsRecording())
+	{
+		FVisibilityReadbacks::FOnReady RecordedOnReady =
+			[OnReady = MoveTemp(OnReady), Source = FVisibilityRecorder::MakeSource(MetricName, Inputs.InputTexture), NumChannels = Shaders.NumChannels](const int64* Data, uint32 NumBytes)
+			{
+				FVisibilityRecorder::Record(Source, NumChannels, Data, NumBytes);
+				OnReady(Data, NumBytes);
+			};
+		OnReady = MoveTemp(RecordedOnReady);
+	}
+
+	// Every slice comes back with the same readback
+	FVisibilityReadbacks::Enqueue(GraphBuilder, Output.Buffer, Shaders.NumChannels * Output.NumSlices * sizeof(int64), MoveTemp(OnReady));
+	return true;
+}
+
+bool FVisibilityReductionPassBuilder::Execute(
+	FRHICommandListImmediate& RHICmdList,
+	const FVisibilityReductionInputs& Inputs,
+	const FVisibilityReductionShaders& Shaders,
+	const TCHAR* MetricName,
+	ERDGPassFlags PassFlags,
+	FVisibilityReadbacks::FOnReady&& OnReady)
+{
+	check(IsInRenderingThread());
+
+	FRDGBuilder GraphBuilder(RHICmdList);
+	const bool bEnqueued = AddReduction(GraphBuilder, Inputs, Shaders, MetricName, PassFlags, MoveTemp(OnReady));
+	GraphBuilder.Execute();
+
+	return bEnqueued;
+}
+
+// Function local, metrics register from static initializers of other modules
+static TArray<const FVisibilityReductionMetric*>& GetRegisteredMetrics()
+{
+	static TArray<const FVisibilityReductionMetric*> Metrics;
+	return Metrics;
+}
+
+const FVisibilityReductionMetric* FVisibilityReductionMetric::Find(const FString& Name)
+{
+	for (const FVisibilityReductionMetric* Metric : GetRegisteredMetrics())
+	{
+		if (Name == Metric->Name)
+		{
+			return Metric;
+		}
+	}
+	return nullptr;
+}
+
+void FVisibilityReductionMetric::Register(const FVisibilityReductionMetric& Metric)
+{
+	GetRegisteredMetrics().AddUnique(&Metric);
+}
+
+void FVisibilityReductionMetric::Unregister(const FVisibilityReductionMetric& Metric)
+{
+	GetRegisteredMetrics().Remove(&Metric);
+}
@@ -0,0 +1,355 @@
+#include "Requests/VisibilityRequests.h"
+#include "RenderGraphBuilder.h"
+#include "RenderingThread.h"
+
+TIndirectArray<FVisibilityRequests::FBatch> FVisibilityRequests::Batches;
+TArray<int32> FVisibilityRequests::FreeBatches;
+TArray<FVisibilityRequests::FWaiter> FVisibilityRequests::Waiters;
+TArray<int32> FVisibilityRequests::FreeWaiters;
+TArray<int32> FVisibilityRequests::QueuedBatches;
+TMap<FVisibilityRequests::FBatchKey, int32> FVisibilityRequests::QueuedBatchMap;
+TArray<TPair<int32, EVisibilityRequestStatus>> FVisibilityRequests::CompletedBatches;
+TArray<TPair<int32, EVisibilityRequestStatus>> FVisibilityRequests::DeliveringBatches;
+FCriticalSection FVisibilityRequests::CompletedLock;
+
+FVisibilityRequests::FBatchKey FVisibilityRequests::MakeKey(const FVisibilityReductionMetric& Metric, const FVisibilityReductionInputs& Inputs)
+{
+	FBatchKey Key;
+	Key.Metric = &Metric;
+	Key.InputTexture = Inputs.InputTexture;
+	Key.CameraTexture = Inputs.CameraTexture;
+	Key.ViewRect = Inputs.ViewRect;
+	Key.ScreenAspectRatio = Inputs.ScreenAspectRatio;
+	// The rect only tells requests apart when it is used
+	Key.ScreenRect = Inputs.bRestrictToScreenRect ? Inputs.ScreenRect : FIntRect();
+	Key.bRestrictToScreenRect = Inputs.bRestrictToScreenRect;
+	Key.bUseTileCompaction = Inputs.bUseTileCompaction;
+	return Key;
+}
+
+int32 FVisibilityRequests::AllocateBatch(const FVisibilityReductionMetric& Metric, const FVisibilityReductionInputs& Inputs)
+{
+	const int32 BatchIndex = FreeBatches.Num() > 0 ? FreeBatches.Pop(false) : Batches.Add(new FBatch());
+
+	FBatch& Batch = Batches[BatchIndex];
+	Batch.Metric = &Metric;
+	Batch.Inputs = Inputs;
+	Batch.InputTexture = Inputs.InputTexture;
+	Batch.CameraTexture = Inputs.CameraTexture;
+	Batch.ScreenArea = Inputs.GetScreenArea();
+	Batch.Status = EVisibilityRequestStatus::Pending;
+	Batch.WaiterIndices.Reset();
+	Batch.NumRefs = 0;
+	Batch.bQueued = true;
+
+	QueuedBatchMap.Add(MakeKey(Metric, Inputs), BatchIndex);
+	QueuedBatches.Add(BatchIndex);
+	return BatchIndex;
+}
+
+void FVisibilityRequests::ReleaseBatchRef(int32 BatchIndex)
+{
+	FBatch& Batch = Batches[BatchIndex];
+	check(Batch.NumRefs > 0);
+	if (--Batch.NumRefs > 0)
+	{
+		return;
+	}
+
+	// Every waiter cancelled before the end of the frame, the dispatch is skipped
+	if (Batch.bQueued)
+	{
+		QueuedBatchMap.Remove(MakeKey(*Batch.Metric, Batch.Inputs));
+		QueuedBatches.RemoveSingle(BatchIndex);
+		Batch.bQueued = false;
+	}
+
+	Batch.Status = EVisibilityRequestStatus::Invalid;
+	Batch.Inputs = FVisibilityReductionInputs();
+	FreeBatches.Add(BatchIndex);
+}
+
+FVisibilityRequests::FWaiter* FVisibilityRequests::FindWaiter(FVisibilityRequestHandle Handle)
+{
+	check(IsInGameThread());
+
+	if (!Waiters.IsValidIndex(Handle.Index))
+	{
+		return nullptr;
+	}
+
+	FWaiter& Waiter = Waiters[Handle.Index];
+	if (Waiter.BatchIndex == INDEX_NONE || Waiter.Generation != Handle.Generation)
+	{
+		return nullptr;
+	}
+	return &Waiter;
+}
+
+void FVisibilityRequests::FreeWaiter(int32 WaiterIndex)
+{
+	FWaiter& Waiter = Waiters[WaiterIndex];
+
+	// Invalidates every outstanding handle to this slot
+	++Waiter.Generation;
+	Waiter.BatchIndex = INDEX_NONE;
+	Waiter.OnComplete.Reset();
+	Waiter.Owner.Reset();
+	Waiter.bHasOwner = false;
+
+	FreeWaiters.Add(WaiterIndex);
+}
+
+FVisibilityRequestHandle FVisibilityRequests::Request(const FVisibilityReductionMetric& Metric, const FVisibilityReductionInputs& Inputs, FOnComplete&& OnComplete, const UObject* Owner)
+{
+	check(IsInGameThread());
+
+	const int32* QueuedBatch = QueuedBatchMap.Find(MakeKey(Metric, Inputs));
+	const int32 BatchIndex = QueuedBatch ? *QueuedBatch : AllocateBatch(Metric, Inputs);
+
+	const int32 WaiterIndex = FreeWaiters.Num() > 0 ? FreeWaiters.Pop(false) : Waiters.AddDefaulted();
+	FWaiter& Waiter = Waiters[WaiterIndex];
+	Waiter.BatchIndex = BatchIndex;
+	Waiter.OnComplete = MoveTemp(OnComplete);
+	Waiter.Owner = Owner;
+	Waiter.bHasOwner = Owner != nullptr;
+
+	FBatch& Batch = Batches[BatchIndex];
+	Batch.WaiterIndices.Add(WaiterIndex);
+	++Batch.NumRefs;
+	// Capturing does not split batches, one waiter asking for it captures the shared dispatch
+	Batch.Inputs.bCapture |= Inputs.bCapture;
+
+	FVisibilityRequestHandle Handle;
+	Handle.Index = WaiterIndex;
+	Handle.Generation = Waiter.Generation;
+	return Handle;
+}
+
+bool FVisibilityRequests::Cancel(FVisibilityRequestHandle Handle)
+{
+	FWaiter* Waiter = FindWaiter(Handle);
+	if (!Waiter)
+	{
+		return false;
+	}
+
+	const int32 BatchIndex = Waiter->BatchIndex;
+	FOnComplete OnComplete = MoveTemp(Waiter->OnComplete);
+	const bool bOwnerAlive = !Waiter->bHasOwner || Waiter->Owner.IsValid();
+
+	Batches[BatchIndex].WaiterIndices.RemoveSingle(Handle.Index);
+	FreeWaiter(Handle.Index);
+	ReleaseBatchRef(BatchIndex);
+
+	// Called last, it may issue new requests
+	if (OnComplete && bOwnerAlive)
+	{
+		OnComplete(nullptr, 0);
+	}
+	return true;
+}
+
+EVisibilityRequestStatus FVisibilityRequests::GetStatus(FVisibilityRequestHandle Handle)
+{
+	const FWaiter* Waiter = FindWaiter(Handle);
+	return Waiter ? Batches[Waiter->BatchIndex].Status : EVisibilityRequestStatus::Invalid;
+}
+
+bool FVisibilityRequests::GetData(FVisibilityRequestHandle Handle, const int64*& OutData, uint32& OutNumBytes, double* OutScreenArea)
+{
+	const FWaiter* Waiter = FindWaiter(Handle);
+	if (!Waiter || Batches[Waiter->BatchIndex].Status != EVisibilityRequestStatus::Ready)
+	{
+		return false;
+	}
+
+	const FBatch& Batch = Batches[Waiter->BatchIndex];
+	OutData = Batch.Data.GetData();
+	OutNumBytes = Batch.Data.Num() * sizeof(int64);
+	if (OutScreenArea)
+	{
+		*OutScreenArea = Batch.ScreenArea;
+	}
+	return true;
+}
+
+void FVisibilityRequests::Release(FVisibilityRequestHandle Handle)
+{
+	FWaiter* Waiter = FindWaiter(Handle);
+	if (!Waiter)
+	{
+		return;
+	}
+
+	const int32 BatchIndex = Waiter->BatchIndex;
+	Batches[BatchIndex].WaiterIndices.RemoveSingle(Handle.Index);
+	FreeWaiter(Handle.Index);
+	ReleaseBatchRef(BatchIndex);
+}
+
+void FVisibilityRequests::Complete(int32 BatchIndex, EVisibilityRequestStatus Status)
+{
+	FScopeLock Lock(&CompletedLock);
+	CompletedBatches.Emplace(BatchIndex, Status);
+}
+
+void FVisibilityRequests::Tick()
+{
+	check(IsInGameThread());
+
+	Deliver();
+	Flush();
+}
+
+void FVisibilityRequests::Deliver()
+{
+	{
+		FScopeLock Lock(&CompletedLock);
+		Swap(CompletedBatches, DeliveringBatches);
+	}
+
+	for (const TPair<int32, EVisibilityRequestStatus>& Completed : DeliveringBatches)
+	{
+		const int32 BatchIndex = Completed.Key;
+		FBatch& Batch = Batches[BatchIndex];
+		Batch.Status = Completed.Value;
+
+		// Callback waiters are released before any of them runs, so callbacks are free to request and cancel.
+		// Polled waiters stay until they are released
+		TArray<FOnComplete, TInlineAllocator<4>> Callbacks;
+		for (int32 Index = 0; Index < Batch.WaiterIndices.Num(); )
+		{
+			const int32 WaiterIndex = Batch.WaiterIndices[Index];
+			FWaiter& Waiter = Waiters[WaiterIndex];
+			if (!Waiter.OnComplete)
+			{
+				++Index;
+				continue;
+			}
+
+			if (!Waiter.bHasOwner || Waiter.Owner.IsValid())
+			{
+				Callbacks.Add(MoveTemp(Waiter.OnComplete));
+			}
+			Batch.WaiterIndices.RemoveAt(Index, 1, false);
+			FreeWaiter(WaiterIndex);
+			--Batch.NumRefs;
+		}
+
+		// The batch is kept alive by its in-flight reference until every callback has read its data
+		const bool bReady = Batch.Status == EVisibilityRequestStatus::Ready;
+		const int64* Data = bReady ? Batch.Data.GetData() : nullptr;
+		const uint32 NumBytes = bReady ? Batch.Data.Num() * sizeof(int64) : 0;
+		for (FOnComplete& OnComplete : Callbacks)
+		{
+			OnComplete(Data, NumBytes);
+		}
+
+		ReleaseBatchRef(BatchIndex);
+	}
+
+	DeliveringBatches.Reset();
+}
+
+void FVisibilityRequests::Flush()
+{
+	if (QueuedBatches.Num() == 0)
+	{
+		return;
+	}
+
+	// Batch objects never move, so the render thread writes the results straight into them
+	TArray<TPair<int32, FBatch*>> Dispatched;
+	Dispatched.Reserve(QueuedBatches.Num());
+
+	for (int32 BatchIndex : QueuedBatches)
+	{
+		FBatch& Batch = Batches[BatchIndex];
+		Batch.bQueued = false;
+		// In-flight reference, dropped by Deliver
+		++Batch.NumRefs;
+
+		// The render targets may have been garbage collected since the request
+		if (!Batch.InputTexture.IsValid() || (Batch.Inputs.CameraTexture && !Batch.CameraTexture.IsValid()))
+		{
+			Complete(BatchIndex, EVisibilityRequestStatus::Failed);
+			continue;
+		}
+		Dispatched.Emplace(BatchIndex, &Batch);
+	}
+
+	QueuedBatches.Reset();
+	QueuedBatchMap.Reset();
+
+	if (Dispatched.Num() == 0)
+	{
+		return;
+	}
+
+	// Every unique request of the frame goes into one graph
+	ENQUEUE_RENDER_COMMAND(VisibilityRequests)(
+		[Dispatched = MoveTemp(Dispatched)](FRHICommandListImmediate& RHICmdList)
+		{
+			FRDGBuilder GraphBuilder(RHICmdList);
+
+			for (const TPair<int32, FBatch*>& Entry : Dispatched)
+			{
+				const int32 BatchIndex = Entry.Key;
+				FBatch* Batch = Entry.Value;
+				const FVisibilityReductionMetric& Metric = *Batch->Metric;
+
+				const bool bEnqueued = FVisibilityReductionPassBuilder::AddReduction(
+					GraphBuilder,
+					Batch->Inputs,
+					Metric.GetShaders(GMaxRHIFeatureLevel),
+					Metric.Name,
+					Metric.PassFlags,
+					[BatchIndex, Batch](const int64* Data, uint32 NumBytes)
+					{
+						Batch->Data.Reset();
+						Batch->Data.Append(Data, NumBytes / sizeof(int64));
+						Complete(BatchIndex, EVisibilityRequestStatus::Ready);
+					});
+
+				if (!bEnqueued)
+				{
+					Complete(BatchIndex, EVisibilityRequestStatus::Failed);
+				}
+			}
+
+			GraphBuilder.Execute();
+		});
+}
+
+void FVisibilityRequests::Shutdown()
+{
+	// Outstanding callbacks fail like a Cancel, so every RequestFuture promise is set before it is destroyed
+	TArray<FOnComplete> Callbacks;
+	for (FWaiter& Waiter : Waiters)
+	{
+		if (Waiter.BatchIndex != INDEX_NONE && Waiter.OnComplete && (!Waiter.bHasOwner || Waiter.Owner.IsValid()))
+		{
+			Callbacks.Add(MoveTemp(Waiter.OnComplete));
+		}
+	}
+
+	{
+		FScopeLock Lock(&CompletedLock);
+		CompletedBatches.Empty();
+	}
+	DeliveringBatches.Empty();
+
+	QueuedBatches.Empty();
+	QueuedBatchMap.Empty();
+	Waiters.Empty();
+	FreeWaiters.Empty();
+	Batches.Empty();
+	FreeBatches.Empty();
+
+	// Called last, once per waiter: a callback that requests again is not called back a second time
+	for (FOnComplete& OnComplete : Callbacks)
+	{
+		OnComplete(nullptr, 0);
+	}
+}
@@ -0,0 +1,270 @@
+#include "ResultCache/VisibilityResultCache.h"
+#include "ScreenRect/VisibilityScreenRect.h"
+#include "VisibilityCoreStats.h"
+#include "Components/SceneCaptureComponent2D.h"
+#include "Engine/TextureRenderTarget.h"
+#include "Engine/World.h"
+#include "GameFramework/Actor.h"
+#include "HAL/IConsoleManager.h"
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("Cache Hits"), STAT_VisibilityCache_Hits, STATGROUP_VisibilityCore);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Cache Joined"), STAT_VisibilityCache_Joined, STATGROUP_VisibilityCore);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Cache Misses"), STAT_VisibilityCache_Misses, STATGROUP_VisibilityCore);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Cache Entries"), STAT_VisibilityCache_Entries, STATGROUP_VisibilityCore);
+
+static TAutoConsoleVariable<float> CVarVisibilityCacheMaxAge(
+	TEXT("r.VisibilityCore.Cache.MaxAge"),
+	1.0f,
+	TEXT("Seconds a cached visibility result is served for while nothing it depends on changes. 0 disables the cache"),
+	ECVF_Default);
+
+// Transforms and matrices closer than this are the same state
+static constexpr float VisibilityCacheTolerance = 1.e-4f;
+// Seconds between two purges of unused entries
+static constexpr double VisibilityCachePurgeInterval = 5.0;
+// Entries unused for this long are purged
+static constexpr double VisibilityCacheEntryLifetime = 30.0;
+
+TMap<FVisibilityResultCache::FKey, FVisibilityResultCache::FEntry> FVisibilityResultCache::Entries;
+uint64 FVisibilityResultCache::SceneEpoch = 0;
+uint32 FVisibilityResultCache::NextSerial = 0;
+FVisibilityResultCache::FStats FVisibilityResultCache::Stats;
+double FVisibilityResultCache::LastPurgeTime = 0.0;
+FDelegateHandle FVisibilityResultCache::LevelAddedHandle;
+FDelegateHandle FVisibilityResultCache::LevelRemovedHandle;
+
+bool FVisibilityCacheState::Matches(const FVisibilityCacheState& Other) const
+{
+	return SceneEpoch == Other.SceneEpoch
+		&& bActorVisible == Other.bActorVisible
+		&& ActorTransform.Equals(Other.ActorTransform, VisibilityCacheTolerance)
+		&& ViewProjectionMatrix.Equals(Other.ViewProjectionMatrix, VisibilityCacheTolerance);
+}
+
+FVisibilityCacheState FVisibilityResultCache::CaptureState(const AActor* Actor, const USceneCaptureComponent2D* Capture, const UTextureRenderTarget* Texture)
+{
+	FVisibilityCacheState State;
+	State.SceneEpoch = SceneEpoch;
+
+	if (Actor)
+	{
+		const USceneComponent* Root = Actor->GetRootComponent();
+		State.ActorTransform = Actor->GetActorTransform();
+		State.bActorVisible = !Actor->IsHidden() && (!Root || Root->IsVisible());
+	}
+
+	if (Capture && Texture)
+	{
+		const FIntPoint TextureSize(FMath::RoundToInt(Texture->GetSurfaceWidth()), FMath::RoundToInt(Texture->GetSurfaceHeight()));
+		State.ViewProjectionMatrix = FVisibilityScreenRect::GetViewProjectionMatrix(Capture, TextureSize);
+	}
+	return State;
+}
+
+bool FVisibilityResultCache::Request(
+	const FVisibilityReductionMetric& Metric,
+	const FVisibilityReductionInputs& Inputs,
+	const AActor* Actor,
+	const USceneCaptureComponent2D* Capture,
+	FVisibilityRequests::FOnComplete&& OnComplete,
+	const UObject* Owner,
+	float MaxAge)
+{
+	check(IsInGameThread());
+
+	if (MaxAge < 0.f)
+	{
+		MaxAge = CVarVisibilityCacheMaxAge.GetValueOnGameThread();
+	}
+	if (MaxAge <= 0.f)
+	{
+		FVisibilityRequests::Request(Metric, Inputs, MoveTemp(OnComplete), Owner);
+		return false;
+	}
+
+	FKey Key;
+	Key.Metric = &Metric;
+	Key.InputTexture = Inputs.InputTexture;
+	Key.CameraTexture = Inputs.CameraTexture;
+	Key.Actor = Actor;
+	Key.Capture = Capture;
+	Key.ViewRect = Inputs.ViewRect;
+	Key.ScreenAspectRatio = Inputs.ScreenAspectRatio;
+	Key.ScreenRect = Inputs.bRestrictToScreenRect ? Inputs.ScreenRect : FIntRect();
+	Key.bRestrictToScreenRect = Inputs.bRestrictToScreenRect;
+	Key.bUseTileCompaction = Inputs.bUseTileCompaction;
+
+	const double Now = FPlatformTime::Seconds();
+	const FVisibilityCacheState State = CaptureState(Actor, Capture, Inputs.InputTexture);
+
+	FEntry& Entry = Entries.FindOrAdd(Key);
+	Entry.LastUsedTime = Now;
+
+	if (Entry.bHasData && Now - Entry.Time <= MaxAge && Entry.State.Matches(State))
+	{
+		++Stats.NumHits;
+		INC_DWORD_STAT(STAT_VisibilityCache_Hits);
+		OnComplete(Entry.Data.GetData(), Entry.Data.Num() * sizeof(int64));
+		return true;
+	}
+
+	FWaiter& Waiter = Entry.Waiters.AddDefaulted_GetRef();
+	Waiter.OnComplete = MoveTemp(OnComplete);
+	Waiter.Owner = Owner;
+	Waiter.bHasOwner = Owner != nullptr;
+
+	if (Entry.bPending && Entry.PendingState.Matches(State))
+	{
+		++Stats.NumJoined;
+		INC_DWORD_STAT(STAT_VisibilityCache_Joined);
+		Waiter.Serial = Entry.PendingSerial;
+		return false;
+	}
+
+	++Stats.NumMisses;
+	INC_DWORD_STAT(STAT_VisibilityCache_Misses);
+
+	const uint32 Serial = ++NextSerial;
+	Waiter.Serial = Serial;
+	Entry.PendingSerial = Serial;
+	Entry.bPending = true;
+	Entry.PendingState = State;
+	Entry.PendingTime = Now;
+
+	// Owners are checked per waiter, the request itself always completes
+	FVisibilityRequests::Request(Metric, Inputs,
+		[Key, Serial](const int64* Data, uint32 NumBytes)
+		{
+			OnRequestComplete(Key, Serial, Data, NumBytes);
+		});
+	return false;
+}
+
+void FVisibilityResultCache::OnRequestComplete(const FKey& Key, uint32 Serial, const int64* Data, uint32 NumBytes)
+{
+	FEntry* Entry = Entries.Find(Key);
+	if (!Entry)
+	{
+		return;
+	}
+
+	// Older requests still answer their waiters, but only the latest one is cached
+	if (Serial == Entry->PendingSerial)
+	{
+		Entry->bPending = false;
+		if (Data)
+		{
+			Entry->State = Entry->PendingState;
+			Entry->Time = Entry->PendingTime;
+			Entry->Data.Reset();
+			Entry->Data.Append(Data, NumBytes / sizeof(int64));
+			Entry->bHasData = true;
+		}
+	}
+
+	// Taken out first, callbacks may request again and reallocate the entries
+	TArray<FWaiter, TInlineAllocator<4>> Completed;
+	for (int32 Index = Entry->Waiters.Num() - 1; Index >= 0; --Index)
+	{
+		if (Entry->Waiters[Index].Serial == Serial)
+		{
+			Completed.Add(MoveTemp(Entry->Waiters[Index]));
+			Entry->Waiters.RemoveAt(Index, 1, false);
+		}
+	}
+
+	// Completed holds them newest first
+	for (int32 Index = Completed.Num() - 1; Index >= 0; --Index)
+	{
+		FWaiter& Waiter = Completed[Index];
+		if (!Waiter.bHasOwner || Waiter.Owner.IsValid())
+		{
+			Waiter.OnComplete(Data, NumBytes);
+		}
+	}
+}
+
+void FVisibilityResultCache::InvalidateAll()
+{
+	++SceneEpoch;
+}
+
+FVisibilityResultCache::FStats FVisibilityResultCache::GetStats()
+{
+	FStats Result = Stats;
+	Result.NumEntries = Entries.Num();
+	return Result;
+}
+
+void FVisibilityResultCache::ResetStats()
+{
+	Stats = FStats();
+}
+
+void FVisibilityResultCache::Startup()
+{
+	LevelAddedHandle = FWorldDelegates::LevelAddedToWorld.AddLambda([](ULevel*, UWorld*) { InvalidateAll(); });
+	LevelRemovedHandle = FWorldDelegates::LevelRemovedFromWorld.AddLambda([](ULevel*, UWorld*) { InvalidateAll(); });
+}
+
+void FVisibilityResultCache::Tick()
+{
+	check(IsInGameThread());
+
+	SET_DWORD_STAT(STAT_VisibilityCache_Entries, Entries.Num());
+
+	const double Now = FPlatformTime::Seconds();
+	if (Now - LastPurgeTime < VisibilityCachePurgeInterval)
+	{
+		return;
+	}
+	LastPurgeTime = Now;
+
+	for (auto It = Entries.CreateIterator(); It; ++It)
+	{
+		const FKey& Key = It.Key();
+		const FEntry& Entry = It.Value();
+		if (Entry.bPending)
+		{
+			continue;
+		}
+
+		// A default key means the object was never given, not that it is gone
+		const bool bObjectsGone = Key.InputTexture.ResolveObjectPtr() == nullptr
+			|| (Key.Actor != TObjectKey<AActor>() && Key.Actor.ResolveObjectPtr() == nullptr)
+			|| (Key.Capture != TObjectKey<USceneCaptureComponent2D>() && Key.Capture.ResolveObjectPtr() == nullptr);
+		if (bObjectsGone || Now - Entry.LastUsedTime > VisibilityCacheEntryLifetime)
+		{
+			It.RemoveCurrent();
+		}
+	}
+}
+
+void FVisibilityResultCache::Shutdown()
+{
+	FWorldDelegates::LevelAddedToWorld.Remove(LevelAddedHandle);
+	FWorldDelegates::LevelRemovedFromWorld.Remove(LevelRemovedHandle);
+	Entries.Empty();
+}
+
+static FAutoConsoleCommand CmdVisibilityCacheStats(
+	TEXT("r.VisibilityCore.Cache.Stats"),
+	TEXT("Prints the hit rate of the visibility result cache since the last r.VisibilityCore.Cache.ResetStats"),
+	FConsoleCommandDelegate::CreateLambda([]()
+	{
+		const FVisibilityResultCache::FStats CacheStats = FVisibilityResultCache::GetStats();
+		const uint64 NumRequests = CacheStats.NumHits + CacheStats.NumJoined + CacheStats.NumMisses;
+		UE_LOG(LogTemp, Display, TEXT("Visibility cache: %llu requests, %llu hits (%.1f%%), %llu joined an in-flight request, %llu dispatched, %d entries."),
+			NumRequests, CacheStats.NumHits, NumRequests > 0 ? 100.0 * CacheStats.NumHits / NumRequests : 0.0,
+			CacheStats.NumJoined, CacheStats.NumMisses, CacheStats.NumEntries);
+	}));
+
+static FAutoConsoleCommand CmdVisibilityCacheResetStats(
+	TEXT("r.VisibilityCore.Cache.ResetStats"),
+	TEXT("Resets the counters of r.VisibilityCore.Cache.Stats"),
+	FConsoleCommandDelegate::CreateStatic(&FVisibilityResultCache::ResetStats));
+
+static FAutoConsoleCommand CmdVisibilityCacheInvalidate(
+	TEXT("r.VisibilityCore.Cache.Invalidate"),
+	TEXT("Makes every cached visibility result stale"),
+	FConsoleCommandDelegate::CreateStatic(&FVisibilityResultCache::InvalidateAll));
@@ -0,0 +1,79 @@
+#include "ScreenRect/VisibilityScreenRect.h"
+#include "SceneView.h"
+#include "GameFramework/Actor.h"
+#include "Components/SceneCaptureComponent2D.h"
+#include "Engine/TextureRenderTarget2D.h"
+#include "Kismet/GameplayStatics.h"
+
+bool FVisibilityScreenRect::Compute(const FBox& WorldBounds, const FMatrix& ViewProjectionMatrix, FIntPoint TextureSize, FIntRect& OutRect, int32 Padding)
+{
+	if (!WorldBounds.IsValid || TextureSize.X <= 0 || TextureSize.Y <= 0)
+	{
+		return false;
+	}
+
+	const FIntRect ViewRect(FIntPoint::ZeroValue, TextureSize);
+	FVector Corners[8];
+	WorldBounds.GetVertices(Corners);
+
+	FVector2D ScreenMin(TNumericLimits<double>::Max());
+	FVector2D ScreenMax(TNumericLimits<double>::Lowest());
+	for (const FVector& Corner : Corners)
+	{
+		FVector2D ScreenPos;
+		// A corner behind the camera can't be projected, and the projected hull of the others does not enclose the object
+		if (!FSceneView::ProjectWorldToScreen(Corner, ViewRect, ViewProjectionMatrix, ScreenPos))
+		{
+			return false;
+		}
+		ScreenMin = FVector2D::Min(ScreenMin, ScreenPos);
+		ScreenMax = FVector2D::Max(ScreenMax, ScreenPos);
+	}
+
+	// Round outwards and pad, so pixels whose centers touch the hull edge are always included
+	OutRect = FIntRect(
+		FMath::FloorToInt(ScreenMin.X) - Padding,
+		FMath::FloorToInt(ScreenMin.Y) - Padding,
+		FMath::CeilToInt(ScreenMax.X) + 1 + Padding,
+		FMath::CeilToInt(ScreenMax.Y) + 1 + Padding);
+	OutRect.Clip(ViewRect);
+	return true;
+}
+
+FMatrix FVisibilityScreenRect::GetViewProjectionMatrix(const USceneCaptureComponent2D* Capture, FIntPoint TextureSize)
+{
+	// Rebuild the capture's view the same way scene capture rendering does: horizontal FOV is kept, vertical follows the target aspect
+	FMinimalViewInfo ViewInfo;
+	ViewInfo.Location = Capture->GetComponentLocation();
+	ViewInfo.Rotation = Capture->GetComponentRotation();
+	ViewInfo.FOV = Capture->FOVAngle;
+	ViewInfo.ProjectionMode = Capture->ProjectionType;
+	ViewInfo.OrthoWidth = Capture->OrthoWidth;
+	ViewInfo.AspectRatio = (float)TextureSize.X / (float)FMath::Max(TextureSize.Y, 1);
+
+	FMatrix ViewMatrix, ProjectionMatrix, ViewProjectionMatrix;
+	UGameplayStatics::GetViewProjectionMatrix(ViewInfo, ViewMatrix, ProjectionMatrix, ViewProjectionMatrix);
+	if (Capture->bUseCustomProjectionMatrix)
+	{
+		ViewProjectionMatrix = ViewMatrix * Capture->CustomProjectionMatrix;
+	}
+	return ViewProjectionMatrix;
+}
+
+bool FVisibilityScreenRect::Compute(const AActor* Actor, const USceneCaptureComponent2D* Capture, FIntRect& OutRect, int32 Padding)
+{
+	check(IsInGameThread());
+
+	if (!Actor || !Capture || !Capture->TextureTarget)
+	{
+		return false;
+	}
+
+	const FIntPoint TextureSize(Capture->TextureTarget->SizeX, Capture->TextureTarget->SizeY);
+	if (TextureSize.X <= 0 || TextureSize.Y <= 0)
+	{
+		return false;
+	}
+
+	return Compute(Actor->GetComponentsBoundingBox(true), GetViewProjectionMatrix(Capture, TextureSize), TextureSize, OutRect, Padding);
+}
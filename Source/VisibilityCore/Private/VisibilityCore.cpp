@@ -0,0 +1,55 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "VisibilityCore.h"
+#include "ReductionPass/VisibilityReadbacks.h"
+#include "Requests/VisibilityRequests.h"
+#include "ResultCache/VisibilityResultCache.h"
+#include "Recorder/VisibilityRecorder.h"
+#include "Capture/VisibilityFrameCapture.h"
+#include "Delivery/VisibilityResultStream.h"
+
+#include "Misc/Paths.h"
+#include "Misc/CoreDelegates.h"
+#include "ShaderCore.h"
+#include "RenderingThread.h"
+#include "Interfaces/IPluginManager.h"
+
+#define LOCTEXT_NAMESPACE "FVisibilityCoreModule"
+
+void FVisibilityCoreModule::StartupModule()
+{
+	// Metric shaders include the reduction framework from /VisibilityCoreShaders, so this module loads in PostConfigInit as well
+	FString PluginShaderDir = FPaths::Combine(IPluginManager::Get().FindPlugin(TEXT("VisibilityToneCalculation"))->GetBaseDir(), TEXT("Shaders/VisibilityCore/Private"));
+	AddShaderSourceDirectoryMapping(TEXT("/VisibilityCoreShaders"), PluginShaderDir);
+
+	EndFrameRTHandle = FCoreDelegates::OnEndFrameRT.AddStatic(&FVisibilityReadbacks::Poll);
+	CaptureEndFrameRTHandle = FCoreDelegates::OnEndFrameRT.AddStatic(&FVisibilityFrameCapture::Poll);
+	EndFrameHandle = FCoreDelegates::OnEndFrame.AddStatic(&FVisibilityRequests::Tick);
+	CacheEndFrameHandle = FCoreDelegates::OnEndFrame.AddStatic(&FVisibilityResultCache::Tick);
+	StreamsEndFrameHandle = FCoreDelegates::OnEndFrame.AddStatic(&FVisibilityResultStreams::Tick);
+	FVisibilityResultCache::Startup();
+}
+
+void FVisibilityCoreModule::ShutdownModule()
+{
+	FVisibilityRecorder::Stop();
+	FVisibilityFrameCapture::Stop();
+
+	FVisibilityResultCache::Shutdown();
+	FCoreDelegates::OnEndFrame.Remove(CacheEndFrameHandle);
+	FCoreDelegates::OnEndFrame.Remove(StreamsEndFrameHandle);
+	FCoreDelegates::OnEndFrame.Remove(EndFrameHandle);
+	FCoreDelegates::OnEndFrameRT.Remove(EndFrameRTHandle);
+	FCoreDelegates::OnEndFrameRT.Remove(CaptureEndFrameRTHandle);
+
+	// Queued render commands still point at pooled request batches
+	FlushRenderingCommands();
+	FVisibilityReadbacks::Shutdown();
+	FVisibilityFrameCapture::Shutdown();
+	FVisibilityRequests::Shutdown();
+	FVisibilityResultStreams::Shutdown();
+}
+
+#undef LOCTEXT_NAMESPACE
+	
+IMPLEMENT_MODULE(FVisibilityCoreModule, VisibilityCore)
@@ -0,0 +1,6 @@
+#pragma once
+
+#include "Stats/Stats.h"
+
+// Shared by every feature of the module, shown with `stat VisibilityCore`
+DECLARE_STATS_GROUP(TEXT("VisibilityCore"), STATGROUP_VisibilityCore, STATCAT_Advanced);
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PixelFormat.h"
+#include "ReductionPass/VisibilityReductionPass.h"
+#include <atomic>
+
+// Pixels of one captured render target, tightly packed rows, slice after slice
+struct VISIBILITYCORE_API FVisibilityCaptureTexture
+{
+	int32 PixelFormat = PF_Unknown;
+	int32 SizeX = 0;
+	int32 SizeY = 0;
+	int32 NumSlices = 0;
+	// Read through an sRGB view by the shaders
+	bool bSRGB = false;
+	TArray<uint8> Pixels;
+
+	int32 GetBytesPerPixel() const;
+	int64 GetSliceBytes() const { return (int64)SizeX * SizeY * GetBytesPerPixel(); }
+	const uint8* GetSlice(int32 Slice) const { return Pixels.GetData() + Slice * GetSliceBytes(); }
+
+	friend FArchive& operator<<(FArchive& Ar, FVisibilityCaptureTexture& Texture);
+};
+
+// Everything needed to run one reduction again: its inputs, the parameters it was dispatched with and what the GPU returned
+struct VISIBILITYCORE_API FVisibilityCapture
+{
+	FString MetricName;
+	uint32 FrameNumber = 0;
+	// Seconds since the capture started
+	double Time = 0.0;
+
+	FIntRect ViewRect;
+	float ScreenAspectRatio = 0.f;
+	FIntRect ScreenRect;
+	bool bRestrictToScreenRect = false;
+	bool bUseTileCompaction = false;
+
+	// NumChannels int64 per slice, as read back from the GPU
+	int32 NumChannels = 0;
+	TArray<int64> Result;
+
+	FVisibilityCaptureTexture InputTexture;
+	bool bHasCameraTexture = false;
+	FVisibilityCaptureTexture CameraTexture;
+
+	// Inputs matching the capture, without render targets
+	FVisibilityReductionInputs MakeInputs() const;
+
+	friend FArchive& operator<<(FArchive& Ar, FVisibilityCapture& Capture);
+};
+
+struct FVisibilityCaptureFileHeader
+{
+	// "VCAP"
+	static constexpr uint32 ExpectedMagic = 0x50414356;
+	// 2: 64 bit Result
+	static constexpr uint32 CurrentVersion = 2;
+
+	uint32 Magic = ExpectedMagic;
+	uint32 Version = CurrentVersion;
+
+	friend FArchive& operator<<(FArchive& Ar, FVisibilityCaptureFileHeader& Header)
+	{
+		return Ar << Header.Magic << Header.Version;
+	}
+};
+
+// Snapshots the inputs, parameters and results of selected reductions into a compressed capture file, to reproduce
+// slow or wrong measurements offline with the VisibilityReplay commandlet.
+//
+// A reduction is captured when its inputs set bCapture, or while CaptureNext has budget left. The render targets are
+// copied into texture readbacks in the same graph as the reduction, polled once per frame on the render thread, and
+// compressed and written by a background thread: capturing never waits for the GPU. Start and Stop on the game thread, or
+// with the r.VisibilityCore.Capture.Start <File>, r.VisibilityCore.Capture.Next <Count> and r.VisibilityCore.Capture.Stop
+// console commands. Read files back with FVisibilityCaptureReader
+class VISIBILITYCORE_API FVisibilityFrameCapture
+{
+public:
+	static bool Start(const FString& Path);
+	// Waits for the GPU to finish the captures in flight and closes the file
+	static void Stop();
+
+	static bool IsCapturing() { return bCapturing.load(std::memory_order_acquire); }
+
+	// Captures the next Count reductions of every metric, whether they set bCapture or not
+	static void CaptureNext(int32 Count);
+
+	// Render thread, called by FVisibilityReductionPassBuilder::AddReduction after the reduction passes. Adds the copies of
+	// the input render targets to the graph if the reduction is selected, and wraps OnReady to store its result
+	static void AddCapture(FRDGBuilder& GraphBuilder, const FVisibilityReductionInputs& Inputs, const TCHAR* MetricName, int32 NumChannels, FVisibilityReadbacks::FOnReady& OnReady);
+
+	// Render thread. Hands the captures whose copies landed to the writer. Bound to FCoreDelegates::OnEndFrameRT by the module
+	static void Poll();
+
+	static void Shutdown();
+
+private:
+	class FWriter;
+	struct FPendingCapture;
+
+	static bool ShouldCapture(const FVisibilityReductionInputs& Inputs, const TCHAR* MetricName);
+
+	static std::atomic<bool> bCapturing;
+	static std::atomic<int32> NumToCapture;
+	static TUniquePtr<FWriter> Writer;
+	// Render thread only
+	static TArray<TSharedPtr<FPendingCapture>> Pending;
+};
+
+// Sequential reader of the files written by FVisibilityFrameCapture
+class VISIBILITYCORE_API FVisibilityCaptureReader
+{
+public:
+	bool Open(const FString& Path);
+
+	// False at the end of the file, or when the next capture is truncated or corrupt
+	bool Next(FVisibilityCapture& OutCapture);
+
+private:
+	TUniquePtr<FArchive> File;
+	TArray<uint8> Compressed;
+	TArray<uint8> Uncompressed;
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+class UTextureRenderTarget;
+
+// Turns texel counts and sums of a capture target into values relative to the screen, so thresholds don't depend on
+// the capture resolution. See VisibilityCoverage_readme.md for the geometry and the error model.
+//
+// Captures are assumed to share the horizontal field of view of the screen (the engine's default axis constraint).
+// The screen then spans the full width of the view rect and ViewWidth / ScreenAspectRatio texels of its height, centered
+struct VISIBILITYCORE_API FVisibilityCoverage
+{
+	// Texels of the view rect that lie on screen. The whole view rect, cropped to its central rows when the screen is wider.
+	// An empty ViewRect stands for the whole texture, a ScreenAspectRatio of 0 for the aspect of the view rect
+	static FIntRect GetMeasuredRect(FIntPoint TextureSize, const FIntRect& ViewRect, float ScreenAspectRatio);
+
+	// Area of the screen in texels of the view rect, ViewWidth * ViewWidth / ScreenAspectRatio. Larger than the measured
+	// rect when the screen is taller than the view, the missing rows were not captured and count as empty
+	static double GetScreenArea(FIntPoint TextureSize, const FIntRect& ViewRect, float ScreenAspectRatio);
+
+	// Same for a render target, 0 without one. Every slice of a cube or array target covers one such screen
+	static double GetScreenArea(const UTextureRenderTarget* Texture, const FIntRect& ViewRect, float ScreenAspectRatio);
+
+	// Fraction of the screen, 0 when ScreenArea is 0
+	static float Normalize(int64 Value, double ScreenArea)
+	{
+		return ScreenArea > 0.0 ? (float)(Value / ScreenArea) : 0.f;
+	}
+};
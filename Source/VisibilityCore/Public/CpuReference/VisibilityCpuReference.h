@@ -0,0 +1,45 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ImageCore.h"
+#include "Async/ParallelFor.h"
+
+// Multi-threaded CPU implementation of the shipped metrics, matching their shaders texel for texel.
+// Used where there is no GPU, f.e. by the VisibilityAnalysis commandlet, and to check GPU results.
+// The reductions split an image in row blocks over the task graph. Callers that already run one reduction per worker pass
+// EParallelForFlags::ForceSingleThread, so the cores are not oversubscribed by nested parallelism.
+//
+// Texels are read as stored, like the shaders read render targets: 8 bit images are divided by 255 without
+// applying their gamma, float images are taken as is.
+class VISIBILITYCORE_API FVisibilityCpuReference
+{
+public:
+	// IsObjectTexel in Test.usf
+	static constexpr float ObjectThreshold = 0.9f;
+	// IsNotDark in LuminanceCalculationShader.usf
+	static constexpr float DarkThreshold = 0.01f;
+
+	// Perceived brightness (CIE L*, 0..100) of an sRGB encoded color, see GetBrightness in VisibilityReductionCommon.ush
+	static float GetBrightness(const FLinearColor& Color);
+
+	static bool IsObjectTexel(const FLinearColor& Color)
+	{
+		return Color.R > ObjectThreshold && Color.G > ObjectThreshold && Color.B > ObjectThreshold;
+	}
+
+	static bool IsNotDark(const FLinearColor& Color)
+	{
+		return Color.R > DarkThreshold && Color.G > DarkThreshold && Color.B > DarkThreshold;
+	}
+
+	// Converts images to a format the reductions read directly (BGRA8, RGBA16F or RGBA32F), keeping the stored values
+	static void NormalizeFormat(FImage& Image);
+
+	static bool IsSupportedFormat(ERawImageFormat::Type Format);
+
+	// Test metric: number of object texels of a stencil mask
+	static int64 CountObjectTexels(const FImageView& Mask, EParallelForFlags Flags = EParallelForFlags::None);
+
+	// LuminanceCalculation metric: sum of the floored brightness of every non-dark texel
+	static int64 SumBrightness(const FImageView& Frame, EParallelForFlags Flags = EParallelForFlags::None);
+};
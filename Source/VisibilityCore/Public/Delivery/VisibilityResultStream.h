@@ -0,0 +1,173 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Async/TaskGraphInterfaces.h"
+#include "Recorder/VisibilityMpscRing.h"
+#include <atomic>
+
+// One result pushed into a stream when its readback landed
+template<typename TResult>
+struct TVisibilityStreamItem
+{
+	// Given with the dispatch, f.e. the id of the measured object
+	uint64 Tag;
+	// GFrameNumberRenderThread when the readback landed
+	uint32 FrameNumber;
+	TResult Result;
+};
+
+// Non-templated part of a result stream, what FVisibilityResultStreams ticks
+class VISIBILITYCORE_API FVisibilityResultStreamBase : public TSharedFromThis<FVisibilityResultStreamBase, ESPMode::ThreadSafe>
+{
+public:
+	virtual ~FVisibilityResultStreamBase() = default;
+
+	// Results dropped because the ring was full, since the stream was created
+	uint32 GetNumDropped() const { return NumDropped.load(std::memory_order_relaxed); }
+
+protected:
+	// Game thread, once per tick while a game thread handler is set
+	virtual void TickGameThread() = 0;
+
+	// A stream has a single consumer at a time, whichever thread it is on
+	bool TryBeginDrain() { return !bDraining.exchange(true, std::memory_order_acquire); }
+	void EndDrain() { bDraining.store(false, std::memory_order_release); }
+
+	std::atomic<uint32> NumDropped{ 0 };
+
+private:
+	std::atomic<bool> bDraining{ false };
+
+	friend class FVisibilityResultStreams;
+};
+
+// Ticks the streams that deliver on the game thread
+class VISIBILITYCORE_API FVisibilityResultStreams
+{
+public:
+	// Game thread. Streams are held weakly, a destroyed stream is unregistered on the next tick
+	static void Register(const TSharedRef<FVisibilityResultStreamBase, ESPMode::ThreadSafe>& Stream);
+	static void Unregister(const FVisibilityResultStreamBase* Stream);
+
+	// Calls the game thread handler of every registered stream. Bound to FCoreDelegates::OnEndFrame by the module
+	static void Tick();
+
+	static void Shutdown();
+
+private:
+	static TArray<TWeakPtr<FVisibilityResultStreamBase, ESPMode::ThreadSafe>> Streams;
+};
+
+// Lock-free delivery of reduction results, for callers that measure many objects per frame.
+//
+// The render thread pushes each result into a bounded MPSC ring as its readback lands, instead of posting a game thread
+// task per result. The owner drains the ring in bulk, into one contiguous array: on any thread with Drain, on a task graph
+// worker with DrainOnWorker, or once per tick on the game thread with SetGameThreadHandler. A full ring drops results and
+// counts them. TResult must be trivially copyable, which the metric results are
+template<typename TResult>
+class TVisibilityResultStream final : public FVisibilityResultStreamBase
+{
+public:
+	using FItem = TVisibilityStreamItem<TResult>;
+	// Receives every result delivered since the previous drain, oldest first. The view is only valid during the call
+	using FHandler = TFunction<void(TArrayView<const FItem> Items)>;
+
+	// Capacity is rounded up to a power of two. Size it for the results of a few frames
+	static TSharedRef<TVisibilityResultStream, ESPMode::ThreadSafe> Create(uint32 Capacity = 4096)
+	{
+		return MakeShareable(new TVisibilityResultStream(Capacity));
+	}
+
+	// Any thread, never blocks. Returns false and drops the item when the ring is full
+	bool Push(const FItem& Item)
+	{
+		if (!Ring.TryPush(Item))
+		{
+			NumDropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		return true;
+	}
+
+	// Any thread. Pops up to MaxItems into OutItems, keeping its allocation. Returns 0 without waiting while another
+	// thread is draining
+	int32 Drain(TArray<FItem>& OutItems, int32 MaxItems = MAX_int32)
+	{
+		if (!TryBeginDrain())
+		{
+			OutItems.Reset();
+			return 0;
+		}
+		const int32 NumItems = Ring.PopAll(OutItems, MaxItems);
+		EndDrain();
+		return NumItems;
+	}
+
+	// Drains on a task graph worker and calls Handler there with the batch, even when it is empty. Skipped while another
+	// thread is draining. The returned event completes after Handler, the stream is kept alive until then
+	FGraphEventRef DrainOnWorker(FHandler&& Handler, ENamedThreads::Type Thread = ENamedThreads::AnyBackgroundThreadNormalTask)
+	{
+		return FFunctionGraphTask::CreateAndDispatchWhenReady(
+			[Stream = StaticCastSharedRef<TVisibilityResultStream>(AsShared()), Handler = MoveTemp(Handler)]()
+			{
+				Stream->DrainInto(Handler);
+			},
+			TStatId(), nullptr, Thread);
+	}
+
+	// Game thread. Handler is called once per tick with everything delivered since, when there is anything. Null stops;
+	// not from inside the handler
+	void SetGameThreadHandler(FHandler&& Handler)
+	{
+		check(IsInGameThread());
+
+		const bool bWasRegistered = (bool)GameThreadHandler;
+		GameThreadHandler = MoveTemp(Handler);
+		if (GameThreadHandler && !bWasRegistered)
+		{
+			FVisibilityResultStreams::Register(AsShared());
+		}
+		else if (!GameThreadHandler && bWasRegistered)
+		{
+			FVisibilityResultStreams::Unregister(this);
+		}
+	}
+
+	uint32 GetCapacity() const { return Ring.GetCapacity(); }
+
+protected:
+	virtual void TickGameThread() override
+	{
+		if (GameThreadHandler)
+		{
+			DrainInto(GameThreadHandler, false);
+		}
+	}
+
+private:
+	explicit TVisibilityResultStream(uint32 Capacity)
+		: Ring(Capacity)
+	{
+	}
+
+	// Drains into the stream's own buffer, so steady state drains do not allocate
+	void DrainInto(const FHandler& Handler, bool bCallWhenEmpty = true)
+	{
+		if (!TryBeginDrain())
+		{
+			return;
+		}
+		Ring.PopAll(DrainBuffer);
+		if (DrainBuffer.Num() > 0 || bCallWhenEmpty)
+		{
+			Handler(DrainBuffer);
+		}
+		EndDrain();
+	}
+
+	TVisibilityMpscRing<FItem> Ring;
+	// Only touched by the thread that holds the drain
+	TArray<FItem> DrainBuffer;
+	// Game thread only
+	FHandler GameThreadHandler;
+};
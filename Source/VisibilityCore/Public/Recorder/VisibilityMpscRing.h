@@ -0,0 +1,104 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include <atomic>
+
+// Bounded lock-free multi-producer single-consumer ring of trivially copyable items (D. Vyukov's bounded queue).
+// Producers never block and never allocate: TryPush fails when the ring is full and the caller decides what to drop.
+template<typename T>
+class TVisibilityMpscRing
+{
+	static_assert(TIsTriviallyCopyConstructible<T>::Value, "Ring items are copied in and out by value");
+
+public:
+	// Capacity is rounded up to a power of two
+	explicit TVisibilityMpscRing(uint32 InCapacity)
+	{
+		const uint32 Capacity = FMath::RoundUpToPowerOfTwo(FMath::Max(InCapacity, 2u));
+		Mask = Capacity - 1;
+		Cells = MakeUnique<FCell[]>(Capacity);
+		for (uint32 Index = 0; Index < Capacity; ++Index)
+		{
+			Cells[Index].Sequence.store(Index, std::memory_order_relaxed);
+		}
+	}
+
+	UE_NONCOPYABLE(TVisibilityMpscRing);
+
+	// Any thread
+	bool TryPush(const T& Item)
+	{
+		uint64 Position = PushPosition.load(std::memory_order_relaxed);
+		FCell* Cell;
+		for (;;)
+		{
+			Cell = &Cells[Position & Mask];
+			const uint64 Sequence = Cell->Sequence.load(std::memory_order_acquire);
+			const int64 Difference = (int64)Sequence - (int64)Position;
+			if (Difference == 0)
+			{
+				if (PushPosition.compare_exchange_weak(Position, Position + 1, std::memory_order_relaxed))
+				{
+					break;
+				}
+			}
+			else if (Difference < 0)
+			{
+				// The consumer has not freed this cell yet
+				return false;
+			}
+			else
+			{
+				Position = PushPosition.load(std::memory_order_relaxed);
+			}
+		}
+
+		Cell->Item = Item;
+		Cell->Sequence.store(Position + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer thread only
+	bool TryPop(T& OutItem)
+	{
+		FCell& Cell = Cells[PopPosition & Mask];
+		const uint64 Sequence = Cell.Sequence.load(std::memory_order_acquire);
+		if ((int64)Sequence - (int64)(PopPosition + 1) < 0)
+		{
+			return false;
+		}
+
+		OutItem = Cell.Item;
+		Cell.Sequence.store(PopPosition + Mask + 1, std::memory_order_release);
+		++PopPosition;
+		return true;
+	}
+
+	// Consumer thread only. Pops up to MaxItems into OutItems, keeping its allocation. Returns the number popped
+	int32 PopAll(TArray<T>& OutItems, int32 MaxItems = MAX_int32)
+	{
+		OutItems.Reset();
+		T Item;
+		while (OutItems.Num() < MaxItems && TryPop(Item))
+		{
+			OutItems.Add(Item);
+		}
+		return OutItems.Num();
+	}
+
+	uint32 GetCapacity() const { return Mask + 1; }
+
+private:
+	struct FCell
+	{
+		std::atomic<uint64> Sequence;
+		T Item;
+	};
+
+	TUniquePtr<FCell[]> Cells;
+	uint32 Mask = 0;
+
+	// Producers and the consumer on separate cache lines
+	alignas(PLATFORM_CACHE_LINE_SIZE) std::atomic<uint64> PushPosition{ 0 };
+	alignas(PLATFORM_CACHE_LINE_SIZE) uint64 PopPosition = 0;
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Recorder/VisibilityRecorder.h"
+
+class IMappedFileHandle;
+class IMappedFileRegion;
+
+// Read-only, memory mapped view of a file written by FVisibilityRecorder. Also opens files of a session that is still
+// recording or crashed: their records up to the last drain are readable, but they have no index and no names
+class VISIBILITYCORE_API FVisibilityRecordReader
+{
+public:
+	FVisibilityRecordReader();
+	~FVisibilityRecordReader();
+
+	bool Open(const FString& Path);
+	void Close();
+
+	const FVisibilityRecordFileHeader& GetHeader() const { return *Header; }
+
+	int64 Num() const { return NumRecords; }
+	const FVisibilityRecord& operator[](int64 Index) const { check(Index >= 0 && Index < NumRecords); return Records[Index]; }
+
+	// Seconds since the recording started
+	double GetSeconds(const FVisibilityRecord& Record) const { return Record.Timestamp * Header->SecondsPerCycle; }
+
+	// Index of the first record delivered on or after FrameNumber, Num() if there is none. Uses the index when there is one
+	int64 FindFirstRecord(uint32 FrameNumber) const;
+
+	// Null for unknown ids, and for every id of an unfinished recording
+	const FString* FindMetricName(uint32 MetricId) const { return MetricNames.Find(MetricId); }
+	const FString* FindSourceName(uint32 SourceId) const { return SourceNames.Find(SourceId); }
+
+private:
+	void ReadNames(const uint8* Begin, const uint8* End);
+
+	TUniquePtr<IMappedFileHandle> Handle;
+	TUniquePtr<IMappedFileRegion> Region;
+
+	const FVisibilityRecordFileHeader* Header = nullptr;
+	const FVisibilityRecord* Records = nullptr;
+	int64 NumRecords = 0;
+	TArrayView<const FVisibilityRecordIndexEntry> Index;
+	TMap<uint32, FString> MetricNames;
+	TMap<uint32, FString> SourceNames;
+};
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include <atomic>
+
+class UTextureRenderTarget;
+
+// Channels kept per record, the shipped metrics use one
+#define VISIBILITY_RECORD_MAX_CHANNELS 4
+
+// One delivered reduction result. Fixed size, written to the log as is
+struct FVisibilityRecord
+{
+	// FPlatformTime::Cycles64 since the recording started, see FVisibilityRecordFileHeader::SecondsPerCycle
+	uint64 Timestamp;
+	// GFrameNumberRenderThread when the readback landed
+	uint32 FrameNumber;
+	// Hash of the metric name and UObject unique id of the input render target, resolved through the name table
+	uint32 MetricId;
+	uint32 SourceId;
+	uint16 NumSlices;
+	uint16 NumChannels;
+	// Summed over every slice, in 64 bits since the sum over a cube's faces can exceed int32. Channels past NumChannels are 0
+	int64 Channels[VISIBILITY_RECORD_MAX_CHANNELS];
+};
+static_assert(sizeof(FVisibilityRecord) == 56, "FVisibilityRecord is part of the log file format");
+
+// Start of a recording file, rewritten in place while recording so a crashed session stays readable.
+//
+// Layout: header, NumRecords FVisibilityRecord, then once the recording is stopped the index
+// (NumIndexEntries FVisibilityRecordIndexEntry, one every IndexInterval records) and the name table
+// (uint32 Count, then per entry uint8 EVisibilityRecordNameKind, uint32 Id, uint16 Length, UTF-8 name).
+// IndexOffset and NamesOffset are 0 until then
+struct FVisibilityRecordFileHeader
+{
+	static constexpr uint32 ExpectedMagic = 0x43455256; // "VREC"
+	// 2: 64 bit channels
+	static constexpr uint32 CurrentVersion = 2;
+
+	uint32 Magic;
+	uint32 Version;
+	uint32 RecordSize;
+	uint32 IndexInterval;
+	uint64 NumRecords;
+	// Records lost because the ring was full
+	uint64 NumDropped;
+	uint64 IndexOffset;
+	uint64 NamesOffset;
+	uint32 NumIndexEntries;
+	uint32 Padding;
+	double SecondsPerCycle;
+};
+static_assert(sizeof(FVisibilityRecordFileHeader) == 64, "FVisibilityRecordFileHeader is part of the log file format");
+
+enum class EVisibilityRecordNameKind : uint8
+{
+	Metric,
+	Source,
+};
+
+// Frame number of every IndexInterval-th record, to seek into long recordings
+struct FVisibilityRecordIndexEntry
+{
+	uint32 FrameNumber;
+	uint32 Padding;
+	uint64 RecordIndex;
+};
+
+// Identifies who a record comes from, built once per dispatch
+struct FVisibilityRecordSource
+{
+	uint32 MetricId = 0;
+	uint32 SourceId = 0;
+};
+
+// Records every delivered reduction result into an append-only memory mapped file, for post-session analysis.
+//
+// The readback completion pushes fixed-size records into a lock-free ring; a background thread drains it into the mapping.
+// Nothing is logged per dispatch. Start and Stop on the game thread, or with the r.VisibilityCore.Recorder.Start <File>
+// and r.VisibilityCore.Recorder.Stop console commands. Read files back with FVisibilityRecordReader
+class VISIBILITYCORE_API FVisibilityRecorder
+{
+public:
+	static bool Start(const FString& Path, uint32 RingCapacity = 1 << 16);
+	static void Stop();
+
+	static bool IsRecording() { return bRecording.load(std::memory_order_acquire); }
+
+	// Game thread, ignored elsewhere. Resolves the path name of a render target the first time it is seen, for the name
+	// table of this and later recordings. Called by FVisibilityReductionInputs when a dispatch is built, whether recording or not
+	static void RegisterSource(const UTextureRenderTarget* InputTexture);
+
+	// Render thread. Ids of a dispatch, registers the name of a new metric. Never touches the render target beyond its id
+	static FVisibilityRecordSource MakeSource(const TCHAR* MetricName, const UTextureRenderTarget* InputTexture);
+
+	// Readback completion. Sums the slices of a reduction output and pushes the record, dropping it if the ring is full
+	static void Record(const FVisibilityRecordSource& Source, int32 NumChannels, const int64* Data, uint32 NumBytes);
+
+	static uint32 GetMetricId(const TCHAR* MetricName);
+
+private:
+	class FWriter;
+
+	static std::atomic<bool> bRecording;
+	static TUniquePtr<FWriter> Writer;
+};
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RenderGraphDefinitions.h"
+
+class FRDGBuilder;
+class FRHIGPUBufferReadback;
+
+// Pooled GPU -> CPU buffer readbacks shared by every reduction pass.
+// Readbacks are recycled instead of allocated per dispatch, and in-flight ones are polled once per frame on the render thread
+// rather than by re-posting a task to the rendering thread until the copy lands.
+class VISIBILITYCORE_API FVisibilityReadbacks
+{
+public:
+	// Called on the render thread with the mapped readback data and its size. The pointer is only valid during the call
+	using FOnReady = TUniqueFunction<void(const int64* Data, uint32 NumBytes)>;
+
+	// Render thread. Adds a copy of the first NumBytes of Buffer into a pooled readback to the graph
+	static void Enqueue(FRDGBuilder& GraphBuilder, FRDGBufferRef Buffer, uint32 NumBytes, FOnReady&& OnReady);
+
+	// Render thread. Completes every readback whose copy has landed. Bound to FCoreDelegates::OnEndFrameRT by the module;
+	// call it directly when driving the renderer without an engine loop, f.e. from a commandlet
+	static void Poll();
+
+	// Drops in-flight readbacks without calling them back and frees the pool
+	static void Shutdown();
+
+	static int32 GetNumInFlight() { return Pending.Num(); }
+
+private:
+	struct FPendingReadback
+	{
+		FRHIGPUBufferReadback* Readback;
+		uint32 NumBytes;
+		FOnReady OnReady;
+	};
+
+	static FRHIGPUBufferReadback* Acquire();
+
+	static TArray<FRHIGPUBufferReadback*> FreeReadbacks;
+	static TArray<FPendingReadback> Pending;
+};
@@ -0,0 +1,448 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Async/Async.h"
+#include "GlobalShader.h"
+#include "ShaderParameterStruct.h"
+#include "RenderGraphBuilder.h"
+#include "RenderingThread.h"
+#include "Engine/TextureRenderTarget.h"
+#include "Engine/TextureRenderTarget2D.h"
+#include "ReductionPass/VisibilityReadbacks.h"
+#include "Coverage/VisibilityCoverage.h"
+#include "Delivery/VisibilityResultStream.h"
+#include "Recorder/VisibilityRecorder.h"
+
+// Framework for metrics that reduce a per-pixel value over a render target into a few integer channels.
+//
+// A metric provides:
+// 1. A .usf that includes "/VisibilityCoreShaders/ReductionPass/VisibilityReductionCommon.ush", defines
+//    bool IsTexelRelevant(int2 Pixel) and void ExtractPixel(int2 Pixel, inout FReductionValues Values),
+//    then includes "/VisibilityCoreShaders/ReductionPass/VisibilityReductionPass.ush"
+// 2. A shader declared with DECLARE_VISIBILITY_REDUCTION_SHADER and implemented with IMPLEMENT_VISIBILITY_REDUCTION_SHADER
+// 3. A traits struct used as TVisibilityReductionPass<TMetric>:
+//
+//	struct FMyMetric
+//	{
+//		using FShader = FMyReductionShader;
+//		using FResult = FMyResult;
+//		static const TCHAR* GetName() { return TEXT("MyMetric"); }
+//		static constexpr ERDGPassFlags PassFlags = ERDGPassFlags::Compute;
+//		static FResult Decode(const int64* Channels, double ScreenArea);
+//	};
+//
+// Decode receives the channels of one slice, or their sum, and the area of the screen in texels they were reduced over,
+// see FVisibilityCoverage. Dividing counts and sums by it makes results independent of the capture resolution.
+//
+// Channels are summed in 64 bits on the GPU, so they do not wrap at any texture size, f.e. a brightness sum of up to 100
+// per texel over an 8K capture. The only 32 bit sum left is the one of a single tile in group shared memory: ExtractPixel
+// must keep every channel of a texel within about 2 million (MAX_int32 / VISIBILITY_REDUCTION_TILE_SIZE^2).
+//
+// The framework generates the flat, tile list and tile classification permutations, builds the RDG passes,
+// reads the channels back through the pooled FVisibilityReadbacks and calls a typed callback on the game thread.
+//
+// Inputs may be 2D render targets, cube render targets or 2D array render targets. Cubes and arrays are reduced in a single
+// dispatch with one group layer per slice (six faces for a cube), and every slice gets its own set of channels.
+
+// Edge of the square tile one reduction group covers, matches TILE_SIZE in VisibilityReductionCommon.ush
+#define VISIBILITY_REDUCTION_TILE_SIZE 32
+
+// Game thread -> render thread inputs of a reduction pass
+struct VISIBILITYCORE_API FVisibilityReductionInputs
+{
+	// Must be a 2D, cube or 2D array RenderTarget. Defines the dispatched extent and slice count
+	UTextureRenderTarget* InputTexture;
+	// Optional second input for metrics that read one, f.e. the camera frame matching a stencil mask.
+	// Must have the same dimension and slice count as InputTexture, it is ignored otherwise
+	UTextureRenderTarget* CameraTexture;
+
+	// Optional InputTexture-space rect holding the rendered view (Max is exclusive), f.e. the viewport of a dynamic resolution
+	// capture. Empty means the whole texture. Texels outside of it are never read
+	FIntRect ViewRect;
+	// Aspect ratio (width / height) of the screen results are relative to, 0 for the aspect of the view rect.
+	// When the screen is wider than the view, only its central rows are reduced, see FVisibilityCoverage
+	float ScreenAspectRatio;
+
+	// Optional InputTexture-space rect to dispatch over (Max is exclusive), clamped to the view rect on the render thread.
+	// It is applied to every slice. It only has to be conservative, see FVisibilityScreenRect
+	FIntRect ScreenRect;
+	bool bRestrictToScreenRect;
+
+	// Runs a coarse pass that lists the tiles holding relevant texels, then reduces only those tiles via an indirect dispatch.
+	// Pays off for mostly empty inputs. Also forced globally by r.VisibilityCore.TileCompaction
+	bool bUseTileCompaction;
+
+	// Snapshots the inputs and result of this reduction into the running frame capture, see FVisibilityFrameCapture
+	bool bCapture;
+
+	FVisibilityReductionInputs(UTextureRenderTarget* InInputTexture = nullptr, UTextureRenderTarget* InCameraTexture = nullptr)
+		: InputTexture(InInputTexture)
+		, CameraTexture(InCameraTexture)
+		, ScreenAspectRatio(0.f)
+		, bRestrictToScreenRect(false)
+		, bUseTileCompaction(false)
+		, bCapture(false)
+	{
+		// Names the input in recordings while the object can still be read safely, see FVisibilityRecorder::RegisterSource
+		FVisibilityRecorder::RegisterSource(InInputTexture);
+	}
+
+	// Area of the screen in texels of one InputTexture slice, see FVisibilityCoverage::GetScreenArea
+	double GetScreenArea() const
+	{
+		return FVisibilityCoverage::GetScreenArea(InputTexture, ViewRect, ScreenAspectRatio);
+	}
+};
+
+BEGIN_SHADER_PARAMETER_STRUCT(FVisibilityReductionParameters, VISIBILITYCORE_API)
+	SHADER_PARAMETER_RDG_TEXTURE(Texture2D, InputTexture)
+	SHADER_PARAMETER_RDG_TEXTURE(Texture2D, CameraTexture)
+	// Cube and 2D array inputs, viewed as Texture2DArray by the TEXTURE_ARRAY_INPUT permutation
+	SHADER_PARAMETER_RDG_TEXTURE_SRV(Texture2DArray, InputTextureArray)
+	SHADER_PARAMETER_RDG_TEXTURE_SRV(Texture2DArray, CameraTextureArray)
+	// Dispatched pixel rect, already clamped to the InputTexture extent. Max is exclusive
+	SHADER_PARAMETER(FIntPoint, RectMin)
+	SHADER_PARAMETER(FIntPoint, RectMax)
+	// NumChannels int64 per slice, each written as a (low, high) uint pair
+	SHADER_PARAMETER_RDG_BUFFER_UAV(RWBuffer<uint>, ReductionOutput)
+	// Tile compaction. TileList is read by the USE_TILE_LIST permutation, the RW views are written by the classify pass
+	SHADER_PARAMETER_RDG_BUFFER_SRV(Buffer<uint>, TileList)
+	SHADER_PARAMETER_RDG_BUFFER_UAV(RWBuffer<uint>, RWTileList)
+	SHADER_PARAMETER_RDG_BUFFER_UAV(RWBuffer<uint>, RWTileIndirectArgs)
+	RDG_BUFFER_ACCESS(TileIndirectArgs, ERHIAccess::IndirectArgs)
+END_SHADER_PARAMETER_STRUCT()
+
+// Base of every metric's reduction shader. Carries the shared parameters and permutations, but is never compiled on its own
+class VISIBILITYCORE_API FVisibilityReductionShader : public FGlobalShader
+{
+public:
+	using FParameters = FVisibilityReductionParameters;
+
+	// Reads its tile from the compacted tile list instead of covering the whole rect
+	class FTileListDim : SHADER_PERMUTATION_BOOL("USE_TILE_LIST");
+	// Compiles the coarse tile classification kernel instead of the reduction
+	class FClassifyPassDim : SHADER_PERMUTATION_BOOL("VISIBILITY_CLASSIFY_PASS");
+	// Reads cube and 2D array inputs slice by slice
+	class FTextureArrayDim : SHADER_PERMUTATION_BOOL("TEXTURE_ARRAY_INPUT");
+	using FPermutationDomain = TShaderPermutationDomain<FTileListDim, FClassifyPassDim, FTextureArrayDim>;
+
+	FVisibilityReductionShader() {}
+	FVisibilityReductionShader(const ShaderMetaType::CompiledShaderInitializerType& Initializer)
+		: FGlobalShader(Initializer)
+	{
+	}
+
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
+	{
+		const FPermutationDomain PermutationVector(Parameters.PermutationId);
+
+		// The classification pass always covers the whole rect
+		return !(PermutationVector.Get<FClassifyPassDim>() && PermutationVector.Get<FTileListDim>());
+	}
+
+	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+	{
+		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+		OutEnvironment.SetDefine(TEXT("TILE_SIZE"), VISIBILITY_REDUCTION_TILE_SIZE);
+	}
+};
+
+// Declares a metric's reduction shader reducing into NumChannels int channels
+#define DECLARE_VISIBILITY_REDUCTION_SHADER(ShaderClass, InNumChannels) \
+	class ShaderClass : public FVisibilityReductionShader \
+	{ \
+	public: \
+		DECLARE_GLOBAL_SHADER(ShaderClass); \
+		SHADER_USE_PARAMETER_STRUCT(ShaderClass, FVisibilityReductionShader); \
+		\
+		static constexpr int32 NumChannels = InNumChannels; \
+		\
+		static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment) \
+		{ \
+			FVisibilityReductionShader::ModifyCompilationEnvironment(Parameters, OutEnvironment); \
+			OutEnvironment.SetDefine(TEXT("VISIBILITY_REDUCTION_CHANNELS"), NumChannels); \
+		} \
+	};
+
+// Binds a metric's reduction shader to its .usf. The entry point is defined by VisibilityReductionPass.ush
+#define IMPLEMENT_VISIBILITY_REDUCTION_SHADER(ShaderClass, ShaderPath) \
+	IMPLEMENT_GLOBAL_SHADER(ShaderClass, ShaderPath, "MainCS", SF_Compute)
+
+// The permutations of one metric's reduction shader, indexed by whether the input is a texture array
+struct VISIBILITYCORE_API FVisibilityReductionShaders
+{
+	TShaderRef<FVisibilityReductionShader> Reduce[2];
+	TShaderRef<FVisibilityReductionShader> ReduceTiles[2];
+	TShaderRef<FVisibilityReductionShader> Classify[2];
+	int32 NumChannels = 0;
+
+	template<typename TShader>
+	static FVisibilityReductionShaders Get(ERHIFeatureLevel::Type FeatureLevel)
+	{
+		FGlobalShaderMap* ShaderMap = GetGlobalShaderMap(FeatureLevel);
+		FVisibilityReductionShaders Shaders;
+
+		for (int32 TextureArray = 0; TextureArray < 2; ++TextureArray)
+		{
+			FVisibilityReductionShader::FPermutationDomain PermutationVector;
+			PermutationVector.Set<FVisibilityReductionShader::FTextureArrayDim>(TextureArray != 0);
+			Shaders.Reduce[TextureArray] = TShaderMapRef<TShader>(ShaderMap, PermutationVector);
+
+			PermutationVector.Set<FVisibilityReductionShader::FTileListDim>(true);
+			Shaders.ReduceTiles[TextureArray] = TShaderMapRef<TShader>(ShaderMap, PermutationVector);
+
+			PermutationVector.Set<FVisibilityReductionShader::FTileListDim>(false);
+			PermutationVector.Set<FVisibilityReductionShader::FClassifyPassDim>(true);
+			Shaders.Classify[TextureArray] = TShaderMapRef<TShader>(ShaderMap, PermutationVector);
+		}
+
+		Shaders.NumChannels = TShader::NumChannels;
+		return Shaders;
+	}
+};
+
+// Output of FVisibilityReductionPassBuilder::AddPasses
+struct FVisibilityReductionOutput
+{
+	// NumChannels int64 per slice, slice after slice
+	FRDGBufferRef Buffer = nullptr;
+	int32 NumSlices = 0;
+};
+
+// Non-templated part of the framework, shared by every metric
+class VISIBILITYCORE_API FVisibilityReductionPassBuilder
+{
+public:
+	// Adds the clear, the optional tile classification and the reduction passes to an existing graph.
+	// The returned buffer is null when the inputs can't be registered
+	static FVisibilityReductionOutput AddPasses(
+		FRDGBuilder& GraphBuilder,
+		const FVisibilityReductionInputs& Inputs,
+		const FVisibilityReductionShaders& Shaders,
+		ERDGPassFlags PassFlags
+	);
+
+	// Adds a reduction to an existing graph and reads the channels of every slice back with one readback.
+	// OnReady is called on the render thread. Returns false, and never calls OnReady, if the shaders or inputs are invalid
+	static bool AddReduction(
+		FRDGBuilder& GraphBuilder,
+		const FVisibilityReductionInputs& Inputs,
+		const FVisibilityReductionShaders& Shaders,
+		const TCHAR* MetricName,
+		ERDGPassFlags PassFlags,
+		FVisibilityReadbacks::FOnReady&& OnReady
+	);
+
+	// Builds and executes a graph holding a single AddReduction
+	static bool Execute(
+		FRHICommandListImmediate& RHICmdList,
+		const FVisibilityReductionInputs& Inputs,
+		const FVisibilityReductionShaders& Shaders,
+		const TCHAR* MetricName,
+		ERDGPassFlags PassFlags,
+		FVisibilityReadbacks::FOnReady&& OnReady
+	);
+
+	// Wraps an existing 2D, cube or 2D array render target into the graph
+	static FRDGTextureRef RegisterRenderTarget(UTextureRenderTarget* RenderTarget, FRDGBuilder& GraphBuilder, const TCHAR* Name);
+
+	// Number of 2D slices the reduction runs over: 1 for 2D textures, 6 per cube, the array size for 2D arrays
+	static int32 GetNumSlices(const FRDGTextureDesc& Desc);
+};
+
+// Type erased description of a metric, for code that handles several metrics at once such as FVisibilityRequests.
+// One instance per metric, returned by TVisibilityReductionPass<TMetric>::GetMetric
+struct VISIBILITYCORE_API FVisibilityReductionMetric
+{
+	const TCHAR* Name;
+	ERDGPassFlags PassFlags;
+	int32 NumChannels;
+	FVisibilityReductionShaders (*GetShaders)(ERHIFeatureLevel::Type FeatureLevel);
+
+	// Metrics registered with IMPLEMENT_VISIBILITY_REDUCTION_METRIC, by name. Null for unknown or unloaded metrics
+	static const FVisibilityReductionMetric* Find(const FString& Name);
+	static void Register(const FVisibilityReductionMetric& Metric);
+	static void Unregister(const FVisibilityReductionMetric& Metric);
+};
+
+// Registers a metric while its module is loaded, for tools that find metrics by name such as the VisibilityReplay commandlet
+struct FVisibilityReductionMetricRegistration
+{
+	const FVisibilityReductionMetric& Metric;
+
+	explicit FVisibilityReductionMetricRegistration(const FVisibilityReductionMetric& InMetric)
+		: Metric(InMetric)
+	{
+		FVisibilityReductionMetric::Register(Metric);
+	}
+
+	~FVisibilityReductionMetricRegistration()
+	{
+		FVisibilityReductionMetric::Unregister(Metric);
+	}
+};
+
+#define IMPLEMENT_VISIBILITY_REDUCTION_METRIC(MetricStruct) \
+	static FVisibilityReductionMetricRegistration MetricStruct##Registration(TVisibilityReductionPass<MetricStruct>::GetMetric());
+
+// Typed front end of the framework for one metric
+template<typename TMetric>
+class TVisibilityReductionPass
+{
+public:
+	using FShader = typename TMetric::FShader;
+	using FResult = typename TMetric::FResult;
+	// Receives the result summed over every slice
+	using FCallback = TFunction<void(const FResult& Result)>;
+	// Receives one result per slice (cube faces in +X, -X, +Y, -Y, +Z, -Z order) and their sum
+	using FSlicesCallback = TFunction<void(const TArray<FResult>& SliceResults, const FResult& Total)>;
+	// Receives results from the render thread without a game thread task each, see DispatchToStream
+	using FStream = TVisibilityResultStream<FResult>;
+
+	// Executes the reduction on the render thread, AsyncCallback is called on the game thread
+	static void DispatchRenderThread(FRHICommandListImmediate& RHICmdList, const FVisibilityReductionInputs& Inputs, FCallback AsyncCallback)
+	{
+		const double ScreenArea = Inputs.GetScreenArea();
+		FVisibilityReductionPassBuilder::Execute(
+			RHICmdList,
+			Inputs,
+			FVisibilityReductionShaders::Get<FShader>(GMaxRHIFeatureLevel),
+			TMetric::GetName(),
+			TMetric::PassFlags,
+			[AsyncCallback = MoveTemp(AsyncCallback), ScreenArea](const int64* Data, uint32 NumBytes)
+			{
+				AsyncTask(ENamedThreads::GameThread, [AsyncCallback, Result = DecodeTotal(Data, NumBytes, ScreenArea)]()
+				{
+					AsyncCallback(Result);
+				});
+			});
+	}
+
+	// Same as DispatchRenderThread, with per slice results for cube and array inputs
+	static void DispatchSlicesRenderThread(FRHICommandListImmediate& RHICmdList, const FVisibilityReductionInputs& Inputs, FSlicesCallback AsyncCallback)
+	{
+		const double ScreenArea = Inputs.GetScreenArea();
+		FVisibilityReductionPassBuilder::Execute(
+			RHICmdList,
+			Inputs,
+			FVisibilityReductionShaders::Get<FShader>(GMaxRHIFeatureLevel),
+			TMetric::GetName(),
+			TMetric::PassFlags,
+			[AsyncCallback = MoveTemp(AsyncCallback), ScreenArea](const int64* Data, uint32 NumBytes)
+			{
+				TArray<FResult> SliceResults;
+				DecodeSlices(Data, NumBytes, ScreenArea, SliceResults);
+
+				AsyncTask(ENamedThreads::GameThread, [AsyncCallback, SliceResults = MoveTemp(SliceResults), Total = DecodeTotal(Data, NumBytes, ScreenArea)]()
+				{
+					AsyncCallback(SliceResults, Total);
+				});
+			});
+	}
+
+	// Executes the reduction on the render thread and pushes its result, summed over every slice, into Stream from the render
+	// thread as the readback lands. No game thread task per result, see TVisibilityResultStream
+	static void DispatchToStreamRenderThread(FRHICommandListImmediate& RHICmdList, const FVisibilityReductionInputs& Inputs, const TSharedRef<FStream, ESPMode::ThreadSafe>& Stream, uint64 Tag)
+	{
+		const double ScreenArea = Inputs.GetScreenArea();
+		FVisibilityReductionPassBuilder::Execute(
+			RHICmdList,
+			Inputs,
+			FVisibilityReductionShaders::Get<FShader>(GMaxRHIFeatureLevel),
+			TMetric::GetName(),
+			TMetric::PassFlags,
+			[Stream, Tag, ScreenArea](const int64* Data, uint32 NumBytes)
+			{
+				Stream->Push({ Tag, GFrameNumberRenderThread, DecodeTotal(Data, NumBytes, ScreenArea) });
+			});
+	}
+
+	// Dispatches the stream variant from any thread
+	static void DispatchToStream(const FVisibilityReductionInputs& Inputs, const TSharedRef<FStream, ESPMode::ThreadSafe>& Stream, uint64 Tag)
+	{
+		if (IsInRenderingThread())
+		{
+			DispatchToStreamRenderThread(GetImmediateCommandList_ForRenderCommand(), Inputs, Stream, Tag);
+		}
+		else
+		{
+			ENQUEUE_RENDER_COMMAND(VisibilityReductionStream)(
+				[Inputs, Stream, Tag](FRHICommandListImmediate& RHICmdList)
+				{
+					DispatchToStreamRenderThread(RHICmdList, Inputs, Stream, Tag);
+				});
+		}
+	}
+
+	// Executes the reduction from the game thread via EnqueueRenderThreadCommand
+	static void DispatchGameThread(const FVisibilityReductionInputs& Inputs, FCallback AsyncCallback)
+	{
+		ENQUEUE_RENDER_COMMAND(VisibilityReduction)(
+			[Inputs, AsyncCallback = MoveTemp(AsyncCallback)](FRHICommandListImmediate& RHICmdList) mutable
+			{
+				DispatchRenderThread(RHICmdList, Inputs, MoveTemp(AsyncCallback));
+			});
+	}
+
+	// Dispatches the reduction from any thread
+	static void Dispatch(const FVisibilityReductionInputs& Inputs, FCallback AsyncCallback)
+	{
+		if (IsInRenderingThread())
+		{
+			DispatchRenderThread(GetImmediateCommandList_ForRenderCommand(), Inputs, MoveTemp(AsyncCallback));
+		}
+		else
+		{
+			DispatchGameThread(Inputs, MoveTemp(AsyncCallback));
+		}
+	}
+
+	// Dispatches the per slice reduction from any thread
+	static void DispatchSlices(const FVisibilityReductionInputs& Inputs, FSlicesCallback AsyncCallback)
+	{
+		if (IsInRenderingThread())
+		{
+			DispatchSlicesRenderThread(GetImmediateCommandList_ForRenderCommand(), Inputs, MoveTemp(AsyncCallback));
+		}
+		else
+		{
+			ENQUEUE_RENDER_COMMAND(VisibilityReductionSlices)(
+				[Inputs, AsyncCallback = MoveTemp(AsyncCallback)](FRHICommandListImmediate& RHICmdList) mutable
+				{
+					DispatchSlicesRenderThread(RHICmdList, Inputs, MoveTemp(AsyncCallback));
+				});
+		}
+	}
+
+	static const FVisibilityReductionMetric& GetMetric()
+	{
+		static const FVisibilityReductionMetric Metric = { TMetric::GetName(), TMetric::PassFlags, FShader::NumChannels, &FVisibilityReductionShaders::Get<FShader> };
+		return Metric;
+	}
+
+	// Decodes the channels of every slice. ScreenArea is the one of a single slice, see FVisibilityReductionInputs::GetScreenArea
+	static void DecodeSlices(const int64* Data, uint32 NumBytes, double ScreenArea, TArray<FResult>& OutSliceResults)
+	{
+		const int32 NumSlices = NumBytes / (FShader::NumChannels * sizeof(int64));
+		OutSliceResults.Reset(NumSlices);
+		for (int32 Slice = 0; Slice < NumSlices; ++Slice)
+		{
+			OutSliceResults.Add(TMetric::Decode(Data + Slice * FShader::NumChannels, ScreenArea));
+		}
+	}
+
+	// Sums the channels of every slice and decodes them. Normalized values of the total are the mean over the slices
+	static FResult DecodeTotal(const int64* Data, uint32 NumBytes, double ScreenArea)
+	{
+		const int32 NumSlices = NumBytes / (FShader::NumChannels * sizeof(int64));
+		int64 Total[FShader::NumChannels] = {};
+		for (int32 Slice = 0; Slice < NumSlices; ++Slice)
+		{
+			for (int32 Channel = 0; Channel < FShader::NumChannels; ++Channel)
+			{
+				Total[Channel] += Data[Slice * FShader::NumChannels + Channel];
+			}
+		}
+		return TMetric::Decode(Total, ScreenArea * NumSlices);
+	}
+};
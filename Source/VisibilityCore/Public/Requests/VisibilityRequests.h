@@ -0,0 +1,246 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Async/Future.h"
+#include "ReductionPass/VisibilityReductionPass.h"
+
+// Pooled, coalescing request API on top of the reduction pass framework.
+//
+// Requests are made on the game thread and queued until the end of the frame. Requests for the same metric, render targets
+// and options made in the same frame share one dispatch and one readback, whose result fans out to every waiter.
+// All queued requests of a frame are built into a single render graph.
+//
+// Request and batch storage is pooled here, so a polled request costs no allocation once the pools are warm.
+// Completion callbacks and futures are delivered on the game thread, at the end of the frame their readback lands.
+
+// Refers to one pooled request. Handles of completed, released or cancelled requests go stale and are detected
+struct FVisibilityRequestHandle
+{
+	int32 Index = INDEX_NONE;
+	uint32 Generation = 0;
+
+	bool IsValid() const { return Index != INDEX_NONE; }
+};
+
+enum class EVisibilityRequestStatus : uint8
+{
+	// Stale or never issued handle
+	Invalid,
+	// Queued or in flight
+	Pending,
+	// The result can be read
+	Ready,
+	// The render targets were destroyed or the shaders are invalid
+	Failed,
+};
+
+// Non-templated part of the request API. Game thread only
+class VISIBILITYCORE_API FVisibilityRequests
+{
+public:
+	// Called on the game thread with every slice's channels, see FVisibilityReductionOutput.
+	// Data is null when the request failed or was cancelled. The pointer is only valid during the call
+	using FOnComplete = TUniqueFunction<void(const int64* Data, uint32 NumBytes)>;
+
+	// Queues a request. With OnComplete, it is called exactly once and the handle is released afterwards, only usable to Cancel.
+	// With an Owner, OnComplete is dropped instead if the Owner has been garbage collected by then.
+	// Without OnComplete, poll the handle with GetStatus / GetData and Release it when done
+	static FVisibilityRequestHandle Request(const FVisibilityReductionMetric& Metric, const FVisibilityReductionInputs& Inputs, FOnComplete&& OnComplete = nullptr, const UObject* Owner = nullptr);
+
+	// Cancels a pending request, calling its OnComplete with null data right away. A batch without waiters left is not dispatched,
+	// or its result is discarded if it is already in flight. Cancelling a Ready or Failed request releases it.
+	// Returns false for stale handles
+	static bool Cancel(FVisibilityRequestHandle Handle);
+
+	static EVisibilityRequestStatus GetStatus(FVisibilityRequestHandle Handle);
+
+	// Channels of a Ready request, valid until it is released, and the screen area of one slice they were reduced over
+	static bool GetData(FVisibilityRequestHandle Handle, const int64*& OutData, uint32& OutNumBytes, double* OutScreenArea = nullptr);
+
+	// Returns a polled request to the pool
+	static void Release(FVisibilityRequestHandle Handle);
+
+	// Delivers landed results, then dispatches the requests queued this frame. Bound to FCoreDelegates::OnEndFrame by the module;
+	// call it directly when driving the engine without a game loop, together with FVisibilityReadbacks::Poll
+	static void Tick();
+
+	// Calls every outstanding callback back as failed, like Cancel, and frees the pools
+	static void Shutdown();
+
+	static int32 GetNumQueued() { return QueuedBatches.Num(); }
+
+private:
+	// Identifies requests that can share a dispatch
+	struct FBatchKey
+	{
+		const FVisibilityReductionMetric* Metric;
+		const UTextureRenderTarget* InputTexture;
+		const UTextureRenderTarget* CameraTexture;
+		FIntRect ViewRect;
+		float ScreenAspectRatio;
+		FIntRect ScreenRect;
+		bool bRestrictToScreenRect;
+		bool bUseTileCompaction;
+
+		bool operator==(const FBatchKey& Other) const
+		{
+			return Metric == Other.Metric && InputTexture == Other.InputTexture && CameraTexture == Other.CameraTexture
+				&& ViewRect == Other.ViewRect && ScreenAspectRatio == Other.ScreenAspectRatio
+				&& ScreenRect == Other.ScreenRect && bRestrictToScreenRect == Other.bRestrictToScreenRect && bUseTileCompaction == Other.bUseTileCompaction;
+		}
+
+		friend uint32 GetTypeHash(const FBatchKey& Key)
+		{
+			uint32 Hash = HashCombine(PointerHash(Key.Metric), PointerHash(Key.InputTexture));
+			Hash = HashCombine(Hash, PointerHash(Key.CameraTexture));
+			Hash = HashCombine(Hash, GetTypeHash(Key.ViewRect.Min));
+			Hash = HashCombine(Hash, GetTypeHash(Key.ViewRect.Max));
+			Hash = HashCombine(Hash, GetTypeHash(Key.ScreenAspectRatio));
+			Hash = HashCombine(Hash, GetTypeHash(Key.ScreenRect.Min));
+			Hash = HashCombine(Hash, GetTypeHash(Key.ScreenRect.Max));
+			return HashCombine(Hash, (uint32)Key.bRestrictToScreenRect | ((uint32)Key.bUseTileCompaction << 1));
+		}
+	};
+
+	// One dispatch shared by every waiter of the same frame. Heap allocated once per pool slot, so the render thread
+	// can write to it while the game thread grows the pool
+	struct FBatch
+	{
+		const FVisibilityReductionMetric* Metric = nullptr;
+		FVisibilityReductionInputs Inputs;
+		TWeakObjectPtr<UTextureRenderTarget> InputTexture;
+		TWeakObjectPtr<UTextureRenderTarget> CameraTexture;
+		// Of one slice, taken when the batch is queued
+		double ScreenArea = 0.0;
+		// Written by the render thread while in flight, read by the game thread once delivered. Capacity is kept across uses
+		TArray<int64> Data;
+		// Only changed on the game thread, stays Pending while in flight
+		EVisibilityRequestStatus Status = EVisibilityRequestStatus::Invalid;
+		TArray<int32, TInlineAllocator<4>> WaiterIndices;
+		// Waiters plus one while in flight
+		int32 NumRefs = 0;
+		bool bQueued = false;
+	};
+
+	struct FWaiter
+	{
+		uint32 Generation = 0;
+		// INDEX_NONE while the slot is free
+		int32 BatchIndex = INDEX_NONE;
+		FOnComplete OnComplete;
+		TWeakObjectPtr<const UObject> Owner;
+		bool bHasOwner = false;
+	};
+
+	static void Deliver();
+	static void Flush();
+
+	static FBatchKey MakeKey(const FVisibilityReductionMetric& Metric, const FVisibilityReductionInputs& Inputs);
+	static int32 AllocateBatch(const FVisibilityReductionMetric& Metric, const FVisibilityReductionInputs& Inputs);
+	static void ReleaseBatchRef(int32 BatchIndex);
+	static FWaiter* FindWaiter(FVisibilityRequestHandle Handle);
+	static void FreeWaiter(int32 WaiterIndex);
+
+	// Any thread. Hands a batch over to the next Deliver, which applies Status on the game thread
+	static void Complete(int32 BatchIndex, EVisibilityRequestStatus Status);
+
+	static TIndirectArray<FBatch> Batches;
+	static TArray<int32> FreeBatches;
+	static TArray<FWaiter> Waiters;
+	static TArray<int32> FreeWaiters;
+	// Batches queued this frame, in request order
+	static TArray<int32> QueuedBatches;
+	static TMap<FBatchKey, int32> QueuedBatchMap;
+	// Written by the render thread, drained by Deliver
+	static TArray<TPair<int32, EVisibilityRequestStatus>> CompletedBatches;
+	static TArray<TPair<int32, EVisibilityRequestStatus>> DeliveringBatches;
+	static FCriticalSection CompletedLock;
+};
+
+// Typed front end of the request API for one metric, see TVisibilityReductionPass. Game thread only
+template<typename TMetric>
+class TVisibilityRequests
+{
+public:
+	using FResult = typename TMetric::FResult;
+	// bSuccess is false when the request failed or was cancelled, Result is default constructed then
+	using FOnComplete = TUniqueFunction<void(bool bSuccess, const FResult& Result)>;
+
+	// Polled request, see Poll
+	static FVisibilityRequestHandle Request(const FVisibilityReductionInputs& Inputs)
+	{
+		return FVisibilityRequests::Request(TVisibilityReductionPass<TMetric>::GetMetric(), Inputs);
+	}
+
+	// OnComplete receives the result summed over every slice
+	static FVisibilityRequestHandle Request(const FVisibilityReductionInputs& Inputs, FOnComplete&& OnComplete, const UObject* Owner = nullptr)
+	{
+		return FVisibilityRequests::Request(TVisibilityReductionPass<TMetric>::GetMetric(), Inputs,
+			[OnComplete = MoveTemp(OnComplete), ScreenArea = Inputs.GetScreenArea()](const int64* Data, uint32 NumBytes) mutable
+			{
+				OnComplete(Data != nullptr, Data ? TVisibilityReductionPass<TMetric>::DecodeTotal(Data, NumBytes, ScreenArea) : FResult());
+			},
+			Owner);
+	}
+
+	// The future is set to an unset optional when the request failed, was cancelled or the module shut down first
+	static TFuture<TOptional<FResult>> RequestFuture(const FVisibilityReductionInputs& Inputs, FVisibilityRequestHandle* OutHandle = nullptr)
+	{
+		TPromise<TOptional<FResult>> Promise;
+		TFuture<TOptional<FResult>> Future = Promise.GetFuture();
+
+		const FVisibilityRequestHandle Handle = FVisibilityRequests::Request(TVisibilityReductionPass<TMetric>::GetMetric(), Inputs,
+			[Promise = MoveTemp(Promise), ScreenArea = Inputs.GetScreenArea()](const int64* Data, uint32 NumBytes) mutable
+			{
+				Promise.SetValue(Data ? TOptional<FResult>(TVisibilityReductionPass<TMetric>::DecodeTotal(Data, NumBytes, ScreenArea)) : TOptional<FResult>());
+			});
+		if (OutHandle)
+		{
+			*OutHandle = Handle;
+		}
+		return Future;
+	}
+
+	// Returns the status of a polled request. Ready requests write their total to OutResult; Ready and Failed requests
+	// are released and Handle is reset
+	static EVisibilityRequestStatus Poll(FVisibilityRequestHandle& Handle, FResult& OutResult)
+	{
+		return PollInternal(Handle, OutResult, nullptr);
+	}
+
+	// Poll with per slice results for cube and array inputs
+	static EVisibilityRequestStatus PollSlices(FVisibilityRequestHandle& Handle, TArray<FResult>& OutSliceResults, FResult& OutTotal)
+	{
+		return PollInternal(Handle, OutTotal, &OutSliceResults);
+	}
+
+	static bool Cancel(FVisibilityRequestHandle Handle)
+	{
+		return FVisibilityRequests::Cancel(Handle);
+	}
+
+private:
+	static EVisibilityRequestStatus PollInternal(FVisibilityRequestHandle& Handle, FResult& OutTotal, TArray<FResult>* OutSliceResults)
+	{
+		const EVisibilityRequestStatus Status = FVisibilityRequests::GetStatus(Handle);
+
+		const int64* Data = nullptr;
+		uint32 NumBytes = 0;
+		double ScreenArea = 0.0;
+		if (Status == EVisibilityRequestStatus::Ready && FVisibilityRequests::GetData(Handle, Data, NumBytes, &ScreenArea))
+		{
+			OutTotal = TVisibilityReductionPass<TMetric>::DecodeTotal(Data, NumBytes, ScreenArea);
+			if (OutSliceResults)
+			{
+				TVisibilityReductionPass<TMetric>::DecodeSlices(Data, NumBytes, ScreenArea, *OutSliceResults);
+			}
+		}
+
+		if (Status == EVisibilityRequestStatus::Ready || Status == EVisibilityRequestStatus::Failed)
+		{
+			FVisibilityRequests::Release(Handle);
+			Handle = FVisibilityRequestHandle();
+		}
+		return Status;
+	}
+};
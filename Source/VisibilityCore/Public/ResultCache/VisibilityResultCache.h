@@ -0,0 +1,161 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/ObjectKey.h"
+#include "Requests/VisibilityRequests.h"
+
+class AActor;
+class USceneCaptureComponent2D;
+
+// Everything a cached result depends on, snapshotted when it is requested
+struct VISIBILITYCORE_API FVisibilityCacheState
+{
+	FTransform ActorTransform;
+	bool bActorVisible = false;
+	// View projection of the capture that renders the measured target, identity without a capture
+	FMatrix ViewProjectionMatrix = FMatrix::Identity;
+	uint64 SceneEpoch = 0;
+
+	bool Matches(const FVisibilityCacheState& Other) const;
+};
+
+// Result cache in front of FVisibilityRequests, for actors and captures that stay still for long stretches.
+//
+// A request is served from the cache, synchronously on the game thread, when the actor transform and visibility, the
+// capture's view projection and the scene epoch all match the cached result and it is younger than the max age
+// (r.VisibilityCore.Cache.MaxAge). Anything else the capture sees is not tracked: call InvalidateAll when the scene
+// changes in a way that matters, f.e. a moving occluder or a light change. Streaming levels in and out does it already.
+// Misses that match a request already in flight wait for it instead of dispatching again. Game thread only
+class VISIBILITYCORE_API FVisibilityResultCache
+{
+public:
+	struct FStats
+	{
+		uint64 NumHits = 0;
+		// Misses that waited for a request already in flight
+		uint64 NumJoined = 0;
+		// Misses that dispatched
+		uint64 NumMisses = 0;
+		int32 NumEntries = 0;
+	};
+
+	// Returns true on a hit, OnComplete has been called then. Otherwise OnComplete is called once the measurement lands,
+	// see FVisibilityRequests::Request. MaxAge in seconds, negative uses r.VisibilityCore.Cache.MaxAge, 0 bypasses the cache
+	static bool Request(
+		const FVisibilityReductionMetric& Metric,
+		const FVisibilityReductionInputs& Inputs,
+		const AActor* Actor,
+		const USceneCaptureComponent2D* Capture,
+		FVisibilityRequests::FOnComplete&& OnComplete,
+		const UObject* Owner = nullptr,
+		float MaxAge = -1.f
+	);
+
+	// Every cached result goes stale
+	static void InvalidateAll();
+	static uint64 GetSceneEpoch() { return SceneEpoch; }
+
+	static FVisibilityCacheState CaptureState(const AActor* Actor, const USceneCaptureComponent2D* Capture, const UTextureRenderTarget* Texture);
+
+	static FStats GetStats();
+	static void ResetStats();
+
+	// Bound by the module. Purges entries whose objects are gone or that have not been used for a while
+	static void Startup();
+	static void Tick();
+	static void Shutdown();
+
+private:
+	struct FKey
+	{
+		const FVisibilityReductionMetric* Metric;
+		TObjectKey<UTextureRenderTarget> InputTexture;
+		TObjectKey<UTextureRenderTarget> CameraTexture;
+		TObjectKey<AActor> Actor;
+		TObjectKey<USceneCaptureComponent2D> Capture;
+		FIntRect ViewRect;
+		float ScreenAspectRatio;
+		FIntRect ScreenRect;
+		bool bRestrictToScreenRect;
+		bool bUseTileCompaction;
+
+		bool operator==(const FKey& Other) const
+		{
+			return Metric == Other.Metric && InputTexture == Other.InputTexture && CameraTexture == Other.CameraTexture
+				&& Actor == Other.Actor && Capture == Other.Capture && ViewRect == Other.ViewRect
+				&& ScreenAspectRatio == Other.ScreenAspectRatio && ScreenRect == Other.ScreenRect
+				&& bRestrictToScreenRect == Other.bRestrictToScreenRect && bUseTileCompaction == Other.bUseTileCompaction;
+		}
+
+		friend uint32 GetTypeHash(const FKey& Key)
+		{
+			uint32 Hash = HashCombine(PointerHash(Key.Metric), GetTypeHash(Key.InputTexture));
+			Hash = HashCombine(Hash, GetTypeHash(Key.CameraTexture));
+			Hash = HashCombine(Hash, GetTypeHash(Key.Actor));
+			Hash = HashCombine(Hash, GetTypeHash(Key.Capture));
+			Hash = HashCombine(Hash, GetTypeHash(Key.ViewRect.Min));
+			Hash = HashCombine(Hash, GetTypeHash(Key.ViewRect.Max));
+			Hash = HashCombine(Hash, GetTypeHash(Key.ScreenAspectRatio));
+			Hash = HashCombine(Hash, GetTypeHash(Key.ScreenRect.Min));
+			Hash = HashCombine(Hash, GetTypeHash(Key.ScreenRect.Max));
+			return HashCombine(Hash, (uint32)Key.bRestrictToScreenRect | ((uint32)Key.bUseTileCompaction << 1));
+		}
+	};
+
+	struct FWaiter
+	{
+		// The request this waiter is waiting for
+		uint32 Serial;
+		FVisibilityRequests::FOnComplete OnComplete;
+		TWeakObjectPtr<const UObject> Owner;
+		bool bHasOwner;
+	};
+
+	struct FEntry
+	{
+		FVisibilityCacheState State;
+		TArray<int64> Data;
+		// When the cached result was requested
+		double Time = 0.0;
+		bool bHasData = false;
+
+		// Latest request issued for this entry
+		uint32 PendingSerial = 0;
+		bool bPending = false;
+		FVisibilityCacheState PendingState;
+		double PendingTime = 0.0;
+		TArray<FWaiter> Waiters;
+
+		double LastUsedTime = 0.0;
+	};
+
+	static void OnRequestComplete(const FKey& Key, uint32 Serial, const int64* Data, uint32 NumBytes);
+
+	static TMap<FKey, FEntry> Entries;
+	static uint64 SceneEpoch;
+	static uint32 NextSerial;
+	static FStats Stats;
+	static double LastPurgeTime;
+	static FDelegateHandle LevelAddedHandle;
+	static FDelegateHandle LevelRemovedHandle;
+};
+
+// Typed front end of the cache for one metric, see TVisibilityRequests
+template<typename TMetric>
+class TVisibilityCachedRequests
+{
+public:
+	using FResult = typename TMetric::FResult;
+	using FOnComplete = typename TVisibilityRequests<TMetric>::FOnComplete;
+
+	// Returns true when served from the cache, OnComplete has been called then
+	static bool Request(const FVisibilityReductionInputs& Inputs, const AActor* Actor, const USceneCaptureComponent2D* Capture, FOnComplete&& OnComplete, const UObject* Owner = nullptr, float MaxAge = -1.f)
+	{
+		return FVisibilityResultCache::Request(TVisibilityReductionPass<TMetric>::GetMetric(), Inputs, Actor, Capture,
+			[OnComplete = MoveTemp(OnComplete), ScreenArea = Inputs.GetScreenArea()](const int64* Data, uint32 NumBytes) mutable
+			{
+				OnComplete(Data != nullptr, Data ? TVisibilityReductionPass<TMetric>::DecodeTotal(Data, NumBytes, ScreenArea) : FResult());
+			},
+			Owner, MaxAge);
+	}
+};
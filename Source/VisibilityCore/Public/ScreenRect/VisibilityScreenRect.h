@@ -0,0 +1,21 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+class AActor;
+class USceneCaptureComponent2D;
+
+// Game thread helpers that project world bounds into a conservative, padded pixel rect of a capture target,
+// used to restrict reduction passes to the part of the screen an object can cover
+struct VISIBILITYCORE_API FVisibilityScreenRect
+{
+	// Returns false when the bounds can't be enclosed on screen (f.e. they cross the near plane) and a full dispatch is needed.
+	// A true return with an empty rect means the bounds are entirely off screen
+	static bool Compute(const FBox& WorldBounds, const FMatrix& ViewProjectionMatrix, FIntPoint TextureSize, FIntRect& OutRect, int32 Padding = 2);
+
+	// Same as above for an actor seen by the scene capture that renders the measured target
+	static bool Compute(const AActor* Actor, const USceneCaptureComponent2D* Capture, FIntRect& OutRect, int32 Padding = 2);
+
+	// View projection matrix the scene capture renders TextureSize targets with
+	static FMatrix GetViewProjectionMatrix(const USceneCaptureComponent2D* Capture, FIntPoint TextureSize);
+};
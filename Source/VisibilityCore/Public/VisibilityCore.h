@@ -0,0 +1,23 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Modules/ModuleManager.h"
+
+// Shared runtime for the visibility metrics: the reduction pass framework, pooled readbacks and requests, result streams, the result cache, recording and capture, and screen rect helpers
+class FVisibilityCoreModule : public IModuleInterface
+{
+public:
+
+	/** IModuleInterface implementation */
+	virtual void StartupModule() override;
+	virtual void ShutdownModule() override;
+
+private:
+	FDelegateHandle EndFrameHandle;
+	FDelegateHandle CacheEndFrameHandle;
+	FDelegateHandle StreamsEndFrameHandle;
+	FDelegateHandle EndFrameRTHandle;
+	FDelegateHandle CaptureEndFrameRTHandle;
+};
@@ -0,0 +1,32 @@
+using UnrealBuildTool; 
+
+public class VisibilityCore: ModuleRules 
+
+{ 
+
+	public VisibilityCore(ReadOnlyTargetRules Target) : base(Target) 
+
+	{
+		PCHUsage = PCHUsageMode.UseExplicitOrSharedPCHs;
+		
+		PrivateIncludePaths.AddRange(new string[] 
+		{
+			"VisibilityCore/Private"
+		});
+		PublicDependencyModuleNames.Add("Core");
+		PublicDependencyModuleNames.Add("Engine");
+		// Public headers expose RDG and global shader types to the metric modules
+		PublicDependencyModuleNames.Add("RenderCore");
+		PublicDependencyModuleNames.Add("RHI");
+		// FImageView in the CPU reference
+		PublicDependencyModuleNames.Add("ImageCore");
+		
+		PrivateDependencyModuleNames.AddRange(new string[]
+		{
+			"CoreUObject",
+			"Renderer",
+			"Projects"
+		});
+	} 
+
+}
@@ -0,0 +1,177 @@
+#include "Encoding/VisibilityTelemetryEncoding.h"
+
+// Offset of the little endian uint16 NumRecords, patched by Finish
+static constexpr int32 VisibilityTelemetryNumRecordsOffset = 1;
+
+FVisibilityTelemetryEncoder::FVisibilityTelemetryEncoder(int32 InBatchBytes)
+	: BatchBytes(FMath::Max(InBatchBytes, MaxHeaderBytes + MaxRecordBytes))
+{
+	Buffer.Reserve(BatchBytes);
+	Scratch.Reserve(MaxRecordBytes);
+}
+
+void FVisibilityTelemetryEncoder::WriteVarint(TArray<uint8>& Out, uint64 Value)
+{
+	while (Value >= 0x80)
+	{
+		Out.Add((uint8)(Value | 0x80));
+		Value >>= 7;
+	}
+	Out.Add((uint8)Value);
+}
+
+void FVisibilityTelemetryEncoder::Begin(uint32 Sequence, uint32 IntervalStartMs, uint32 IntervalMs)
+{
+	Buffer.Reset();
+	Buffer.Add(Version);
+	Buffer.Add(0);
+	Buffer.Add(0);
+	WriteVarint(Buffer, Sequence);
+	WriteVarint(Buffer, IntervalStartMs);
+	WriteVarint(Buffer, IntervalMs);
+
+	NumRecords = 0;
+	Previous = FVisibilityTelemetryRecord();
+}
+
+bool FVisibilityTelemetryEncoder::Add(const FVisibilityTelemetryRecord& Record)
+{
+	if (NumRecords == MAX_uint16)
+	{
+		return false;
+	}
+
+	const bool bSameMetric = NumRecords > 0 && Record.MetricId == Previous.MetricId;
+	checkSlow(NumRecords == 0 || Record.MetricId > Previous.MetricId || (bSameMetric && Record.ObjectId > Previous.ObjectId));
+
+	Scratch.Reset();
+	WriteVarint(Scratch, Record.MetricId - (NumRecords > 0 ? Previous.MetricId : 0));
+	WriteVarint(Scratch, Record.ObjectId - (bSameMetric ? Previous.ObjectId : 0));
+	// Wrapping differences, so any int64 values round trip, f.e. Min = MIN_int64 and Max = MAX_int64
+	WriteVarint(Scratch, ZigZag((int64)((uint64)Record.Min - (bSameMetric ? (uint64)Previous.Min : 0))));
+	WriteVarint(Scratch, (uint64)Record.Max - (uint64)Record.Min);
+	WriteVarint(Scratch, (uint64)Record.Mean - (uint64)Record.Min);
+	WriteVarint(Scratch, Record.NumSamples);
+	WriteVarint(Scratch, Record.FramesVisible);
+
+	if (Buffer.Num() + Scratch.Num() > BatchBytes)
+	{
+		return false;
+	}
+
+	Buffer.Append(Scratch);
+	Previous = Record;
+	++NumRecords;
+	return true;
+}
+
+TArrayView<const uint8> FVisibilityTelemetryEncoder::Finish()
+{
+	Buffer[VisibilityTelemetryNumRecordsOffset] = (uint8)NumRecords;
+	Buffer[VisibilityTelemetryNumRecordsOffset + 1] = (uint8)(NumRecords >> 8);
+	return Buffer;
+}
+
+// Bounds checked reader of the varints of one batch
+class FVisibilityTelemetryBatchReader
+{
+public:
+	explicit FVisibilityTelemetryBatchReader(TArrayView<const uint8> InData)
+		: Data(InData)
+	{
+	}
+
+	bool ReadByte(uint8& OutValue)
+	{
+		if (Offset >= Data.Num())
+		{
+			return false;
+		}
+		OutValue = Data[Offset++];
+		return true;
+	}
+
+	bool ReadVarint(uint64& OutValue)
+	{
+		OutValue = 0;
+		for (int32 Shift = 0; Shift < 64; Shift += 7)
+		{
+			uint8 Byte;
+			if (!ReadByte(Byte))
+			{
+				return false;
+			}
+			OutValue |= (uint64)(Byte & 0x7f) << Shift;
+			if ((Byte & 0x80) == 0)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool ReadVarint32(uint32& OutValue)
+	{
+		uint64 Value;
+		if (!ReadVarint(Value) || Value > MAX_uint32)
+		{
+			return false;
+		}
+		OutValue = (uint32)Value;
+		return true;
+	}
+
+	bool IsAtEnd() const { return Offset == Data.Num(); }
+
+private:
+	TArrayView<const uint8> Data;
+	int32 Offset = 0;
+};
+
+bool FVisibilityTelemetryDecoder::Decode(TArrayView<const uint8> Batch, FVisibilityTelemetryBatchHeader& OutHeader, TArray<FVisibilityTelemetryRecord>& OutRecords)
+{
+	FVisibilityTelemetryBatchReader Reader(Batch);
+
+	uint8 Version, NumRecordsLow, NumRecordsHigh;
+	if (!Reader.ReadByte(Version) || Version != FVisibilityTelemetryEncoder::Version
+		|| !Reader.ReadByte(NumRecordsLow) || !Reader.ReadByte(NumRecordsHigh)
+		|| !Reader.ReadVarint32(OutHeader.Sequence)
+		|| !Reader.ReadVarint32(OutHeader.IntervalStartMs)
+		|| !Reader.ReadVarint32(OutHeader.IntervalMs))
+	{
+		return false;
+	}
+	OutHeader.NumRecords = NumRecordsLow | (NumRecordsHigh << 8);
+
+	const int32 FirstRecord = OutRecords.Num();
+	FVisibilityTelemetryRecord Previous;
+	for (int32 Index = 0; Index < OutHeader.NumRecords; ++Index)
+	{
+		uint64 MetricDelta, ObjectDelta, MinDelta, MaxOffset, MeanOffset;
+		FVisibilityTelemetryRecord Record;
+		if (!Reader.ReadVarint(MetricDelta) || !Reader.ReadVarint(ObjectDelta) || !Reader.ReadVarint(MinDelta)
+			|| !Reader.ReadVarint(MaxOffset) || !Reader.ReadVarint(MeanOffset)
+			|| !Reader.ReadVarint32(Record.NumSamples) || !Reader.ReadVarint32(Record.FramesVisible))
+		{
+			OutRecords.SetNum(FirstRecord);
+			return false;
+		}
+
+		const bool bSameMetric = Index > 0 && MetricDelta == 0;
+		Record.MetricId = (uint32)((Index > 0 ? Previous.MetricId : 0) + MetricDelta);
+		Record.ObjectId = (bSameMetric ? Previous.ObjectId : 0) + ObjectDelta;
+		Record.Min = (int64)((bSameMetric ? (uint64)Previous.Min : 0) + (uint64)FVisibilityTelemetryEncoder::UnZigZag(MinDelta));
+		Record.Max = (int64)((uint64)Record.Min + MaxOffset);
+		Record.Mean = (int64)((uint64)Record.Min + MeanOffset);
+
+		OutRecords.Add(Record);
+		Previous = Record;
+	}
+
+	if (!Reader.IsAtEnd())
+	{
+		OutRecords.SetNum(FirstRecord);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,326 @@
+#include "Exporter/VisibilityTelemetryExporter.h"
+#include "Recorder/VisibilityMpscRing.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/Runnable.h"
+#include "HAL/RunnableThread.h"
+#include "Misc/Paths.h"
+
+// Seconds the exporter thread sleeps between two drains of the ring
+static constexpr float VisibilityTelemetryDrainInterval = 0.01f;
+
+static TAutoConsoleVariable<float> CVarVisibilityTelemetryInterval(
+	TEXT("r.VisibilityTelemetry.Interval"),
+	1.0f,
+	TEXT("Seconds aggregated into one telemetry record per object and metric, for r.VisibilityTelemetry.Start"),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarVisibilityTelemetryBatchBytes(
+	TEXT("r.VisibilityTelemetry.BatchBytes"),
+	1200,
+	TEXT("Upper bound of an encoded telemetry batch in bytes, for r.VisibilityTelemetry.Start"),
+	ECVF_Default);
+
+std::atomic<bool> FVisibilityTelemetryExporter::bRunning{ false };
+std::atomic<int32> FVisibilityTelemetryExporter::NumRecording{ 0 };
+TUniquePtr<FVisibilityTelemetryExporter::FWorker> FVisibilityTelemetryExporter::Worker;
+FVisibilityTelemetryExporter::FStats FVisibilityTelemetryExporter::LastStats;
+
+class FVisibilityTelemetryExporter::FWorker : public FRunnable
+{
+public:
+	FWorker(TSharedRef<IVisibilityTelemetrySink, ESPMode::ThreadSafe> InSink, const FSettings& InSettings)
+		: Ring(InSettings.RingCapacity)
+		, Sink(MoveTemp(InSink))
+		, Encoder(FMath::Min(InSettings.BatchBytes, (int32)MAX_uint16))
+		, IntervalSeconds(FMath::Max(InSettings.IntervalSeconds, VisibilityTelemetryDrainInterval))
+	{
+	}
+
+	virtual ~FWorker()
+	{
+		delete Thread;
+	}
+
+	bool Launch()
+	{
+		StartTime = FPlatformTime::Seconds();
+		IntervalStartTime = StartTime;
+		Thread = FRunnableThread::Create(this, TEXT("VisibilityTelemetry"), 0, TPri_BelowNormal);
+		return Thread != nullptr;
+	}
+
+	// Game thread, once no producer can push anymore. Sends the interval in progress
+	void Finish()
+	{
+		bStopRequested = true;
+		Thread->WaitForCompletion();
+	}
+
+	virtual uint32 Run() override
+	{
+		while (!bStopRequested)
+		{
+			Drain();
+			if (FPlatformTime::Seconds() - IntervalStartTime >= IntervalSeconds)
+			{
+				SendInterval();
+			}
+			FPlatformProcess::Sleep(VisibilityTelemetryDrainInterval);
+		}
+		Drain();
+		SendInterval();
+		Sink->Flush();
+		return 0;
+	}
+
+	FStats GetStats() const
+	{
+		FStats Stats;
+		Stats.NumSamples = NumSamples.load(std::memory_order_relaxed);
+		Stats.NumDropped = NumDropped.load(std::memory_order_relaxed);
+		Stats.NumRecords = NumRecords.load(std::memory_order_relaxed);
+		Stats.NumBatches = NumBatches.load(std::memory_order_relaxed);
+		Stats.NumBytes = NumBytes.load(std::memory_order_relaxed);
+		Stats.NumLostBatches = NumLostBatches.load(std::memory_order_relaxed);
+		return Stats;
+	}
+
+	TVisibilityMpscRing<FVisibilityTelemetrySample> Ring;
+	std::atomic<uint64> NumDropped{ 0 };
+
+private:
+	struct FKey
+	{
+		uint32 MetricId;
+		uint64 ObjectId;
+
+		bool operator==(const FKey& Other) const { return MetricId == Other.MetricId && ObjectId == Other.ObjectId; }
+		// The order the encoder needs
+		bool operator<(const FKey& Other) const { return MetricId != Other.MetricId ? MetricId < Other.MetricId : ObjectId < Other.ObjectId; }
+
+		friend uint32 GetTypeHash(const FKey& Key)
+		{
+			return HashCombine(GetTypeHash(Key.MetricId), GetTypeHash(Key.ObjectId));
+		}
+	};
+
+	struct FAggregate
+	{
+		int64 Min;
+		int64 Max;
+		int64 Sum;
+		uint32 NumSamples;
+		uint32 FramesVisible;
+		uint32 LastVisibleFrame;
+	};
+
+	// Exporter thread. Takes at most one ring's worth of samples, so producers that keep up with it can't hold the
+	// interval back forever
+	void Drain()
+	{
+		for (uint32 NumDrained = 0; NumDrained < Ring.GetCapacity() && Ring.PopAll(Samples, 4096) > 0; NumDrained += Samples.Num())
+		{
+			for (const FVisibilityTelemetrySample& Sample : Samples)
+			{
+				const bool bVisible = Sample.Value > 0;
+				FAggregate* Aggregate = Aggregates.Find({ Sample.MetricId, Sample.ObjectId });
+				if (!Aggregate)
+				{
+					Aggregates.Add({ Sample.MetricId, Sample.ObjectId }, { Sample.Value, Sample.Value, Sample.Value, 1, bVisible ? 1u : 0u, Sample.FrameNumber });
+					continue;
+				}
+
+				Aggregate->Min = FMath::Min(Aggregate->Min, Sample.Value);
+				Aggregate->Max = FMath::Max(Aggregate->Max, Sample.Value);
+				Aggregate->Sum += Sample.Value;
+				++Aggregate->NumSamples;
+				// Several samples of a frame, f.e. from several captures, count it once
+				if (bVisible && (Aggregate->FramesVisible == 0 || Sample.FrameNumber != Aggregate->LastVisibleFrame))
+				{
+					++Aggregate->FramesVisible;
+					Aggregate->LastVisibleFrame = Sample.FrameNumber;
+				}
+			}
+			NumSamples.fetch_add(Samples.Num(), std::memory_order_relaxed);
+		}
+	}
+
+	// Exporter thread. Encodes the aggregates of the interval in key order and sends them
+	void SendInterval()
+	{
+		const double Now = FPlatformTime::Seconds();
+		const uint32 IntervalStartMs = (uint32)((IntervalStartTime - StartTime) * 1000.0);
+		const uint32 IntervalMs = (uint32)((Now - IntervalStartTime) * 1000.0);
+		IntervalStartTime = Now;
+
+		if (Aggregates.Num() == 0)
+		{
+			return;
+		}
+
+		Aggregates.KeySort([](const FKey& A, const FKey& B) { return A < B; });
+
+		Encoder.Begin(Sequence++, IntervalStartMs, IntervalMs);
+		for (const TPair<FKey, FAggregate>& Pair : Aggregates)
+		{
+			const FAggregate& Aggregate = Pair.Value;
+
+			FVisibilityTelemetryRecord Record;
+			Record.MetricId = Pair.Key.MetricId;
+			Record.ObjectId = Pair.Key.ObjectId;
+			Record.Min = Aggregate.Min;
+			Record.Max = Aggregate.Max;
+			Record.Mean = FMath::RoundToInt64((double)Aggregate.Sum / Aggregate.NumSamples);
+			Record.NumSamples = Aggregate.NumSamples;
+			Record.FramesVisible = Aggregate.FramesVisible;
+
+			if (!Encoder.Add(Record))
+			{
+				SendBatch();
+				Encoder.Begin(Sequence++, IntervalStartMs, IntervalMs);
+				verify(Encoder.Add(Record));
+			}
+		}
+		SendBatch();
+
+		NumRecords.fetch_add(Aggregates.Num(), std::memory_order_relaxed);
+		// Keeps the allocation, the same objects are usually measured again
+		Aggregates.Reset();
+	}
+
+	void SendBatch()
+	{
+		const TArrayView<const uint8> Batch = Encoder.Finish();
+		if (Sink->Send(Batch))
+		{
+			NumBatches.fetch_add(1, std::memory_order_relaxed);
+			NumBytes.fetch_add(Batch.Num(), std::memory_order_relaxed);
+		}
+		else
+		{
+			NumLostBatches.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	TSharedRef<IVisibilityTelemetrySink, ESPMode::ThreadSafe> Sink;
+	FVisibilityTelemetryEncoder Encoder;
+	const double IntervalSeconds;
+
+	FRunnableThread* Thread = nullptr;
+	std::atomic<bool> bStopRequested{ false };
+
+	// Exporter thread only
+	TArray<FVisibilityTelemetrySample> Samples;
+	TMap<FKey, FAggregate> Aggregates;
+	double StartTime = 0.0;
+	double IntervalStartTime = 0.0;
+	uint32 Sequence = 0;
+
+	std::atomic<uint64> NumSamples{ 0 };
+	std::atomic<uint64> NumRecords{ 0 };
+	std::atomic<uint64> NumBatches{ 0 };
+	std::atomic<uint64> NumBytes{ 0 };
+	std::atomic<uint64> NumLostBatches{ 0 };
+};
+
+bool FVisibilityTelemetryExporter::Start(TSharedRef<IVisibilityTelemetrySink, ESPMode::ThreadSafe> Sink, const FSettings& Settings)
+{
+	check(IsInGameThread());
+
+	Stop();
+
+	TUniquePtr<FWorker> NewWorker = MakeUnique<FWorker>(MoveTemp(Sink), Settings);
+	if (!NewWorker->Launch())
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Can't start the visibility telemetry exporter thread."));
+		return false;
+	}
+
+	Worker = MoveTemp(NewWorker);
+	bRunning.store(true, std::memory_order_release);
+	return true;
+}
+
+void FVisibilityTelemetryExporter::Stop()
+{
+	check(IsInGameThread());
+
+	if (!Worker)
+	{
+		return;
+	}
+
+	bRunning.store(false, std::memory_order_seq_cst);
+	// Producers that saw the export running may still be pushing
+	while (NumRecording.load(std::memory_order_seq_cst) > 0)
+	{
+		FPlatformProcess::YieldThread();
+	}
+
+	Worker->Finish();
+	LastStats = Worker->GetStats();
+	Worker.Reset();
+
+	UE_LOG(LogTemp, Display, TEXT("Visibility telemetry: %llu samples (%llu dropped) sent as %llu records in %llu batches, %llu bytes, %llu batches lost."),
+		LastStats.NumSamples, LastStats.NumDropped, LastStats.NumRecords, LastStats.NumBatches, LastStats.NumBytes, LastStats.NumLostBatches);
+}
+
+void FVisibilityTelemetryExporter::Record(uint32 MetricId, uint64 ObjectId, int64 Value, uint32 FrameNumber)
+{
+	if (!IsRunning())
+	{
+		return;
+	}
+
+	NumRecording.fetch_add(1, std::memory_order_seq_cst);
+	// Checked again, Stop may have started waiting in between
+	if (bRunning.load(std::memory_order_seq_cst) && !Worker->Ring.TryPush({ ObjectId, MetricId, FrameNumber, Value }))
+	{
+		Worker->NumDropped.fetch_add(1, std::memory_order_relaxed);
+	}
+	NumRecording.fetch_sub(1, std::memory_order_seq_cst);
+}
+
+FVisibilityTelemetryExporter::FStats FVisibilityTelemetryExporter::GetStats()
+{
+	return Worker ? Worker->GetStats() : LastStats;
+}
+
+static FAutoConsoleCommand CmdVisibilityTelemetryStart(
+	TEXT("r.VisibilityTelemetry.Start"),
+	TEXT("Exports aggregated visibility telemetry into the given file, Saved/Profiling/VisibilityTelemetry.vtel by default"),
+	FConsoleCommandWithArgsDelegate::CreateStatic([](const TArray<FString>& Args)
+	{
+		const FString Path = Args.Num() > 0 ? Args[0] : FPaths::Combine(FPaths::ProfilingDir(), TEXT("VisibilityTelemetry.vtel"));
+
+		TSharedRef<FVisibilityTelemetryFileSink, ESPMode::ThreadSafe> Sink = MakeShared<FVisibilityTelemetryFileSink, ESPMode::ThreadSafe>();
+		if (!Sink->Open(Path))
+		{
+			UE_LOG(LogTemp, Warning, TEXT("Can't write visibility telemetry to %s."), *Path);
+			return;
+		}
+
+		FVisibilityTelemetryExporter::FSettings Settings;
+		Settings.IntervalSeconds = CVarVisibilityTelemetryInterval.GetValueOnGameThread();
+		Settings.BatchBytes = CVarVisibilityTelemetryBatchBytes.GetValueOnGameThread();
+		if (FVisibilityTelemetryExporter::Start(Sink, Settings))
+		{
+			UE_LOG(LogTemp, Display, TEXT("Exporting visibility telemetry to %s."), *Path);
+		}
+	}));
+
+static FAutoConsoleCommand CmdVisibilityTelemetryStop(
+	TEXT("r.VisibilityTelemetry.Stop"),
+	TEXT("Stops r.VisibilityTelemetry.Start, sending the interval in progress"),
+	FConsoleCommandDelegate::CreateStatic(&FVisibilityTelemetryExporter::Stop));
+
+static FAutoConsoleCommand CmdVisibilityTelemetryStats(
+	TEXT("r.VisibilityTelemetry.Stats"),
+	TEXT("Prints the samples, records and bytes of the running or last telemetry export"),
+	FConsoleCommandDelegate::CreateLambda([]()
+	{
+		const FVisibilityTelemetryExporter::FStats Stats = FVisibilityTelemetryExporter::GetStats();
+		UE_LOG(LogTemp, Display, TEXT("Visibility telemetry: %llu samples (%llu dropped), %llu records, %llu batches, %llu bytes (%.2f bytes per sample), %llu batches lost."),
+			Stats.NumSamples, Stats.NumDropped, Stats.NumRecords, Stats.NumBatches, Stats.NumBytes,
+			Stats.NumSamples > 0 ? (double)Stats.NumBytes / Stats.NumSamples : 0.0, Stats.NumLostBatches);
+	}));
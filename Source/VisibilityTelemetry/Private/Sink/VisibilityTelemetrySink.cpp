@@ -0,0 +1,123 @@
+#include "Sink/VisibilityTelemetrySink.h"
+#include "HAL/FileManager.h"
+#include "Misc/Paths.h"
+
+bool FVisibilityTelemetryFileSink::Open(const FString& Path)
+{
+	IFileManager::Get().MakeDirectory(*FPaths::GetPath(Path), true);
+	File.Reset(IFileManager::Get().CreateFileWriter(*Path));
+	if (!File)
+	{
+		return false;
+	}
+
+	FVisibilityTelemetryFileHeader Header;
+	*File << Header;
+	return true;
+}
+
+bool FVisibilityTelemetryFileSink::Send(TArrayView<const uint8> Batch)
+{
+	if (!File || Batch.Num() > MAX_uint16)
+	{
+		return false;
+	}
+
+	uint16 Size = (uint16)Batch.Num();
+	*File << Size;
+	File->Serialize(const_cast<uint8*>(Batch.GetData()), Batch.Num());
+	return !File->IsError();
+}
+
+void FVisibilityTelemetryFileSink::Flush()
+{
+	if (File)
+	{
+		File->Flush();
+	}
+}
+
+bool FVisibilityTelemetryFileSink::ReadFile(const FString& Path, TArray<FVisibilityTelemetryRecord>& OutRecords, TArray<FVisibilityTelemetryBatchHeader>* OutHeaders)
+{
+	TUniquePtr<FArchive> Reader(IFileManager::Get().CreateFileReader(*Path));
+	if (!Reader)
+	{
+		return false;
+	}
+
+	FVisibilityTelemetryFileHeader Header;
+	*Reader << Header;
+	if (Reader->IsError() || Header.Magic != FVisibilityTelemetryFileHeader::ExpectedMagic || Header.Version != FVisibilityTelemetryFileHeader::CurrentVersion)
+	{
+		return false;
+	}
+
+	TArray<uint8> Batch;
+	while (Reader->Tell() < Reader->TotalSize())
+	{
+		uint16 Size = 0;
+		*Reader << Size;
+		if (Reader->IsError() || Reader->Tell() + Size > Reader->TotalSize())
+		{
+			return false;
+		}
+
+		Batch.SetNumUninitialized(Size);
+		Reader->Serialize(Batch.GetData(), Size);
+
+		FVisibilityTelemetryBatchHeader BatchHeader;
+		if (!FVisibilityTelemetryDecoder::Decode(Batch, BatchHeader, OutRecords))
+		{
+			return false;
+		}
+		if (OutHeaders)
+		{
+			OutHeaders->Add(BatchHeader);
+		}
+	}
+	return true;
+}
+
+bool FVisibilityTelemetryLoopbackSink::Send(TArrayView<const uint8> Batch)
+{
+	if (bFailSends.load(std::memory_order_relaxed))
+	{
+		return false;
+	}
+
+	FScopeLock ScopeLock(&Lock);
+	++NumBatches;
+	NumBytes += Batch.Num();
+
+	FVisibilityTelemetryBatchHeader Header;
+	if (!FVisibilityTelemetryDecoder::Decode(Batch, Header, Records))
+	{
+		++NumCorrupt;
+	}
+	return true;
+}
+
+void FVisibilityTelemetryLoopbackSink::TakeRecords(TArray<FVisibilityTelemetryRecord>& OutRecords)
+{
+	FScopeLock ScopeLock(&Lock);
+	OutRecords = MoveTemp(Records);
+	Records.Reset();
+}
+
+int32 FVisibilityTelemetryLoopbackSink::GetNumBatches() const
+{
+	FScopeLock ScopeLock(&Lock);
+	return NumBatches;
+}
+
+int64 FVisibilityTelemetryLoopbackSink::GetNumBytes() const
+{
+	FScopeLock ScopeLock(&Lock);
+	return NumBytes;
+}
+
+int32 FVisibilityTelemetryLoopbackSink::GetNumCorrupt() const
+{
+	FScopeLock ScopeLock(&Lock);
+	return NumCorrupt;
+}
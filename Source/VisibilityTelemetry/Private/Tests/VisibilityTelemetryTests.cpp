@@ -0,0 +1,343 @@
+#include "Encoding/VisibilityTelemetryEncoding.h"
+#include "Exporter/VisibilityTelemetryExporter.h"
+#include "Sink/VisibilityTelemetrySink.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace VisibilityTelemetryTests
+{
+	static FVisibilityTelemetryRecord MakeRecord(uint32 MetricId, uint64 ObjectId, int64 Min, int64 Max, int64 Mean, uint32 NumSamples, uint32 FramesVisible)
+	{
+		FVisibilityTelemetryRecord Record;
+		Record.MetricId = MetricId;
+		Record.ObjectId = ObjectId;
+		Record.Min = Min;
+		Record.Max = Max;
+		Record.Mean = Mean;
+		Record.NumSamples = NumSamples;
+		Record.FramesVisible = FramesVisible;
+		return Record;
+	}
+
+	static FString ToString(const FVisibilityTelemetryRecord& Record)
+	{
+		return FString::Printf(TEXT("metric %u object %llu min %lld max %lld mean %lld samples %u visible %u"),
+			Record.MetricId, Record.ObjectId, Record.Min, Record.Max, Record.Mean, Record.NumSamples, Record.FramesVisible);
+	}
+
+	// Reports the first mismatch
+	static bool TestRecords(FAutomationTestBase& Test, const TCHAR* What, const TArray<FVisibilityTelemetryRecord>& Actual, const TArray<FVisibilityTelemetryRecord>& Expected)
+	{
+		if (!Test.TestEqual(*FString::Printf(TEXT("%s: number of records"), What), Actual.Num(), Expected.Num()))
+		{
+			return false;
+		}
+		for (int32 Index = 0; Index < Expected.Num(); ++Index)
+		{
+			if (!(Actual[Index] == Expected[Index]))
+			{
+				Test.AddError(FString::Printf(TEXT("%s: record %d is {%s}, expected {%s}"), What, Index, *ToString(Actual[Index]), *ToString(Expected[Index])));
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Records the exporter should send for the samples of RecordSamples, sorted like the exporter sends them
+	static TArray<FVisibilityTelemetryRecord> GetExpectedRecords(uint32 MetricA, uint32 MetricB)
+	{
+		TArray<FVisibilityTelemetryRecord> Records;
+		// Frame 3 has two samples above 0 and counts once
+		Records.Add(MakeRecord(MetricA, 10, 0, 8, 5, 4, 2));
+		Records.Add(MakeRecord(MetricA, 11, -5, -3, -4, 2, 0));
+		// Mean 1.5 rounds to 2
+		Records.Add(MakeRecord(MetricB, 12, 1, 2, 2, 2, 2));
+		for (uint64 ObjectId = 1000; ObjectId < 1100; ++ObjectId)
+		{
+			Records.Add(MakeRecord(MetricB, ObjectId, (int64)ObjectId, (int64)ObjectId, (int64)ObjectId, 1, 1));
+		}
+		Records.Sort([](const FVisibilityTelemetryRecord& A, const FVisibilityTelemetryRecord& B)
+		{
+			return A.MetricId != B.MetricId ? A.MetricId < B.MetricId : A.ObjectId < B.ObjectId;
+		});
+		return Records;
+	}
+
+	// Returns the number of samples
+	static uint64 RecordSamples(uint32 MetricA, uint32 MetricB)
+	{
+		FVisibilityTelemetryExporter::Record(MetricA, 10, 4, 1);
+		FVisibilityTelemetryExporter::Record(MetricA, 10, 0, 2);
+		FVisibilityTelemetryExporter::Record(MetricA, 10, 8, 3);
+		FVisibilityTelemetryExporter::Record(MetricA, 10, 8, 3);
+		FVisibilityTelemetryExporter::Record(MetricA, 11, -3, 1);
+		FVisibilityTelemetryExporter::Record(MetricA, 11, -5, 2);
+		FVisibilityTelemetryExporter::Record(MetricB, 12, 1, 1);
+		FVisibilityTelemetryExporter::Record(MetricB, 12, 2, 2);
+		for (uint64 ObjectId = 1000; ObjectId < 1100; ++ObjectId)
+		{
+			FVisibilityTelemetryExporter::Record(MetricB, ObjectId, (int64)ObjectId, 1);
+		}
+		return 8 + 100;
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FVisibilityTelemetryVarintTest, "VisibilityTelemetry.Encoding.Varint", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FVisibilityTelemetryVarintTest::RunTest(const FString& Parameters)
+{
+	struct FVarintCase
+	{
+		uint64 Value;
+		TArray<uint8> Bytes;
+	};
+	const FVarintCase VarintCases[] =
+	{
+		{ 0, { 0x00 } },
+		{ 1, { 0x01 } },
+		{ 127, { 0x7f } },
+		{ 128, { 0x80, 0x01 } },
+		{ 300, { 0xac, 0x02 } },
+		{ MAX_uint32, { 0xff, 0xff, 0xff, 0xff, 0x0f } },
+		{ MAX_uint64, { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x01 } },
+	};
+	for (const FVarintCase& Case : VarintCases)
+	{
+		TArray<uint8> Bytes;
+		FVisibilityTelemetryEncoder::WriteVarint(Bytes, Case.Value);
+		TestTrue(*FString::Printf(TEXT("Varint of %llu"), Case.Value), Bytes == Case.Bytes);
+	}
+
+	struct FZigZagCase
+	{
+		int64 Value;
+		uint64 Encoded;
+	};
+	const FZigZagCase ZigZagCases[] =
+	{
+		{ 0, 0 },
+		{ -1, 1 },
+		{ 1, 2 },
+		{ -2, 3 },
+		{ MAX_int64, MAX_uint64 - 1 },
+		{ MIN_int64, MAX_uint64 },
+	};
+	for (const FZigZagCase& Case : ZigZagCases)
+	{
+		TestTrue(*FString::Printf(TEXT("ZigZag of %lld"), Case.Value), FVisibilityTelemetryEncoder::ZigZag(Case.Value) == Case.Encoded);
+		TestTrue(*FString::Printf(TEXT("UnZigZag of %llu"), Case.Encoded), FVisibilityTelemetryEncoder::UnZigZag(Case.Encoded) == Case.Value);
+	}
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FVisibilityTelemetryRoundTripTest, "VisibilityTelemetry.Encoding.RoundTrip", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FVisibilityTelemetryRoundTripTest::RunTest(const FString& Parameters)
+{
+	using namespace VisibilityTelemetryTests;
+
+	const TArray<FVisibilityTelemetryRecord> Records =
+	{
+		MakeRecord(1, 1, 0, 0, 0, 1, 0),
+		MakeRecord(1, 2, 5, 9, 7, 3, 2),
+		// Negative Min delta
+		MakeRecord(1, 3, -7, -1, -4, 2, 0),
+		// Full range, the Min delta and Max - Min wrap
+		MakeRecord(1, 1ull << 40, MIN_int64, MAX_int64, 0, MAX_uint32, MAX_uint32),
+		MakeRecord(1, MAX_uint64, MAX_int64, MAX_int64, MAX_int64, 1, 1),
+		// The metric changes, deltas restart from 0
+		MakeRecord(7, 1, 100, 200, 150, 4, 4),
+		MakeRecord(MAX_uint32, 0, -1, -1, -1, 1, 0),
+	};
+
+	FVisibilityTelemetryEncoder Encoder(MAX_uint16);
+	Encoder.Begin(3, 2000, 1000);
+	for (const FVisibilityTelemetryRecord& Record : Records)
+	{
+		TestTrue(*FString::Printf(TEXT("Add {%s}"), *ToString(Record)), Encoder.Add(Record));
+	}
+	const TArray<uint8> Batch(Encoder.Finish());
+
+	FVisibilityTelemetryBatchHeader Header;
+	TArray<FVisibilityTelemetryRecord> Decoded;
+	if (!TestTrue(TEXT("Decode"), FVisibilityTelemetryDecoder::Decode(Batch, Header, Decoded)))
+	{
+		return false;
+	}
+	TestEqual(TEXT("Sequence"), (int64)Header.Sequence, (int64)3);
+	TestEqual(TEXT("IntervalStartMs"), (int64)Header.IntervalStartMs, (int64)2000);
+	TestEqual(TEXT("IntervalMs"), (int64)Header.IntervalMs, (int64)1000);
+	TestEqual(TEXT("NumRecords"), Header.NumRecords, Records.Num());
+	TestRecords(*this, TEXT("Round trip"), Decoded, Records);
+
+	// The first record is the smallest one: one byte per field
+	FVisibilityTelemetryEncoder Smallest(MAX_uint16);
+	Smallest.Begin(0, 0, 0);
+	const int32 HeaderBytes = Smallest.Finish().Num();
+	Smallest.Add(Records[0]);
+	TestEqual(TEXT("Bytes of the smallest record"), Smallest.Finish().Num() - HeaderBytes, 7);
+
+	// A truncated batch fails and leaves the output alone
+	TArray<FVisibilityTelemetryRecord> Truncated = { Records[0] };
+	TestFalse(TEXT("Decode a truncated batch"), FVisibilityTelemetryDecoder::Decode(TArrayView<const uint8>(Batch).LeftChop(1), Header, Truncated));
+	TestEqual(TEXT("Records after a truncated batch"), Truncated.Num(), 1);
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FVisibilityTelemetryBatchSplitTest, "VisibilityTelemetry.Encoding.BatchSplit", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FVisibilityTelemetryBatchSplitTest::RunTest(const FString& Parameters)
+{
+	using namespace VisibilityTelemetryTests;
+
+	// The smallest batch still takes the largest record
+	FVisibilityTelemetryEncoder Smallest(1);
+	TestEqual(TEXT("Clamped BatchBytes"), Smallest.GetBatchBytes(), FVisibilityTelemetryEncoder::MaxHeaderBytes + FVisibilityTelemetryEncoder::MaxRecordBytes);
+	Smallest.Begin(MAX_uint32, MAX_uint32, MAX_uint32);
+	TestTrue(TEXT("Add the largest record"), Smallest.Add(MakeRecord(MAX_uint32, MAX_uint64, MIN_int64, MAX_int64, MAX_int64, MAX_uint32, MAX_uint32)));
+	TestEqual(TEXT("Largest batch"), Smallest.Finish().Num(), FVisibilityTelemetryEncoder::MaxHeaderBytes + FVisibilityTelemetryEncoder::MaxRecordBytes);
+
+	TArray<FVisibilityTelemetryRecord> Records;
+	for (int32 Index = 0; Index < 200; ++Index)
+	{
+		Records.Add(MakeRecord(Index < 100 ? 1 : 2, (uint64)Index * 1000, (int64)Index * Index - 5000, (int64)Index * Index, (int64)Index * Index - 10, Index + 1, Index / 2));
+	}
+
+	// Splits like the exporter
+	const int32 BatchBytes = 100;
+	FVisibilityTelemetryEncoder Encoder(BatchBytes);
+	TArray<FVisibilityTelemetryRecord> Decoded;
+	uint32 Sequence = 0;
+	int32 NumBatches = 0;
+	auto FinishBatch = [&]()
+	{
+		const TArrayView<const uint8> Batch = Encoder.Finish();
+		TestTrue(*FString::Printf(TEXT("Batch %u fits BatchBytes"), Sequence - 1), Batch.Num() <= BatchBytes);
+
+		FVisibilityTelemetryBatchHeader Header;
+		TestTrue(*FString::Printf(TEXT("Decode batch %u"), Sequence - 1), FVisibilityTelemetryDecoder::Decode(Batch, Header, Decoded));
+		TestEqual(TEXT("Sequence"), (int64)Header.Sequence, (int64)NumBatches);
+		++NumBatches;
+	};
+
+	Encoder.Begin(Sequence++, 0, 1000);
+	for (const FVisibilityTelemetryRecord& Record : Records)
+	{
+		if (!Encoder.Add(Record))
+		{
+			TestTrue(TEXT("A full batch has records"), Encoder.GetNumRecords() > 0);
+			FinishBatch();
+			Encoder.Begin(Sequence++, 0, 1000);
+			TestTrue(*FString::Printf(TEXT("Add {%s} to a new batch"), *ToString(Record)), Encoder.Add(Record));
+		}
+	}
+	FinishBatch();
+
+	TestTrue(TEXT("Several batches"), NumBatches > 1);
+	TestRecords(*this, TEXT("Split batches"), Decoded, Records);
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FVisibilityTelemetryRecordLimitTest, "VisibilityTelemetry.Encoding.RecordLimit", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FVisibilityTelemetryRecordLimitTest::RunTest(const FString& Parameters)
+{
+	using namespace VisibilityTelemetryTests;
+
+	// The exporter caps BatchBytes at 65535, where the size limit comes first. An encoder of larger batches stops at the
+	// uint16 NumRecords
+	FVisibilityTelemetryEncoder Encoder(1 << 20);
+	Encoder.Begin(0, 0, 0);
+	for (uint64 ObjectId = 1; ObjectId <= MAX_uint16; ++ObjectId)
+	{
+		if (!Encoder.Add(MakeRecord(1, ObjectId, 0, 0, 0, 1, 0)))
+		{
+			AddError(FString::Printf(TEXT("Add failed at record %llu"), ObjectId));
+			return false;
+		}
+	}
+	TestFalse(TEXT("Add past MAX_uint16 records"), Encoder.Add(MakeRecord(1, MAX_uint16 + 1, 0, 0, 0, 1, 0)));
+
+	FVisibilityTelemetryBatchHeader Header;
+	TArray<FVisibilityTelemetryRecord> Decoded;
+	TestTrue(TEXT("Decode"), FVisibilityTelemetryDecoder::Decode(Encoder.Finish(), Header, Decoded));
+	TestEqual(TEXT("NumRecords"), Header.NumRecords, (int32)MAX_uint16);
+	TestEqual(TEXT("Decoded records"), Decoded.Num(), (int32)MAX_uint16);
+	if (Decoded.Num() == MAX_uint16)
+	{
+		TestTrue(TEXT("Last record"), Decoded.Last() == MakeRecord(1, MAX_uint16, 0, 0, 0, 1, 0));
+	}
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FVisibilityTelemetryExporterTest, "VisibilityTelemetry.Exporter.Loopback", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter)
+
+bool FVisibilityTelemetryExporterTest::RunTest(const FString& Parameters)
+{
+	using namespace VisibilityTelemetryTests;
+
+	if (FVisibilityTelemetryExporter::IsRunning())
+	{
+		AddWarning(TEXT("Skipped, an export is running."));
+		return true;
+	}
+
+	const uint32 MetricA = FVisibilityTelemetryExporter::GetMetricId(TEXT("VisibilityTelemetryTestA"));
+	const uint32 MetricB = FVisibilityTelemetryExporter::GetMetricId(TEXT("VisibilityTelemetryTestB"));
+	const TArray<FVisibilityTelemetryRecord> Expected = GetExpectedRecords(MetricA, MetricB);
+
+	FVisibilityTelemetryExporter::FSettings Settings;
+	// Every sample lands in the interval Stop sends
+	Settings.IntervalSeconds = 3600.f;
+	Settings.BatchBytes = 100;
+
+	{
+		TSharedRef<FVisibilityTelemetryLoopbackSink, ESPMode::ThreadSafe> Sink = MakeShared<FVisibilityTelemetryLoopbackSink, ESPMode::ThreadSafe>();
+		if (!TestTrue(TEXT("Start"), FVisibilityTelemetryExporter::Start(Sink, Settings)))
+		{
+			return false;
+		}
+		const uint64 NumSamples = RecordSamples(MetricA, MetricB);
+		FVisibilityTelemetryExporter::Stop();
+
+		TArray<FVisibilityTelemetryRecord> Received;
+		Sink->TakeRecords(Received);
+		TestRecords(*this, TEXT("Loopback"), Received, Expected);
+
+		const FVisibilityTelemetryExporter::FStats Stats = FVisibilityTelemetryExporter::GetStats();
+		TestEqual(TEXT("NumSamples"), (int64)Stats.NumSamples, (int64)NumSamples);
+		TestEqual(TEXT("NumDropped"), (int64)Stats.NumDropped, (int64)0);
+		TestEqual(TEXT("NumRecords"), (int64)Stats.NumRecords, (int64)Expected.Num());
+		TestTrue(TEXT("Several batches"), Stats.NumBatches > 1);
+		TestEqual(TEXT("NumBatches"), (int64)Stats.NumBatches, (int64)Sink->GetNumBatches());
+		TestEqual(TEXT("NumBytes"), (int64)Stats.NumBytes, Sink->GetNumBytes());
+		TestTrue(TEXT("Batches fit BatchBytes"), Stats.NumBytes <= Stats.NumBatches * Settings.BatchBytes);
+		TestEqual(TEXT("NumLostBatches"), (int64)Stats.NumLostBatches, (int64)0);
+		TestEqual(TEXT("Corrupt batches"), Sink->GetNumCorrupt(), 0);
+	}
+
+	{
+		TSharedRef<FVisibilityTelemetryLoopbackSink, ESPMode::ThreadSafe> Sink = MakeShared<FVisibilityTelemetryLoopbackSink, ESPMode::ThreadSafe>();
+		Sink->SetFailSends(true);
+		if (!TestTrue(TEXT("Start failing"), FVisibilityTelemetryExporter::Start(Sink, Settings)))
+		{
+			return false;
+		}
+		RecordSamples(MetricA, MetricB);
+		FVisibilityTelemetryExporter::Stop();
+
+		TArray<FVisibilityTelemetryRecord> Received;
+		Sink->TakeRecords(Received);
+		TestEqual(TEXT("Records received by a failing sink"), Received.Num(), 0);
+
+		const FVisibilityTelemetryExporter::FStats Stats = FVisibilityTelemetryExporter::GetStats();
+		TestEqual(TEXT("NumRecords of a failing sink"), (int64)Stats.NumRecords, (int64)Expected.Num());
+		TestEqual(TEXT("NumBatches of a failing sink"), (int64)Stats.NumBatches, (int64)0);
+		TestEqual(TEXT("NumBytes of a failing sink"), (int64)Stats.NumBytes, (int64)0);
+		TestTrue(TEXT("NumLostBatches of a failing sink"), Stats.NumLostBatches > 1);
+	}
+	return true;
+}
+
+#endif
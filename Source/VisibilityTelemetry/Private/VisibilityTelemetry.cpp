@@ -0,0 +1,20 @@
+// Copyright Epic Games, Inc. All Rights Reserved.
+
+#include "VisibilityTelemetry.h"
+#include "Exporter/VisibilityTelemetryExporter.h"
+
+#define LOCTEXT_NAMESPACE "FVisibilityTelemetryModule"
+
+void FVisibilityTelemetryModule::StartupModule()
+{
+}
+
+void FVisibilityTelemetryModule::ShutdownModule()
+{
+	// Sends the interval in progress
+	FVisibilityTelemetryExporter::Stop();
+}
+
+#undef LOCTEXT_NAMESPACE
+	
+IMPLEMENT_MODULE(FVisibilityTelemetryModule, VisibilityTelemetry)
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+// Aggregate of one metric of one object over one interval
+struct FVisibilityTelemetryRecord
+{
+	// FVisibilityRecorder::GetMetricId of the metric name
+	uint32 MetricId = 0;
+	// Given with the samples, f.e. the unique id of the measured actor
+	uint64 ObjectId = 0;
+	int64 Min = 0;
+	int64 Max = 0;
+	// Rounded to the nearest integer
+	int64 Mean = 0;
+	uint32 NumSamples = 0;
+	// Frames with at least one sample above 0
+	uint32 FramesVisible = 0;
+
+	bool operator==(const FVisibilityTelemetryRecord& Other) const
+	{
+		return MetricId == Other.MetricId && ObjectId == Other.ObjectId && Min == Other.Min && Max == Other.Max
+			&& Mean == Other.Mean && NumSamples == Other.NumSamples && FramesVisible == Other.FramesVisible;
+	}
+};
+
+struct FVisibilityTelemetryBatchHeader
+{
+	// Counts the batches of an export from 0, gaps are lost batches
+	uint32 Sequence = 0;
+	// Milliseconds since the export started
+	uint32 IntervalStartMs = 0;
+	uint32 IntervalMs = 0;
+	int32 NumRecords = 0;
+};
+
+// Encodes sorted records into self-contained batches of at most BatchBytes.
+//
+// Layout, integers are LEB128 varints unless noted:
+//   uint8 Version, uint16 NumRecords (little endian), Sequence, IntervalStartMs, IntervalMs
+//   per record: MetricId delta, ObjectId delta (from 0 when the metric changes), zigzag Min delta (from 0 when the
+//   metric changes), Max - Min, Mean - Min, NumSamples, FramesVisible
+// Deltas are taken from the previous record of the batch, so records must be added sorted by MetricId then ObjectId.
+// A batch decodes on its own: a lost batch only loses its records
+class VISIBILITYTELEMETRY_API FVisibilityTelemetryEncoder
+{
+public:
+	static constexpr uint8 Version = 1;
+	// Version, NumRecords and three 32 bit varints
+	static constexpr int32 MaxHeaderBytes = 3 + 3 * 5;
+	// Three 32 bit and four 64 bit varints
+	static constexpr int32 MaxRecordBytes = 3 * 5 + 4 * 10;
+
+	explicit FVisibilityTelemetryEncoder(int32 InBatchBytes);
+
+	void Begin(uint32 Sequence, uint32 IntervalStartMs, uint32 IntervalMs);
+
+	// False when the record does not fit: Finish the batch and Begin the next one
+	bool Add(const FVisibilityTelemetryRecord& Record);
+
+	// The encoded batch, valid until the next Begin
+	TArrayView<const uint8> Finish();
+
+	int32 GetNumRecords() const { return NumRecords; }
+	int32 GetBatchBytes() const { return BatchBytes; }
+
+	static void WriteVarint(TArray<uint8>& Out, uint64 Value);
+	static uint64 ZigZag(int64 Value) { return ((uint64)Value << 1) ^ (uint64)(Value >> 63); }
+	static int64 UnZigZag(uint64 Value) { return (int64)(Value >> 1) ^ -(int64)(Value & 1); }
+
+private:
+	int32 BatchBytes;
+	TArray<uint8> Buffer;
+	TArray<uint8> Scratch;
+	int32 NumRecords = 0;
+	FVisibilityTelemetryRecord Previous;
+};
+
+class VISIBILITYTELEMETRY_API FVisibilityTelemetryDecoder
+{
+public:
+	// Appends the records of one batch to OutRecords. False, with OutRecords unchanged, for truncated or corrupt batches
+	static bool Decode(TArrayView<const uint8> Batch, FVisibilityTelemetryBatchHeader& OutHeader, TArray<FVisibilityTelemetryRecord>& OutRecords);
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Delivery/VisibilityResultStream.h"
+#include "Recorder/VisibilityRecorder.h"
+#include "Sink/VisibilityTelemetrySink.h"
+#include <atomic>
+
+// One measurement handed to the exporter
+struct FVisibilityTelemetrySample
+{
+	uint64 ObjectId;
+	uint32 MetricId;
+	uint32 FrameNumber;
+	int64 Value;
+};
+
+// Exports visibility results to an analytics backend at a fraction of the bandwidth and game thread cost of one event
+// per result.
+//
+// Record pushes a 24 byte sample into a lock-free ring and returns, from any thread. A background thread aggregates the
+// samples per object and metric over fixed intervals (min, max, mean, frames visible), encodes the aggregates with
+// deltas and varints into self-contained batches of bounded size (FVisibilityTelemetryEncoder) and hands them to a
+// pluggable sink. Start and Stop on the game thread, or with the r.VisibilityTelemetry.Start [File] and
+// r.VisibilityTelemetry.Stop console commands
+class VISIBILITYTELEMETRY_API FVisibilityTelemetryExporter
+{
+public:
+	struct FSettings
+	{
+		// Seconds aggregated into one record per object and metric
+		float IntervalSeconds = 1.f;
+		// Upper bound of an encoded batch, at most 65535. The default fits a UDP datagram
+		int32 BatchBytes = 1200;
+		// Samples the ring holds between two drains of the exporter thread
+		uint32 RingCapacity = 1 << 16;
+	};
+
+	struct FStats
+	{
+		uint64 NumSamples = 0;
+		// Samples dropped because the ring was full
+		uint64 NumDropped = 0;
+		uint64 NumRecords = 0;
+		uint64 NumBatches = 0;
+		uint64 NumBytes = 0;
+		// Batches the sink failed to deliver
+		uint64 NumLostBatches = 0;
+	};
+
+	// Stops a running export first
+	static bool Start(TSharedRef<IVisibilityTelemetrySink, ESPMode::ThreadSafe> Sink, const FSettings& Settings = FSettings());
+	// Sends the interval in progress and flushes the sink
+	static void Stop();
+
+	static bool IsRunning() { return bRunning.load(std::memory_order_acquire); }
+
+	// Any thread, never blocks. Values are integers: raw channels like PixelCount as is, normalized values quantized by
+	// the caller. A sample above 0 counts its frame as visible. Costs one atomic load while no export runs
+	static void Record(uint32 MetricId, uint64 ObjectId, int64 Value, uint32 FrameNumber);
+
+	// Records the items of a result stream drain, with their Tag as object id. GetValue maps a result to its value
+	template<typename TResult, typename TGetValue>
+	static void RecordStreamItems(uint32 MetricId, TArrayView<const TVisibilityStreamItem<TResult>> Items, TGetValue GetValue)
+	{
+		if (!IsRunning())
+		{
+			return;
+		}
+		for (const TVisibilityStreamItem<TResult>& Item : Items)
+		{
+			Record(MetricId, Item.Tag, GetValue(Item.Result), Item.FrameNumber);
+		}
+	}
+
+	// Same ids as the recorder, the CRC32 of the metric name
+	static uint32 GetMetricId(const TCHAR* MetricName) { return FVisibilityRecorder::GetMetricId(MetricName); }
+
+	// Of the running or last export
+	static FStats GetStats();
+
+private:
+	class FWorker;
+
+	static std::atomic<bool> bRunning;
+	// Producers inside Record, Stop waits for them before it frees the ring
+	static std::atomic<int32> NumRecording;
+	static TUniquePtr<FWorker> Worker;
+	static FStats LastStats;
+};
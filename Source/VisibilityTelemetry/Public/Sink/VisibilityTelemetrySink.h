@@ -0,0 +1,77 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Encoding/VisibilityTelemetryEncoding.h"
+#include <atomic>
+
+// Where the exporter sends its encoded batches. Implement it to ship them to a backend, f.e. over HTTP or UDP.
+// Every call comes from the exporter thread
+class IVisibilityTelemetrySink
+{
+public:
+	virtual ~IVisibilityTelemetrySink() = default;
+
+	// Batch is one self-contained encoded batch, only valid during the call. Returns false when it could not be
+	// delivered, the exporter counts it as lost
+	virtual bool Send(TArrayView<const uint8> Batch) = 0;
+
+	// After the last batch, when the exporter stops
+	virtual void Flush() {}
+};
+
+struct FVisibilityTelemetryFileHeader
+{
+	// "VTEL"
+	static constexpr uint32 ExpectedMagic = 0x4c455456;
+	static constexpr uint32 CurrentVersion = 1;
+
+	uint32 Magic = ExpectedMagic;
+	uint32 Version = CurrentVersion;
+
+	friend FArchive& operator<<(FArchive& Ar, FVisibilityTelemetryFileHeader& Header)
+	{
+		return Ar << Header.Magic << Header.Version;
+	}
+};
+
+// Appends the batches to a local file: FVisibilityTelemetryFileHeader, then a uint16 size and the bytes of each batch
+class VISIBILITYTELEMETRY_API FVisibilityTelemetryFileSink : public IVisibilityTelemetrySink
+{
+public:
+	bool Open(const FString& Path);
+
+	virtual bool Send(TArrayView<const uint8> Batch) override;
+	virtual void Flush() override;
+
+	// Reads the records of a file written by this sink. Stops at the first truncated or corrupt batch, false then
+	static bool ReadFile(const FString& Path, TArray<FVisibilityTelemetryRecord>& OutRecords, TArray<FVisibilityTelemetryBatchHeader>* OutHeaders = nullptr);
+
+private:
+	TUniquePtr<FArchive> File;
+};
+
+// Decodes every batch it receives and keeps the records in memory, to check the exporter offline without a backend
+class VISIBILITYTELEMETRY_API FVisibilityTelemetryLoopbackSink : public IVisibilityTelemetrySink
+{
+public:
+	virtual bool Send(TArrayView<const uint8> Batch) override;
+
+	// Any thread. Moves out the records received so far, in the order they were sent
+	void TakeRecords(TArray<FVisibilityTelemetryRecord>& OutRecords);
+
+	int32 GetNumBatches() const;
+	int64 GetNumBytes() const;
+	// Batches that did not decode
+	int32 GetNumCorrupt() const;
+
+	// Any thread. While set, Send fails, to exercise the exporter's loss accounting
+	void SetFailSends(bool bFail) { bFailSends.store(bFail, std::memory_order_relaxed); }
+
+private:
+	mutable FCriticalSection Lock;
+	TArray<FVisibilityTelemetryRecord> Records;
+	int32 NumBatches = 0;
+	int64 NumBytes = 0;
+	int32 NumCorrupt = 0;
+	std::atomic<bool> bFailSends{ false };
+};
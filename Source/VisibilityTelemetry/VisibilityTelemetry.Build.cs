@@ -0,0 +1,27 @@
+using UnrealBuildTool; 
+
+public class VisibilityTelemetry: ModuleRules 
+
+{ 
+
+	public VisibilityTelemetry(ReadOnlyTargetRules Target) : base(Target) 
+
+	{
+		PCHUsage = PCHUsageMode.UseExplicitOrSharedPCHs;
+		
+		PrivateIncludePaths.AddRange(new string[] 
+		{
+			"VisibilityTelemetry/Private"
+		});
+		PublicDependencyModuleNames.Add("Core");
+		// Result streams in the public exporter header
+		PublicDependencyModuleNames.Add("VisibilityCore");
+		
+		PrivateDependencyModuleNames.AddRange(new string[]
+		{
+			"CoreUObject",
+			"Engine"
+		});
+	} 
+
+}